@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#if BENCH_HOST
+#include <time.h>
+#else
+#include "pico/stdlib.h"
+#include "hardware/structs/systick.h"
+#endif
+
+#include "bench.h"
+
+static uint32_t g_bench_overhead;
+
+#if BENCH_HOST
+uint32_t bench_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint32_t) ((now.tv_sec * 1000000000ull) + now.tv_nsec);
+}
+
+static inline uint32_t bench_raw_elapsed(uint32_t start, uint32_t end)
+{
+    return end - start;
+}
+#else
+uint32_t bench_now(void)
+{
+    return systick_hw->cvr;
+}
+
+static inline uint32_t bench_raw_elapsed(uint32_t start, uint32_t end)
+{
+    // Counts down
+    return (start - end) & BENCH_COUNTER_MASK;
+}
+#endif
+
+void bench_timer_init(void)
+{
+#if !BENCH_HOST
+    systick_hw->csr = 0;
+    systick_hw->rvr = BENCH_COUNTER_MASK;
+    systick_hw->cvr = 0;
+    // Enabled, counting the processor clock
+    systick_hw->csr = 0x5;
+#endif
+
+    // Smallest back to back reading
+    g_bench_overhead = UINT32_MAX;
+    for (uint8_t i = 0; i < 16; i++) {
+        uint32_t start = bench_now();
+        uint32_t end = bench_now();
+        uint32_t elapsed = bench_raw_elapsed(start, end);
+
+        if (elapsed < g_bench_overhead) {
+            g_bench_overhead = elapsed;
+        }
+    }
+}
+
+uint32_t bench_elapsed(uint32_t start, uint32_t end)
+{
+    uint32_t elapsed = bench_raw_elapsed(start, end);
+
+    return elapsed > g_bench_overhead ? elapsed - g_bench_overhead : 0;
+}
+
+void bench_print_header(void)
+{
+    printf("bench,param,value,iterations,total,per_iter,unit\n");
+}
+
+void bench_report(const char *bench, const char *param, uint32_t value, uint32_t iterations, uint32_t total)
+{
+    printf("%s,%s,%lu,%lu,%lu,%lu,%s\n", bench, param, (unsigned long) value,
+        (unsigned long) iterations, (unsigned long) total,
+        (unsigned long) (total / iterations), BENCH_UNIT);
+}
@@ -0,0 +1,40 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+/*
+ * Timing for the microbenchmarks. On the device everything is measured in
+ * core clock cycles with SysTick. The host build uses the monotonic clock
+ * in nanoseconds, which is only good for comparing results with each
+ * other.
+ *
+ * Results are printed as CSV, one row per benchmark and parameter value:
+ *
+ *     bench,param,value,iterations,total,per_iter,unit
+ */
+
+#include <stdint.h>
+
+#if BENCH_HOST
+#define BENCH_UNIT "ns"
+#else
+#define BENCH_UNIT "cycles"
+#endif
+
+// SysTick is a 24 bit down counter, so each timed block has to finish
+// within 2^24 cycles (about 130ms at 125MHz)
+#define BENCH_COUNTER_MASK 0x00ffffff
+
+void bench_timer_init(void);
+
+uint32_t bench_now(void);
+
+/*
+ * Time between two bench_now() readings, less the cost of the readings
+ * themselves
+ */
+uint32_t bench_elapsed(uint32_t start, uint32_t end);
+
+void bench_print_header(void);
+
+void bench_report(const char *bench, const char *param, uint32_t value, uint32_t iterations, uint32_t total);
+
+#endif
@@ -0,0 +1,374 @@
+/*
+ * Microbenchmarks for the primitives on the note path. Each one is run
+ * BENCH_ITERATIONS times per parameter value and the results printed as
+ * CSV (see bench.h), so runs can be diffed to catch regressions.
+ *
+ * Only the hardware independent benchmarks are built on the host.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bench.h"
+#include "lkp_stack.h"
+#include "midi.h"
+
+#if !BENCH_HOST
+#include "pico/stdlib.h"
+#include "pico/util/queue.h"
+#include "hardware/adc.h"
+#include "hardware/spi.h"
+
+#include "hardware_config.h"
+#include "io.h"
+#include "mcp4921.h"
+#include "scale.h"
+#include "sched.h"
+#include "tuning.h"
+#include "voice.h"
+#endif
+
+#define BENCH_ITERATIONS 100
+
+// Key id that is never in the stack before it is pushed
+#define BENCH_KEY 49
+
+static struct lkp_stack g_stack;
+
+/*
+ * Pushing and popping the newest key with a varying number of keys
+ * already held
+ */
+static void bench_lkp(void)
+{
+    for (uint8_t held = 0; held < MAX_KEY_PRESSES; held++) {
+        uint32_t push_total = 0;
+        uint32_t pop_total = 0;
+
+        lkp_stack_init(&g_stack);
+        for (uint8_t i = 0; i < held; i++) {
+            lkp_push_key(&g_stack, i + 1);
+        }
+
+        for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+            uint32_t start = bench_now();
+            lkp_push_key(&g_stack, BENCH_KEY);
+            uint32_t end = bench_now();
+            push_total += bench_elapsed(start, end);
+
+            start = bench_now();
+            lkp_pop_key(&g_stack, BENCH_KEY);
+            end = bench_now();
+            pop_total += bench_elapsed(start, end);
+        }
+
+        bench_report("lkp_push_key", "held", held, BENCH_ITERATIONS, push_total);
+        bench_report("lkp_pop_key", "held", held, BENCH_ITERATIONS, pop_total);
+    }
+}
+
+static uint32_t bench_null_writer(const uint8_t packets[][MIDI_PACKET_LEN], uint32_t count)
+{
+    (void) packets;
+    return count;
+}
+
+/*
+ * Batching a chord worth of note ons and flushing it
+ */
+static void bench_midi_batch(void)
+{
+    static struct midi_batch batch;
+
+    for (uint8_t chord = 1; chord <= 6; chord++) {
+        uint32_t total = 0;
+
+        for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+            midi_batch_init(&batch);
+
+            uint32_t start = bench_now();
+            for (uint8_t note = 0; note < chord; note++) {
+                midi_note_on(&batch, 0, 60 + note, 100);
+            }
+            midi_batch_flush(&batch, bench_null_writer);
+            uint32_t end = bench_now();
+
+            total += bench_elapsed(start, end);
+        }
+
+        bench_report("midi_batch_chord", "notes", chord, BENCH_ITERATIONS, total);
+    }
+}
+
+#if !BENCH_HOST
+static struct mcp4921 g_dac;
+static struct scale_table g_table;
+static struct tuning g_tuning;
+
+static int bench_init_dac(void)
+{
+    memset(&g_dac, 0, sizeof(struct mcp4921));
+
+    g_dac.clk_pin = DAC_PIN_SCK;
+    g_dac.cs_pin = DAC_PIN_CS;
+    g_dac.mosi_pin = DAC_PIN_MOSI;
+    g_dac.spi_inst = spi1;
+    g_dac.refv = DAC_REFV;
+    g_dac.clock_speed = DAC_CLK_SPEED;
+    g_dac.hw_cs = 1;
+    mcp4921_set_dac(&g_dac, MCP4921_DAC_A);
+    mcp4921_set_buff(&g_dac, MCP4921_VREF_BUFFERED);
+    mcp4921_set_gain(&g_dac, MCP4921_GAIN_1X);
+    mcp4921_set_shdn(&g_dac, MCP4921_SHDN_ON);
+
+    return mcp4921_init(&g_dac);
+}
+
+static uint16_t bench_key_to_code(uint32_t key_id)
+{
+    return scale_lookup(&g_table, key_id);
+}
+
+/*
+ * Key to DAC code lookup on the note path, and rebuilding the whole table
+ * when the scale changes
+ */
+static void bench_scale(void)
+{
+    struct scale_config config = {0};
+    volatile uint16_t sink = 0;
+    uint32_t total = 0;
+
+    tuning_set_12tet(&g_tuning);
+
+    for (uint8_t scale = 0; scale < SCALE_NUM_SCALES; scale++) {
+        config.scale = scale;
+        total = 0;
+
+        for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+            uint32_t start = bench_now();
+            scale_build_table(&config, &g_tuning, &g_dac, &g_table);
+            uint32_t end = bench_now();
+            total += bench_elapsed(start, end);
+        }
+
+        bench_report("scale_build_table", "scale", scale, BENCH_ITERATIONS, total);
+    }
+
+    total = 0;
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+        uint32_t start = bench_now();
+        sink = bench_key_to_code(KEY_C1 + (i % MAX_KEYBED_KEY));
+        uint32_t end = bench_now();
+        total += bench_elapsed(start, end);
+    }
+
+    bench_report("key_to_code", "none", 0, BENCH_ITERATIONS, total);
+    (void) sink;
+}
+
+/*
+ * Single channel and dual channel DAC updates at a range of SPI clocks
+ */
+static void bench_dac(void)
+{
+    static const uint32_t speeds_hz[] = {1000000, 4000000, 10000000, 20000000};
+
+    for (uint8_t s = 0; s < sizeof(speeds_hz) / sizeof(speeds_hz[0]); s++) {
+        uint32_t single_total = 0;
+        uint32_t dual_total = 0;
+        uint32_t output_total = 0;
+
+        spi_set_baudrate(g_dac.spi_inst, speeds_hz[s]);
+
+        for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+            uint32_t start = bench_now();
+            mcp4921_set_code(&g_dac, MCP4921_DAC_A, i);
+            uint32_t end = bench_now();
+            single_total += bench_elapsed(start, end);
+
+            start = bench_now();
+            mcp4921_set_codes(&g_dac, i, i);
+            end = bench_now();
+            dual_total += bench_elapsed(start, end);
+
+            start = bench_now();
+            mcp4921_set_output(&g_dac, 1.0f);
+            end = bench_now();
+            output_total += bench_elapsed(start, end);
+        }
+
+        bench_report("mcp4921_set_code", "spi_hz", speeds_hz[s], BENCH_ITERATIONS, single_total);
+        bench_report("mcp4921_set_codes", "spi_hz", speeds_hz[s], BENCH_ITERATIONS, dual_total);
+        bench_report("mcp4921_set_output", "spi_hz", speeds_hz[s], BENCH_ITERATIONS, output_total);
+    }
+
+    spi_set_baudrate(g_dac.spi_inst, g_dac.clock_speed);
+}
+
+/*
+ * The sampling loop of io_analog_read(), without the settling delays
+ */
+static void bench_adc(void)
+{
+    static const uint16_t samples[] = {1, 4, 16, 30};
+    volatile uint32_t sink = 0;
+
+    adc_init();
+    adc_gpio_init(ANALOG_IN_PIN);
+    adc_select_input(ANALOG_IN_CHANNEL);
+
+    for (uint8_t s = 0; s < sizeof(samples) / sizeof(samples[0]); s++) {
+        uint32_t total = 0;
+
+        for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+            uint32_t acc = 0;
+
+            uint32_t start = bench_now();
+            for (uint16_t j = 0; j < samples[s]; j++) {
+                acc += adc_read();
+            }
+            sink = acc / samples[s];
+            uint32_t end = bench_now();
+
+            total += bench_elapsed(start, end);
+        }
+
+        bench_report("adc_read_avg", "samples", samples[s], BENCH_ITERATIONS, total);
+    }
+
+    (void) sink;
+}
+
+/*
+ * A push and a pop of each kind of inter-core queue entry
+ */
+static void bench_queue(void)
+{
+    static queue_t queue;
+    uint32_t total = 0;
+
+    io_event_t event = 0;
+    queue_init(&queue, sizeof(io_event_t), IO_EVENT_QUEUE_SIZE);
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+        uint32_t start = bench_now();
+        queue_try_add(&queue, &event);
+        queue_try_remove(&queue, &event);
+        uint32_t end = bench_now();
+        total += bench_elapsed(start, end);
+    }
+    queue_free(&queue);
+    bench_report("queue_io_event", "bytes", sizeof(io_event_t), BENCH_ITERATIONS, total);
+
+    struct io_key_frame frame = {0};
+    total = 0;
+    queue_init(&queue, sizeof(struct io_key_frame), IO_FRAME_QUEUE_SIZE);
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+        uint32_t start = bench_now();
+        queue_try_add(&queue, &frame);
+        queue_try_remove(&queue, &frame);
+        uint32_t end = bench_now();
+        total += bench_elapsed(start, end);
+    }
+    queue_free(&queue);
+    bench_report("queue_key_frame", "bytes", sizeof(struct io_key_frame), BENCH_ITERATIONS, total);
+}
+
+/*
+ * Pressing and releasing a chord in each voice mode
+ */
+static void bench_voice(void)
+{
+    static struct voice_state voices;
+
+    if (sched_init() || voice_init(&voices, &g_dac, bench_key_to_code)) {
+        printf("# voice init failed\n");
+        return;
+    }
+
+    for (uint8_t mode = 0; mode < VOICE_NUM_MODES; mode++) {
+        voice_set_mode(&voices, mode);
+
+        for (uint8_t chord = 1; chord <= 6; chord++) {
+            uint64_t keys = 0;
+            uint32_t press_total = 0;
+            uint32_t release_total = 0;
+
+            lkp_stack_init(&g_stack);
+
+            for (uint8_t i = 0; i < chord; i++) {
+                keys |= IO_KEY_BIT(KEY_C2 + (i * 2));
+            }
+
+            for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+                for (uint64_t k = keys; k; k &= k - 1) {
+                    lkp_push_key(&g_stack, __builtin_ctzll(k));
+                }
+
+                uint32_t start = bench_now();
+                voice_key_frame(&voices, &g_stack, keys, 0);
+                uint32_t end = bench_now();
+                press_total += bench_elapsed(start, end);
+
+                for (uint64_t k = keys; k; k &= k - 1) {
+                    lkp_pop_key(&g_stack, __builtin_ctzll(k));
+                }
+
+                start = bench_now();
+                voice_key_frame(&voices, &g_stack, 0, keys);
+                end = bench_now();
+                release_total += bench_elapsed(start, end);
+            }
+
+            char name[32];
+            snprintf(name, sizeof(name), "voice_press_mode%u", mode);
+            bench_report(name, "chord", chord, BENCH_ITERATIONS, press_total);
+            snprintf(name, sizeof(name), "voice_release_mode%u", mode);
+            bench_report(name, "chord", chord, BENCH_ITERATIONS, release_total);
+        }
+    }
+
+    voice_set_mode(&voices, VOICE_MODE_MONO);
+}
+#endif
+
+int main(void)
+{
+#if !BENCH_HOST
+    stdio_init_all();
+
+    // Give the host a chance to open the port
+    while (!stdio_usb_connected()) {
+        sleep_ms(100);
+    }
+#endif
+
+    bench_timer_init();
+    bench_print_header();
+
+    bench_lkp();
+    bench_midi_batch();
+
+#if !BENCH_HOST
+    if (bench_init_dac()) {
+        printf("# DAC init failed\n");
+    } else {
+        bench_scale();
+        bench_dac();
+        bench_voice();
+    }
+
+    bench_adc();
+    bench_queue();
+#endif
+
+    printf("# done\n");
+
+#if !BENCH_HOST
+    while (true) {
+        tight_loop_contents();
+    }
+#endif
+
+    return 0;
+}
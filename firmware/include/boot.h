@@ -0,0 +1,43 @@
+#ifndef __BOOT_H__
+#define __BOOT_H__
+/*
+ * Boot time measurement. Each milestone is stamped with time_us_32() the
+ * first time it's reached. The timer starts from 0 at reset, so the
+ * stamps are time since reset.
+ *
+ * The keyboard is playable once the first scan is done and the DAC has
+ * been written. USB and the stored settings come up after that, from the
+ * main loop.
+ */
+
+#include <stdint.h>
+#include "pico/stdlib.h"
+
+enum boot_mark {
+    BOOT_MARK_FIRST_DAC = 0, // Idle CV written
+    BOOT_MARK_CORE1 = 1, // io_main() started
+    BOOT_MARK_FIRST_SCAN = 2, // Whole matrix scanned once
+    BOOT_MARK_SETTINGS = 3, // Stored settings and tuning in effect
+    BOOT_MARK_USB = 4, // USB stack started, enumeration is up to the host
+    BOOT_NUM_MARKS = 5
+};
+
+extern volatile uint32_t g_boot_marks[BOOT_NUM_MARKS];
+
+/*
+ * Stamps a milestone. Later calls for the same one are ignored. Safe to
+ * call from either core.
+ */
+static inline void boot_mark(uint8_t mark)
+{
+    if (!g_boot_marks[mark]) {
+        g_boot_marks[mark] = time_us_32() | 1; // Never 0
+    }
+}
+
+/*
+ * Prints the milestones on stdio
+ */
+void boot_print(void);
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+/*
+ * Master clock engine. Runs on core1 and generates CLOCK_PPQN ticks per
+ * quarter note from one of:
+ *
+ *  - An internal timer, with the tempo set by the clock speed knob
+ *  - Pulses on SYNC_IN, which are subdivided up to CLOCK_PPQN using an
+ *    estimate of the period between them
+ *  - MIDI clock (0xF8) bytes received on the MIDI UART
+ *
+ * Everything that needs to follow the clock registers a listener, which
+ * is called from interrupt context on core1 for every tick and transport
+ * change.
+ *
+ * Ticks are always evenly spaced. Anything that plays in steps (eg
+ * SYNC_OUT with SYNC_OUT_PPQN_STEPS) follows CLOCK_STEP events instead,
+ * which carry the swing and groove. Each step can be held back by up to a step. The
+ * delays are fixed point fractions of a step (CLOCK_GROOVE_ONE being a
+ * whole one), turned in to microseconds whenever the tempo, division or
+ * feel changes, so a step's time is its straight time plus one table
+ * entry.
+ */
+
+#include <stdint.h>
+#include "pico/stdlib.h"
+
+// Internal resolution of the clock. Matches MIDI clock.
+#define CLOCK_PPQN 24
+
+#define CLOCK_DEFAULT_BPM 120
+#define CLOCK_MIN_BPM 30
+#define CLOCK_MAX_BPM 300
+
+#define CLOCK_SYNC_IN_DEFAULT_PPQN 4
+
+// If an external source doesn't send a pulse for this long it is
+// considered gone and the period estimate starts over
+#define CLOCK_EXT_TIMEOUT_US (2 * 1000 * 1000)
+
+#define CLOCK_MAX_LISTENERS 8
+
+#define CLOCK_DEFAULT_STEPS_PER_QUARTER 4
+
+// Swing is how much of each pair of steps the first one gets, in percent
+#define CLOCK_MIN_SWING 50
+#define CLOCK_MAX_SWING 75
+
+// Length of the groove templates. A bar of 16ths at the default division.
+#define CLOCK_GROOVE_STEPS 16
+
+// Fixed point for groove offsets. This much is a whole step.
+#define CLOCK_GROOVE_ONE 256
+
+enum clock_source {
+    CLOCK_SRC_INTERNAL = 0,
+    CLOCK_SRC_SYNC_IN = 1,
+    CLOCK_SRC_MIDI = 2,
+    CLOCK_NUM_SOURCES = 3
+};
+
+enum clock_event {
+    CLOCK_TICK = 0,
+    CLOCK_START = 1,
+    CLOCK_STOP = 2,
+    CLOCK_CONTINUE = 3,
+    // Passes the number of steps since start instead of the tick
+    CLOCK_STEP = 4
+};
+
+enum clock_groove {
+    CLOCK_GROOVE_STRAIGHT = 0,
+    // Backbeats a little late
+    CLOCK_GROOVE_LAID_BACK = 1,
+    // Small uneven delays, like someone playing it in
+    CLOCK_GROOVE_HUMAN = 2,
+    CLOCK_NUM_GROOVES = 3
+};
+
+/*
+ * Smoothed estimate of the period between external clock pulses. Used
+ * for both SYNC_IN and MIDI clock.
+ */
+struct clock_period_est {
+    uint64_t last_pulse_us;
+    uint32_t period_us; // 0 until two pulses have been seen
+};
+
+/*
+ * Where the clock was as of its last event, for code on core0 that needs
+ * to line up with it
+ */
+struct clock_position {
+    uint32_t tick;
+    uint32_t tick_us; // time_us_32() when the event was sent out
+    uint32_t tick_period_us;
+    uint8_t running;
+};
+
+/*
+ * Called for every tick and transport change. tick is the number of
+ * ticks since the clock was last started.
+ */
+typedef void (*clock_listener_t)(uint8_t event, uint32_t tick);
+
+/*
+ * Resets the period estimate
+ */
+static inline void clock_period_est_reset(struct clock_period_est *est)
+{
+    est->last_pulse_us = 0;
+    est->period_us = 0;
+}
+
+/*
+ * Feeds a pulse seen at now_us in to the estimate. Returns the updated
+ * period estimate, or 0 if there isn't one yet.
+ */
+uint32_t clock_period_est_update(struct clock_period_est *est, uint64_t now_us);
+
+/*
+ * Initializes the clock state. Called from core0 before core1 is started.
+ */
+int clock_init(void);
+
+/*
+ * Starts generating ticks using alarms from the given pool. Must be
+ * called on core1.
+ */
+void clock_run(alarm_pool_t *pool);
+
+/*
+ * Called from core0 after core1 has been reset part way through running
+ * the clock, before clock_run() is called again with a new pool. The
+ * clock carries on from the same tick.
+ */
+void clock_recover(void);
+
+/*
+ * Registers a function to be called on every clock event. Must be called
+ * before clock_run(). Returns 0 on success.
+ */
+int clock_add_listener(clock_listener_t listener);
+
+/*
+ * Feeds an external clock pulse from the given source in to the engine.
+ * Called from the SYNC_IN and MIDI UART interrupt handlers on core1.
+ */
+void clock_ext_pulse(uint8_t source);
+
+/*
+ * Applies a transport change (CLOCK_START, CLOCK_STOP, CLOCK_CONTINUE)
+ * received from an external source. Must be called on core1.
+ */
+void clock_ext_transport(uint8_t source, uint8_t event);
+
+/*
+ * Picks the clock source based on whether a sync cable is plugged in and
+ * whether MIDI clock has been seen recently. Called regularly from the
+ * io loop on core1.
+ */
+void clock_update_source(uint8_t sync_cable_connected);
+
+/*
+ * Requests a transport change (CLOCK_START, CLOCK_STOP, CLOCK_CONTINUE).
+ * Safe to call from core0. Takes effect on the next tick.
+ */
+void clock_request_transport(uint8_t event);
+
+/*
+ * Sets the internal clock tempo. Safe to call from core0. Takes effect on
+ * the next tick.
+ */
+void clock_set_bpm(uint16_t bpm);
+
+/*
+ * Sets the number of SYNC_IN pulses per quarter note. Must divide
+ * CLOCK_PPQN. Returns 0 on success.
+ */
+int clock_set_sync_in_ppqn(uint8_t ppqn);
+
+uint8_t clock_get_sync_in_ppqn(void);
+
+/*
+ * Sets the step length. Must divide CLOCK_PPQN. Safe to call from core0.
+ * Returns 0 on success.
+ */
+int clock_set_steps_per_quarter(uint8_t steps);
+
+uint8_t clock_get_steps_per_quarter(void);
+
+/*
+ * Sets the swing, clamped to CLOCK_MIN_SWING - CLOCK_MAX_SWING. Safe to
+ * call from core0.
+ */
+void clock_set_swing(uint8_t swing);
+
+uint8_t clock_get_swing(void);
+
+/*
+ * Picks a groove template. Safe to call from core0. Returns 0 on success.
+ */
+int clock_set_groove(uint8_t groove);
+
+uint8_t clock_get_groove(void);
+
+/*
+ * Returns the current estimate of the time between ticks
+ */
+uint32_t clock_get_tick_period_us(void);
+
+uint8_t clock_get_source(void);
+
+/*
+ * Copies out the position as of the last tick or transport change. Safe
+ * to call from core0, including from interrupts.
+ */
+void clock_read_position(struct clock_position *position);
+
+uint8_t clock_is_running(void);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef __CONSOLE_H__
+#define __CONSOLE_H__
+/*
+ * Line based command interface on the stdio console. Used to upload
+ * tunings in Scala format (see util/scl_upload.py):
+ *
+ *     tuning scl <slot>     following lines are a .scl file
+ *     tuning kbm            following lines are a .kbm file (optional)
+ *     tuning end            parses, stores and replies "tuning: ok"
+ *     tuning select <slot>  switches to a stored tuning, 0 being 12-TET
+ *
+ * to set up SYNC_OUT (see sync_out.h):
+ *
+ *     sync                  prints the current setup
+ *     sync ppqn <n>         pulses per quarter note, 1, 2, 4, 24 or 48, or 0
+ *                           for a pulse per step with the swing and groove
+ *     sync width <us>       clock pulse width
+ *     sync thru <0|1>       passes SYNC_IN straight through
+ *
+ * to set up the LFO on channel B (see lfo.h):
+ *
+ *     lfo                   prints the current setup and update stats
+ *     lfo shape <n>         0 off, 1 sine, 2 triangle, 3 saw, 4 square, 5 S&H
+ *     lfo rate <mhz>        free runs at this rate
+ *     lfo sync <division>   follows the clock, 0 being 4 bars and 8 a 16th
+ *     lfo depth <percent>   peak to peak swing
+ *
+ * and for profiling:
+ *
+ *     xip                   prints the XIP cache hit and miss counts
+ *     xip reset             zeroes them
+ *     boot                  prints the boot milestones (see boot.h)
+ *     health                prints the core1 health checks (see health.h)
+ *     keys                  prints the held keys and their matrix row/col
+ *
+ * Everything runs from console_task() in the main loop.
+ */
+
+#include <stdint.h>
+
+#define CONSOLE_LINE_LEN 96
+
+// Max number of characters read per call to console_task()
+#define CONSOLE_READ_BUDGET 64
+
+/*
+ * Called when the tuning in a slot has been replaced, with select clear,
+ * or when a slot has been selected, with select set.
+ */
+typedef void (*console_tuning_callback_t)(uint8_t slot, uint8_t select);
+
+int console_init(console_tuning_callback_t on_tuning);
+
+/*
+ * Reads and handles whatever console input is waiting
+ */
+void console_task(void);
+
+#endif
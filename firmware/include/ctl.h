@@ -0,0 +1,126 @@
+#ifndef __CTL_H__
+#define __CTL_H__
+/*
+ * Binary control protocol on the second USB CDC interface, for host tools
+ * (see util/kbctl.py). The console stays on the first one.
+ *
+ * Every message is a single frame (see frame.h). Requests are
+ *
+ *     cmd, seq, args...
+ *
+ * and each one gets a response of
+ *
+ *     cmd | CTL_RESPONSE, seq, status, data...
+ *
+ * Multi byte values are little endian. Frames that fail their CRC are
+ * dropped without a response, and counted. Stats pushed by CTL_CMD_STREAM
+ * come as CTL_CMD_STATS responses with a seq of 0.
+ *
+ *     CTL_CMD_PING          -> version, max payload (u16)
+ *     CTL_CMD_PARAM_GET     id -> id, value (i32)
+ *     CTL_CMD_PARAM_SET     id, value (i32) -> id, value as set
+ *     CTL_CMD_TUNING_READ   slot -> slot, struct tuning
+ *     CTL_CMD_TUNING_WRITE  slot, struct tuning -> slot
+ *     CTL_CMD_TUNING_SELECT slot -> slot
+ *     CTL_CMD_PATTERN_READ  slot -> slot, pattern
+ *     CTL_CMD_PATTERN_WRITE slot, pattern -> slot
+ *     CTL_CMD_STATS         -> CTL_STATS_VERSION, then the counters as u32s
+ *     CTL_CMD_STREAM        interval_ms (u16), 0 to stop -> nothing
+ *
+ * Patterns are stored as they are sent, up to KV_PATTERN_MAX_LEN bytes.
+ *
+ * Everything runs from ctl_task() in the main loop. Frames are read
+ * straight in to a single receive buffer and decoded where they are.
+ * The bytes come and go through a struct ctl_io, which is the USB CDC
+ * interface on the device (see usb_ctl.h) and a pty in the host tests.
+ */
+
+#include <stdint.h>
+
+#include "settings.h"
+
+#define CTL_VERSION 1
+
+#define CTL_MAX_PAYLOAD 256
+
+#define CTL_RESPONSE 0x80
+
+// Pattern slots run from KV_KEY_PATTERN_BASE
+#define CTL_PATTERN_SLOTS KV_PATTERN_SLOTS
+
+#define CTL_STATS_VERSION 2
+
+// Fastest that stats can be streamed
+#define CTL_MIN_STREAM_INTERVAL_MS 10
+
+enum ctl_cmd {
+    CTL_CMD_PING = 0x01,
+    CTL_CMD_PARAM_GET = 0x02,
+    CTL_CMD_PARAM_SET = 0x03,
+    CTL_CMD_TUNING_READ = 0x04,
+    CTL_CMD_TUNING_WRITE = 0x05,
+    CTL_CMD_TUNING_SELECT = 0x06,
+    CTL_CMD_PATTERN_READ = 0x07,
+    CTL_CMD_PATTERN_WRITE = 0x08,
+    CTL_CMD_STATS = 0x09,
+    CTL_CMD_STREAM = 0x0a
+};
+
+enum ctl_status {
+    CTL_OK = 0,
+    CTL_ERR_UNKNOWN_CMD = 1,
+    CTL_ERR_BAD_ARGS = 2,
+    CTL_ERR_FAILED = 3,
+    CTL_ERR_EMPTY = 4
+};
+
+// Keep in sync with PARAMS in util/kbctl.py
+enum ctl_param {
+    CTL_PARAM_BPM = 0,
+    CTL_PARAM_STEPS_PER_QUARTER = 1,
+    CTL_PARAM_SWING = 2,
+    CTL_PARAM_GROOVE = 3,
+    CTL_PARAM_SYNC_IN_PPQN = 4,
+    CTL_PARAM_SYNC_OUT_PPQN = 5,
+    CTL_PARAM_SYNC_OUT_WIDTH_US = 6,
+    CTL_PARAM_SYNC_OUT_THRU = 7,
+    CTL_PARAM_LOOPER_GRID = 8,
+    CTL_PARAM_LFO_SHAPE = 9,
+    CTL_PARAM_LFO_SYNC = 10,
+    CTL_PARAM_LFO_RATE_MHZ = 11,
+    CTL_PARAM_LFO_DIVISION = 12,
+    CTL_PARAM_LFO_DEPTH = 13,
+    CTL_NUM_PARAMS = 14
+};
+
+/*
+ * Same as console_tuning_callback_t
+ */
+typedef void (*ctl_tuning_callback_t)(uint8_t slot, uint8_t select);
+
+/*
+ * Where the protocol's bytes come from and go to
+ */
+struct ctl_io {
+    // Reads up to len bytes of whatever has come in, without waiting.
+    // Returns the number read.
+    uint32_t (*read)(uint8_t *buf, uint32_t len);
+    // Sends a whole frame, without waiting. Returns 1 if there wasn't room
+    // for it, in which case none of it is sent.
+    int (*write)(const uint8_t *frame, uint32_t len);
+};
+
+int ctl_init(const struct ctl_io *io, ctl_tuning_callback_t on_tuning);
+
+/*
+ * Handles any requests that have come in, and streams stats when due
+ */
+void ctl_task(void);
+
+/*
+ * Returns the number of frames that were dropped for being malformed or
+ * too long
+ */
+uint32_t ctl_bad_frames(void);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef __FRAME_H__
+#define __FRAME_H__
+/*
+ * Framing for the binary control protocol (see ctl.h). A frame is a
+ * payload followed by its CRC-16/CCITT-FALSE (little endian), COBS
+ * encoded so that it contains no zero bytes, and then a single zero
+ * byte as the delimiter.
+ *
+ * Nothing in here depends on the SDK, so it builds on the host as well.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FRAME_DELIMITER 0x00
+#define FRAME_CRC_LEN 2
+
+// Worst case size of an encoded frame, including the delimiter
+#define FRAME_ENCODED_LEN(payload_len) \
+    ((payload_len) + FRAME_CRC_LEN + (((payload_len) + FRAME_CRC_LEN) / 254) + 2)
+
+uint16_t frame_crc16(const uint8_t *data, size_t len);
+
+/*
+ * Encodes payload in to out, which must hold FRAME_ENCODED_LEN(len)
+ * bytes. Returns the number of bytes written, delimiter included.
+ */
+size_t frame_encode(const uint8_t *payload, size_t len, uint8_t *out);
+
+/*
+ * Decodes a frame in place. buf holds the encoded bytes up to but not
+ * including the delimiter. Returns the length of the payload, which is
+ * left at the start of buf, or -1 if the frame is malformed or fails its
+ * CRC.
+ */
+int frame_decode(uint8_t *buf, size_t len);
+
+#endif
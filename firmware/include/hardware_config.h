@@ -20,6 +20,10 @@
 #define LED3_PIN 13 // GP13
 #define LED4_PIN 12 // GP12
 
+// Gate for the second voice. There are no spare pins, so this shares
+// the LED4 header pin.
+#define GATE2_OUT_PIN LED4_PIN
+
 #define SHIFT_REG_CLK_PIN 27 // GP27
 #define SHIFT_REG_DATA_PIN 28 // GP28
 
@@ -43,6 +47,13 @@
 #define SYNC_IN_PIN 3 // GP3
 #define SYNC_OUT_PIN 4 // GP4
 
+// DIN/TRS MIDI. These are the default stdio UART pins, so stdio
+// is routed over USB instead.
+#define MIDI_UART uart0
+#define MIDI_UART_IRQ UART0_IRQ
+#define MIDI_TX_PIN 0 // GP0
+#define MIDI_RX_PIN 1 // GP1
+
 #define ANALOG_IN_PIN 26 // GP26
 #define ANALOG_IN_CHANNEL 0
 
@@ -59,5 +70,13 @@
 #define MASK_CLK_DIV (3 << 6)
 #define MASK_SUB_MODE (4 << 6)
 #define MASK_GND (5 << 6)
+#define MASK_CV1 (6 << 6)
+#define MASK_CV2 (7 << 6)
+
+// External CV on the spare mux channels. The input network scales
+// 0 to CV_IN_RANGE_MV down to the ADC's full range. Only CV1 is read,
+// CV2 is wired up but has nothing to do yet.
+#define NUM_CV_INPUTS 1
+#define CV_IN_RANGE_MV 5000
 
 #endif
@@ -0,0 +1,50 @@
+#ifndef __HEALTH_H__
+#define __HEALTH_H__
+/*
+ * Keeps an eye on core1. The heartbeat counters that it bumps (see io.h)
+ * are checked from the main loop, and if either stops moving for
+ * HEALTH_STALL_US core1 is reset and started again with io_restart().
+ *
+ * The hardware watchdog is fed from the same check, so it covers core0
+ * hanging. It's also the last resort for core1: once core1 has had to be
+ * restarted HEALTH_MAX_RECOVERIES times within HEALTH_RECOVERY_WINDOW_US,
+ * the watchdog is left to reset the whole chip.
+ */
+
+#include <stdint.h>
+
+#define HEALTH_CHECK_INTERVAL_US (10 * 1000)
+
+// The scan timer runs every KEY_PROBE_INTERVAL_US at the slowest, and the
+// CV inputs are read every IO_CV_INTERVAL_US
+#define HEALTH_STALL_US (100 * 1000)
+
+#define HEALTH_MAX_RECOVERIES 3
+#define HEALTH_RECOVERY_WINDOW_US (10 * 1000 * 1000)
+
+// Comfortably longer than a flash sector erase, which holds up the main
+// loop with interrupts off
+#define HEALTH_WATCHDOG_MS 1000
+
+struct health_stats {
+    uint32_t checks;
+    uint32_t late_checks; // Main loop was held up for over two intervals
+    uint32_t scan_stalls;
+    uint32_t analog_stalls;
+    uint32_t recoveries; // Times core1 was restarted
+    uint8_t watchdog_reboot; // The last reset was the watchdog's doing
+};
+
+/*
+ * Starts the watchdog. Must be called once core1 is running.
+ */
+int health_init(void);
+
+/*
+ * Checks core1 and feeds the watchdog. Called from the main loop.
+ */
+void health_task(void);
+
+void health_get_stats(struct health_stats *stats);
+
+#endif
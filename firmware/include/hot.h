@@ -0,0 +1,26 @@
+#ifndef __HOT_H__
+#define __HOT_H__
+/*
+ * Marks interrupt handlers and everything they call. Code normally runs
+ * straight out of flash through the XIP cache, so a handler that misses
+ * the cache stalls while the line is fetched over QSPI. Building with the
+ * KEYBOARD_HOT_IN_RAM CMake option puts marked functions in SRAM instead,
+ * which makes their timing predictable.
+ *
+ * util/hot_report.py lists anything reachable from a handler that is
+ * still in flash.
+ */
+
+#include "pico/platform.h"
+
+#ifndef KEYBOARD_HOT_IN_RAM
+#define KEYBOARD_HOT_IN_RAM 0
+#endif
+
+#if KEYBOARD_HOT_IN_RAM
+#define HOT_FUNC(func) __time_critical_func(func)
+#else
+#define HOT_FUNC(func) func
+#endif
+
+#endif
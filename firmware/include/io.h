@@ -2,11 +2,26 @@
 #define __KEYS_H__
 
 #include <stdint.h>
+#include <stdbool.h>
+
+#include "keymap.h"
 
 typedef uint32_t io_event_t;
 
 #define IO_EVENT_QUEUE_SIZE 20
 
+// Each entry holds every key change from one scan of the matrix
+#define IO_FRAME_QUEUE_SIZE 8
+
+// The key scan drops to an idle probe once no keys have been held for
+// this long
+#define IO_SCAN_IDLE_TIMEOUT_US (250 * 1000)
+
+// The external CV input is read this often, the pots one at a time
+// every IO_POT_INTERVAL_US
+#define IO_CV_INTERVAL_US 1000
+#define IO_POT_INTERVAL_US 5000
+
 #define IO_MODE_ARP 0
 #define IO_MODE_SEQ 1
 
@@ -18,29 +33,93 @@ enum io_event {
     IO_PORTAMENTO_CHANGED = 4,
     IO_CLK_DIV_CHANGED = 5,
     IO_SUB_MODE_CHANGED = 6,
-    IO_MODE_CHANGED = 7
+    IO_MODE_CHANGED = 7,
+    IO_CV_TRANSPOSE_CHANGED = 8 // Value is a signed number of semitones
 };
 
+// Numbered in the order they're listed in KEYMAP, see keymap.h
+#define IO_KEY_ID(key, ...) key,
+
 enum key_id {
     KEY_NONE = 0,
-    KEY_C1 = 1, KEY_CS1 = 2, KEY_D1 = 3, KEY_DS1 = 4, 
-    KEY_E1 = 5, KEY_F1 = 6, KEY_FS1 = 7, KEY_G1 = 8, 
-    KEY_GS1 = 9, KEY_A1 = 10, KEY_AS1 = 11, KEY_B1 = 12,
-    KEY_C2 = 13, KEY_CS2 = 14, KEY_D2 = 15, KEY_DS2 = 16, 
-    KEY_E2 = 17, KEY_F2 = 18, KEY_FS2 = 19, KEY_G2 = 20, 
-    KEY_GS2 = 21, KEY_A2 = 22, KEY_AS2 = 23, KEY_B2 = 24,
-    KEY_C3 = 25, KEY_CS3 = 26, KEY_D3 = 27, KEY_DS3 = 28, 
-    KEY_E3 = 29, KEY_F3 = 30, KEY_FS3 = 31, KEY_G3 = 32, 
-    KEY_GS3 = 33, KEY_A3 = 34, KEY_AS3 = 35, KEY_B3 = 36,
-    KEY_C4 = 37, KEY_CS4 = 38, KEY_D4 = 39, KEY_DS4 = 40, 
-    KEY_E4 = 41, KEY_F4 = 42, KEY_FS4 = 43, KEY_G4 = 44, 
-    KEY_GS4 = 45, KEY_A4 = 46, KEY_AS4 = 47, KEY_B4 = 48,
-    KEY_C5 = 49, KEY_OCTAVE_UP=50, KEY_OCTAVE_DOWN=51, KEY_PLAY_PAUSE=52,
-    KEY_RECORD=53, KEY_STOP=54, KEY_REST=55, KEY_HOLD=56, 
-    KEY_FUNC=57, KEY_MODE=58
+    KEYMAP(IO_KEY_ID)
+    NUM_KEYS
 };
 
-#define MAX_KEYBED_KEY 49
+#undef IO_KEY_ID
+
+// io_key_frame masks have a bit per key_id
+_Static_assert(NUM_KEYS <= 64, "key_ids don't fit in a io_key_frame mask");
+
+// Bit for a key in io_key_frame masks
+#define IO_KEY_BIT(key_id) (1ULL << (key_id))
+
+#define IO_KEYBED_BIT(key, row, col, kind, ...) | (KEYMAP_KIND_##kind ? IO_KEY_BIT(key) : 0)
+
+// Every keybed key in a io_key_frame mask
+#define IO_KEYBED_KEYS (0 KEYMAP(IO_KEYBED_BIT))
+
+#define IO_KEYBED_COUNT(key, row, col, kind, ...) + KEYMAP_KIND_##kind
+
+// The keybed keys come straight after KEY_NONE, so the last one's key_id
+// is the number of them
+#define MAX_KEYBED_KEY (0 KEYMAP(IO_KEYBED_COUNT))
+
+_Static_assert(IO_KEYBED_KEYS == IO_KEY_BIT(MAX_KEYBED_KEY + 1) - IO_KEY_BIT(KEY_NONE + 1),
+    "keybed keys must come first in KEYMAP");
+
+// Where each key sits in the matrix
+struct io_key_position {
+    uint8_t row;
+    uint8_t col;
+};
+
+// Inverse of the matrix, generated from KEYMAP along with it
+extern const struct io_key_position key_positions[NUM_KEYS];
+
+/*
+ * All of the key changes from one scan of the matrix
+ */
+struct io_key_frame {
+    uint64_t pressed; // IO_KEY_BIT of each key that went down
+    uint64_t released; // IO_KEY_BIT of each key that came up
+    uint32_t timestamp; // time_us_32() at the end of the scan
+};
+
+/*
+ * Every key that core1 has reported as down, along with how many frames
+ * it took to report them
+ */
+struct io_key_snapshot {
+    uint64_t keys;
+    uint32_t frames_posted;
+};
+
+struct io_scan_stats {
+    uint32_t frames; // Full scans of the matrix
+    uint32_t probes; // Idle probes
+    uint32_t idle_entries;
+    uint32_t wakes;
+    // Time from a probe seeing a key to the first event being pushed
+    uint32_t last_wake_latency_us;
+    uint32_t max_wake_latency_us;
+    // Frames that had to be merged in to the next one
+    uint32_t frame_queue_full;
+    // Time between calls to the scan timer, and calls that came more than
+    // twice their delay after the last one
+    uint32_t min_poll_period_us;
+    uint32_t max_poll_period_us;
+    uint32_t late_polls;
+};
+
+/*
+ * Counters that core1 bumps to show it's alive. scans goes up on every
+ * call to the scan timer, analog on every read of the CV inputs.
+ */
+struct io_heartbeat {
+    uint32_t scans;
+    uint32_t analog;
+};
 
 /*
  * Returns 1 if the provided key is a keybed key. Returns
@@ -48,7 +127,16 @@ enum key_id {
  */
 inline bool io_is_keybed_key(uint8_t key_id) 
 {
-    return MAX_KEYBED_KEY >= key_id;
+    return (IO_KEYBED_KEYS >> key_id) & 1;
+}
+
+/*
+ * Returns 1 if the event comes from the external CV input rather
+ * than a pot
+ */
+inline bool io_is_cv_event(uint8_t type)
+{
+    return IO_CV_TRANSPOSE_CHANGED == type;
 }
 
 /*
@@ -74,6 +162,37 @@ inline io_event_t io_event_create(uint8_t type, uint16_t value)
  */
 int io_event_queue_ready(void);
 
+/*
+ * Returns true if there are key frames on the key frame queue,
+ * false otherwise
+ */
+int io_frame_queue_ready(void);
+
+/*
+ * Pops a key frame off of the key frame queue, blocking until there
+ * is one.
+ */
+void io_frame_queue_pop_blocking(struct io_key_frame *frame);
+
+/*
+ * Copies out a consistent snapshot of the reported key state. Lock free,
+ * so it's fine to call while core1 is scanning. Once every posted frame
+ * has been popped off of the key frame queue, snapshot->keys should
+ * match what was held according to those frames.
+ */
+void io_read_key_snapshot(struct io_key_snapshot *snapshot);
+
+/*
+ * Copies out the key scan statistics. The counters are updated on core1,
+ * so they may not all be from exactly the same moment.
+ */
+void io_get_scan_stats(struct io_scan_stats *stats);
+
+/*
+ * Reads the heartbeat counters. Safe to call from core0 at any time.
+ */
+void io_read_heartbeat(struct io_heartbeat *heartbeat);
+
 /*
  * Pops an io event off of the io event queue. If there is no 
  * io event on the queue at the time of calling, the function
@@ -91,4 +210,11 @@ int io_init(void);
  */
 void io_main(void);
 
+/*
+ * Resets core1 and starts io_main() on it again. Called from core0 when
+ * core1 has stopped responding. Key state already reported to core0 is
+ * kept, so held keys carry on.
+ */
+void io_restart(void);
+
 #endif
@@ -0,0 +1,91 @@
+#ifndef __KEYMAP_H__
+#define __KEYMAP_H__
+/*
+ * Every key on the controller, in key_id order, with where it sits in the
+ * switch matrix and what it does on each layer:
+ *
+ *     X(key, row, col, kind, base action, arg, FUNC action, arg)
+ *
+ * kind is KEYBED or BUTTON. Holding KEY_FUNC switches to the FUNC layer.
+ * Keybed keys play notes on the base layer, which goes through the
+ * voices a frame at a time rather than through an action.
+ *
+ * Everything else is generated from this: the key_id enum and the keybed
+ * mask in io.h, the matrix and its inverse in io.c, and the per layer
+ * dispatch tables in keyboard.c, which call key_action_<action>(arg).
+ *
+ * Notes are worked out from the key_id, so the keybed keys have to stay
+ * first and in order. The scale and tuning keys need one key each for
+ * SCALE_NUM_SCALES and TUNING_NUM_SLOTS.
+ */
+
+#define KEYMAP_KIND_KEYBED 1
+#define KEYMAP_KIND_BUTTON 0
+
+enum keymap_layer {
+    KEYMAP_LAYER_BASE = 0,
+    KEYMAP_LAYER_FUNC = 1,
+    KEYMAP_NUM_LAYERS = 2
+};
+
+#define KEYMAP(X) \
+    X(KEY_C1,          5, 0, KEYBED, none,        0, root,          0) \
+    X(KEY_CS1,         0, 1, KEYBED, none,        0, root,          1) \
+    X(KEY_D1,          1, 1, KEYBED, none,        0, root,          2) \
+    X(KEY_DS1,         2, 1, KEYBED, none,        0, root,          3) \
+    X(KEY_E1,          3, 1, KEYBED, none,        0, root,          4) \
+    X(KEY_F1,          4, 1, KEYBED, none,        0, root,          5) \
+    X(KEY_FS1,         5, 1, KEYBED, none,        0, root,          6) \
+    X(KEY_G1,          0, 2, KEYBED, none,        0, root,          7) \
+    X(KEY_GS1,         1, 2, KEYBED, none,        0, root,          8) \
+    X(KEY_A1,          2, 2, KEYBED, none,        0, root,          9) \
+    X(KEY_AS1,         3, 2, KEYBED, none,        0, root,          10) \
+    X(KEY_B1,          4, 2, KEYBED, none,        0, root,          11) \
+    X(KEY_C2,          5, 2, KEYBED, none,        0, scale,         0) \
+    X(KEY_CS2,         0, 3, KEYBED, none,        0, scale,         1) \
+    X(KEY_D2,          1, 3, KEYBED, none,        0, scale,         2) \
+    X(KEY_DS2,         2, 3, KEYBED, none,        0, scale,         3) \
+    X(KEY_E2,          3, 3, KEYBED, none,        0, scale,         4) \
+    X(KEY_F2,          4, 3, KEYBED, none,        0, scale,         5) \
+    X(KEY_FS2,         5, 3, KEYBED, none,        0, scale,         6) \
+    X(KEY_G2,          0, 4, KEYBED, none,        0, scale,         7) \
+    X(KEY_GS2,         1, 4, KEYBED, none,        0, scale,         8) \
+    X(KEY_A2,          2, 4, KEYBED, none,        0, scale,         9) \
+    X(KEY_AS2,         3, 4, KEYBED, none,        0, scale,         10) \
+    X(KEY_B2,          4, 4, KEYBED, none,        0, sync_out_ppqn, 0) \
+    X(KEY_C3,          5, 4, KEYBED, none,        0, transpose,     0) \
+    X(KEY_CS3,         0, 5, KEYBED, none,        0, transpose,     1) \
+    X(KEY_D3,          1, 5, KEYBED, none,        0, transpose,     2) \
+    X(KEY_DS3,         2, 5, KEYBED, none,        0, transpose,     3) \
+    X(KEY_E3,          3, 5, KEYBED, none,        0, transpose,     4) \
+    X(KEY_F3,          4, 5, KEYBED, none,        0, transpose,     5) \
+    X(KEY_FS3,         5, 5, KEYBED, none,        0, transpose,     6) \
+    X(KEY_G3,          0, 6, KEYBED, none,        0, transpose,     7) \
+    X(KEY_GS3,         1, 6, KEYBED, none,        0, transpose,     8) \
+    X(KEY_A3,          2, 6, KEYBED, none,        0, transpose,     9) \
+    X(KEY_AS3,         3, 6, KEYBED, none,        0, transpose,     10) \
+    X(KEY_B3,          4, 6, KEYBED, none,        0, transpose,     11) \
+    X(KEY_C4,          5, 6, KEYBED, none,        0, tuning,        0) \
+    X(KEY_CS4,         0, 7, KEYBED, none,        0, tuning,        1) \
+    X(KEY_D4,          1, 7, KEYBED, none,        0, tuning,        2) \
+    X(KEY_DS4,         2, 7, KEYBED, none,        0, tuning,        3) \
+    X(KEY_E4,          3, 7, KEYBED, none,        0, tuning,        4) \
+    X(KEY_F4,          4, 7, KEYBED, none,        0, tuning,        5) \
+    X(KEY_FS4,         5, 7, KEYBED, none,        0, tuning,        6) \
+    X(KEY_G4,          0, 8, KEYBED, none,        0, tuning,        7) \
+    X(KEY_GS4,         1, 8, KEYBED, none,        0, tuning,        8) \
+    X(KEY_A4,          2, 8, KEYBED, none,        0, swing,         50) \
+    X(KEY_AS4,         3, 8, KEYBED, none,        0, swing,         58) \
+    X(KEY_B4,          4, 8, KEYBED, none,        0, swing,         66) \
+    X(KEY_C5,          5, 8, KEYBED, none,        0, swing,         75) \
+    X(KEY_OCTAVE_UP,   0, 0, BUTTON, octave_up,   0, octave_up,     0) \
+    X(KEY_OCTAVE_DOWN, 1, 0, BUTTON, octave_down, 0, octave_down,   0) \
+    X(KEY_PLAY_PAUSE,  2, 0, BUTTON, play_pause,  0, groove,        0) \
+    X(KEY_RECORD,      3, 0, BUTTON, record,      0, looper_clear,  0) \
+    X(KEY_STOP,        4, 0, BUTTON, stop,        0, stop,          0) \
+    X(KEY_REST,        0, 9, BUTTON, none,        0, looper_grid,   0) \
+    X(KEY_HOLD,        1, 9, BUTTON, latch,       0, latch_mode,    0) \
+    X(KEY_FUNC,        2, 9, BUTTON, none,        0, none,          0) \
+    X(KEY_MODE,        3, 9, BUTTON, none,        0, voice_mode,    0)
+
+#endif
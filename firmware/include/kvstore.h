@@ -0,0 +1,74 @@
+#ifndef __KVSTORE_H__
+#define __KVSTORE_H__
+/*
+ * Small log structured key/value store in the last few sectors of flash.
+ *
+ * The store is split in to pages of KV_SECTORS_PER_PAGE sectors. Writes
+ * are appended to the active page. When it fills up, the latest value for
+ * every key is copied in to the next page, which then becomes active. The
+ * pages are used in rotation so erases are spread across all of them, and
+ * a page is only erased when it is about to be reused.
+ *
+ * Every live value has to fit in one page, with room to spare for the
+ * next write. Whoever picks the keys and value sizes checks their worst
+ * case against KV_PAGE_CAPACITY at build time (see settings.c), and
+ * kv_write() refuses anything that would overflow a page.
+ *
+ * A RAM index holds the flash location of the latest value for each key,
+ * so reads are a memcpy straight out of XIP. It is rebuilt at boot by
+ * scanning the active page once.
+ *
+ * Must only be used from core0. core1 is paused with multicore_lockout
+ * for each individual erase or page program, so it must have called
+ * multicore_lockout_victim_init().
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hardware/flash.h"
+
+#define KV_SECTORS_PER_PAGE 2
+#define KV_NUM_PAGES 3
+#define KV_PAGE_SIZE (KV_SECTORS_PER_PAGE * FLASH_SECTOR_SIZE)
+
+#define KV_PAGE_HEADER_LEN 8
+#define KV_RECORD_HEADER_LEN 4
+
+// Space for records in a page
+#define KV_PAGE_CAPACITY (KV_PAGE_SIZE - KV_PAGE_HEADER_LEN)
+
+// Flash used by a value of len bytes. Records are padded out to keep the
+// headers word aligned.
+#define KV_RECORD_SIZE(len) ((KV_RECORD_HEADER_LEN + (len) + 3) & ~3)
+
+// Keys run from 1 to KV_MAX_KEYS - 1
+#define KV_MAX_KEYS 64
+
+// Max size of a single value
+#define KV_MAX_VALUE_LEN 248
+
+/*
+ * Finds the active page and rebuilds the index. Returns 0 on success.
+ */
+int kv_init(void);
+
+/*
+ * Copies the latest value for key in to buf. Returns the length of the
+ * value, or -1 if the key has never been written. If the value is longer
+ * than buf_len, only buf_len bytes are copied.
+ */
+int kv_read(uint8_t key, void *buf, size_t buf_len);
+
+/*
+ * Appends a new value for key. Nothing is written if the value is the same
+ * as what is already stored. Returns 0 on success, or 1 without touching
+ * flash if the live values wouldn't fit in a page along with it.
+ */
+int kv_write(uint8_t key, const void *data, size_t len);
+
+/*
+ * Returns the number of sector erases done since boot
+ */
+uint32_t kv_erase_count(void);
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef __LATCH_H__
+#define __LATCH_H__
+/*
+ * Latch (hold) mode. While enabled, keybed keys keep sounding after they
+ * are released. The latched keys are kept as a bitmap for membership
+ * tests and a list in the order they were latched, for anything that
+ * plays them back in order (eg an arpeggiator). Notes are only ever added
+ * to the set or the whole set dropped at once, so clearing or starting a
+ * new chord is constant time.
+ */
+
+#include <stdint.h>
+#include "io.h"
+#include "lkp_stack.h"
+
+// Can't latch more keys than can be held
+#define LATCH_MAX_KEYS MAX_KEY_PRESSES
+
+enum latch_mode {
+    // Every key pressed is added to the set until the latch is cleared
+    LATCH_MODE_ADD = 0,
+    // Pressing a key while nothing is held starts a new set. Keys pressed
+    // while any key is held are added to it.
+    LATCH_MODE_REPLACE = 1,
+    LATCH_NUM_MODES = 2
+};
+
+struct latch {
+    uint8_t enabled;
+    uint8_t mode;
+    uint64_t keys; // IO_KEY_BIT of each latched key
+    uint8_t order[LATCH_MAX_KEYS]; // Latched keys, oldest first
+    uint8_t count;
+    uint64_t physical; // Keybed keys that are actually down
+};
+
+static inline uint8_t latch_has(const struct latch *latch, uint32_t key_id)
+{
+    return (latch->keys & IO_KEY_BIT(key_id)) ? 1 : 0;
+}
+
+/*
+ * Latched keys that aren't also being held down
+ */
+static inline uint64_t latch_released_keys(const struct latch *latch)
+{
+    return latch->keys & ~latch->physical;
+}
+
+void latch_init(struct latch *latch, uint8_t mode);
+
+/*
+ * Turns the latch on, latching whatever is currently held, or off.
+ * Returns the keys that should stop sounding.
+ */
+uint64_t latch_set_enabled(struct latch *latch, uint8_t enabled);
+
+/*
+ * Changes the mode and clears the set. Returns the keys that should stop
+ * sounding.
+ */
+uint64_t latch_set_mode(struct latch *latch, uint8_t mode);
+
+/*
+ * Empties the set. Returns the keys that should stop sounding.
+ */
+uint64_t latch_clear(struct latch *latch);
+
+/*
+ * Records a keybed press. Returns the keys that were dropped from the set
+ * and should stop sounding.
+ */
+uint64_t latch_press(struct latch *latch, uint32_t key_id);
+
+/*
+ * Records a keybed release. Returns 1 if the key is latched and should
+ * keep sounding.
+ */
+uint8_t latch_release(struct latch *latch, uint32_t key_id);
+
+#endif
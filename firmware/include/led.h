@@ -0,0 +1,54 @@
+#ifndef __LED_H__
+#define __LED_H__
+/*
+ * Front panel LEDs, driven by the PWM slices so that brightness and
+ * blinking are handled entirely in hardware. Nothing here is polled: each
+ * LED is only touched when the thing it shows changes.
+ *
+ *  - LED1 flashes on every beat, brighter on the first beat of the bar.
+ *    It follows the clock engine through a clock listener on core1.
+ *  - LED2 is solid while the latch is on. Otherwise it glows with the
+ *    position of the last analog input that moved.
+ *  - LED3 shows the octave shift: off when there isn't one, a short blink
+ *    when shifted down and a long one when shifted up. Its slice runs slow
+ *    enough that the PWM itself is the blink.
+ *
+ * LED4 shares its pin with the second gate output (see hardware_config.h),
+ * so it isn't used here and already shows that gate.
+ *
+ * LED1 and LED2 are the two channels of the same slice. They're written
+ * from different cores, which is fine because pwm_set_chan_level() only
+ * flips the bits of its own channel with an atomic XOR.
+ */
+
+#include <stdint.h>
+#include "clock.h"
+
+// The clock engine doesn't know about time signatures, so assume 4/4
+#define LED_BEATS_PER_BAR 4
+
+// How many clock ticks the beat flash lasts for. A sixteenth note.
+#define LED_FLASH_TICKS (CLOCK_PPQN / 4)
+
+/*
+ * Sets up the PWM slices and registers the clock listener. Must be called
+ * from core0 after clock_init() and before core1 is started.
+ */
+int led_init(void);
+
+/*
+ * Shows whether the latch is on. Called from core0.
+ */
+void led_set_latch(uint8_t enabled);
+
+/*
+ * Shows an analog input position, from 0 to 4095. Called from core0.
+ */
+void led_set_analog(uint16_t value);
+
+/*
+ * Shows the octave shift, from -1 to 1. Called from core0.
+ */
+void led_set_octave_shift(int8_t shift);
+
+#endif
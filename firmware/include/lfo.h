@@ -0,0 +1,129 @@
+#ifndef __LFO_H__
+#define __LFO_H__
+/*
+ * Modulation LFO on DAC channel B. Runs from a repeating timer on core1
+ * every LFO_UPDATE_INTERVAL_US. The phase is a 32-bit accumulator, a
+ * whole cycle being 2^32, which either:
+ *
+ *  - Free runs at a rate in millihertz
+ *  - Follows the clock engine, taking a whole number of ticks per cycle.
+ *    The phase is worked out from the last tick rather than accumulated,
+ *    so it can't drift away from the beat. While the clock is stopped it
+ *    carries on at the last tempo.
+ *
+ * The sine comes from a 256 entry table with linear interpolation, the
+ * other shapes straight from the phase. Outputs are centred on half
+ * scale.
+ *
+ * Channel B belongs to voice 1 in the two voice modes, so the LFO only
+ * drives it while it has been handed the channel (see lfo_set_enabled()).
+ * Updates are queued on the SPI FIFO without waiting for them to go out,
+ * so they don't hold up core1 and they can sit between the voice writes
+ * from core0.
+ */
+
+#include <stdint.h>
+#include "pico/stdlib.h"
+
+#include "mcp4921.h"
+
+#define LFO_UPDATE_INTERVAL_US 500
+
+#define LFO_TABLE_BITS 8
+#define LFO_TABLE_LEN (1 << LFO_TABLE_BITS)
+
+#define LFO_MIN_RATE_MHZ 10
+#define LFO_MAX_RATE_MHZ 50000
+#define LFO_DEFAULT_RATE_MHZ 1000
+
+#define LFO_MAX_DEPTH 100 // Percent of full scale
+#define LFO_DEFAULT_DEPTH 50
+
+enum lfo_shape {
+    LFO_SHAPE_OFF = 0,
+    LFO_SHAPE_SINE = 1,
+    LFO_SHAPE_TRIANGLE = 2,
+    LFO_SHAPE_SAW = 3,
+    LFO_SHAPE_SQUARE = 4,
+    // A new random level at the start of each cycle
+    LFO_SHAPE_SAMPLE_HOLD = 5,
+    LFO_NUM_SHAPES = 6
+};
+
+// Cycle lengths when synced to the clock
+enum lfo_division {
+    LFO_DIV_4_BARS = 0,
+    LFO_DIV_2_BARS = 1,
+    LFO_DIV_1_BAR = 2,
+    LFO_DIV_HALF = 3,
+    LFO_DIV_QUARTER = 4,
+    LFO_DIV_QUARTER_TRIPLET = 5,
+    LFO_DIV_EIGHTH = 6,
+    LFO_DIV_EIGHTH_TRIPLET = 7,
+    LFO_DIV_SIXTEENTH = 8,
+    LFO_NUM_DIVISIONS = 9
+};
+
+struct lfo_stats {
+    uint32_t updates;
+    uint32_t dropped; // SPI FIFO was full
+    uint32_t max_update_us;
+};
+
+/*
+ * Builds the wavetable and registers the clock listener. Must be called
+ * from core0 after clock_init() and before core1 is started.
+ */
+int lfo_init(struct mcp4921 *dac);
+
+/*
+ * Starts the update timer in the given pool. Must be called on core1.
+ */
+void lfo_run(alarm_pool_t *pool);
+
+/*
+ * Hands channel B to the LFO, or takes it back. Must only be enabled
+ * while voice 1 is unused, ie in VOICE_MODE_MONO.
+ */
+void lfo_set_enabled(uint8_t enabled);
+
+/*
+ * Picks the shape, LFO_SHAPE_OFF leaving the output where it is. Returns
+ * 0 on success.
+ */
+int lfo_set_shape(uint8_t shape);
+
+uint8_t lfo_get_shape(void);
+
+/*
+ * Sets the free running rate. Returns 0 on success.
+ */
+int lfo_set_rate_mhz(uint16_t rate_mhz);
+
+uint16_t lfo_get_rate_mhz(void);
+
+/*
+ * Switches between free running and following the clock
+ */
+void lfo_set_sync(uint8_t sync);
+
+uint8_t lfo_get_sync(void);
+
+/*
+ * Sets the cycle length used while synced. Returns 0 on success.
+ */
+int lfo_set_division(uint8_t division);
+
+uint8_t lfo_get_division(void);
+
+/*
+ * Sets the peak to peak swing as a percentage of full scale, clamped to
+ * LFO_MAX_DEPTH
+ */
+void lfo_set_depth(uint8_t depth);
+
+uint8_t lfo_get_depth(void);
+
+void lfo_get_stats(struct lfo_stats *stats);
+
+#endif
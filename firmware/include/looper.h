@@ -0,0 +1,125 @@
+#ifndef __LOOPER_H__
+#define __LOOPER_H__
+/*
+ * Real time phrase looper. Keybed presses and releases and octave shifts
+ * are recorded as they are played, with their position measured against
+ * the master clock, and played back in time with it.
+ *
+ * Positions are in 1/LOOPER_SUBTICKS of a clock tick from the start of the
+ * loop, so a loop follows tempo changes. Loops start on a bar line and are
+ * a whole number of bars long.
+ *
+ * Events live in fixed arrays: the recorded loop, and a staging area for
+ * overdubs that is merged in each time the loop comes round. Recording
+ * never allocates or blocks. Events that don't fit are dropped.
+ *
+ * Playback runs from the scheduler (see sched.h), one group of events at a
+ * time, so events land within the scheduler's lateness of where they were
+ * recorded. The output callbacks run in its interrupt, so the main loop
+ * must hold sched_lock() while it changes anything they use.
+ *
+ * Quantise is applied on playback and leaves the recording alone. Note
+ * starts move to the nearest grid line and their releases move with them,
+ * which keeps the note lengths.
+ */
+
+#include <stdint.h>
+#include "clock.h"
+
+#define LOOPER_MAX_EVENTS 512
+#define LOOPER_STAGING_EVENTS 128
+
+#define LOOPER_SUBTICKS 1024
+
+// The clock engine doesn't know about time signatures, so assume 4/4
+#define LOOPER_BAR_TICKS (4 * CLOCK_PPQN)
+#define LOOPER_MAX_BARS 16
+
+// Events further away than this are waited for in steps, so that tempo
+// changes along the way are picked up
+#define LOOPER_HORIZON_TICKS CLOCK_PPQN
+
+enum looper_event_type {
+    // Also the order that events at the same position are played in
+    LOOPER_EVENT_RELEASE = 0,
+    LOOPER_EVENT_OCTAVE = 1,
+    LOOPER_EVENT_PRESS = 2
+};
+
+enum looper_status {
+    LOOPER_EMPTY = 0,
+    LOOPER_RECORDING = 1,
+    LOOPER_PLAYING = 2,
+    LOOPER_OVERDUBBING = 3
+};
+
+enum looper_grid {
+    LOOPER_GRID_OFF = 0,
+    LOOPER_GRID_4TH = 1,
+    LOOPER_GRID_8TH = 2,
+    LOOPER_GRID_16TH = 3,
+    LOOPER_GRID_32ND = 4,
+    LOOPER_NUM_GRIDS = 5
+};
+
+struct looper_event {
+    uint32_t pos;
+    uint8_t type;
+    uint8_t key_id;
+    int8_t octave_shift;
+};
+
+/*
+ * Plays keybed keys (IO_KEY_BIT masks). Releases come before presses.
+ */
+typedef void (*looper_keys_callback_t)(uint64_t pressed, uint64_t released);
+
+typedef void (*looper_octave_callback_t)(int8_t octave_shift);
+
+/*
+ * Must be called on core0 after sched_init()
+ */
+int looper_init(looper_keys_callback_t on_keys, looper_octave_callback_t on_octave);
+
+/*
+ * Steps through empty -> recording -> playing <-> overdubbing. Recording
+ * only starts while the clock is running. Returns 0 on success.
+ */
+int looper_record_button(void);
+
+/*
+ * Stops playback and throws the loop away
+ */
+void looper_clear(void);
+
+void looper_set_grid(uint8_t grid);
+
+uint8_t looper_get_grid(void);
+
+uint8_t looper_get_status(void);
+
+/*
+ * Records keybed keys that started or stopped sounding. timestamp_us is
+ * when they were played, in time_us_32() terms.
+ */
+void looper_record_keys(uint64_t pressed, uint64_t released, uint32_t timestamp_us);
+
+void looper_record_octave(int8_t octave_shift, uint32_t timestamp_us);
+
+/*
+ * Returns the keys that playback is holding down
+ */
+uint64_t looper_sounding_keys(void);
+
+/*
+ * Follows the clock's transport and merges overdubs. Called from the main
+ * loop.
+ */
+void looper_task(void);
+
+/*
+ * Returns the number of events that didn't fit
+ */
+uint32_t looper_dropped(void);
+
+#endif
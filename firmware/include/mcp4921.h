@@ -30,7 +30,7 @@
 #define mcp4921_set_gain(mcp, gain) (mcp)->cmd_flags |= ((gain) << 1)
 #define mcp4921_set_shdn(mcp, shdn_state) (mcp)->cmd_flags |= (shdn_state)
 
-#define mcp4921_get_gain(mcp) ((mcp)->cmd_flags & 0b0100) >> 2
+#define mcp4921_get_gain(mcp) (((mcp)->cmd_flags & 0b0010) >> 1)
 
 struct mcp4921 {
     uint8_t clk_pin;
@@ -40,10 +40,37 @@ struct mcp4921 {
     float refv;
     unsigned int clock_speed;
     uint8_t cmd_flags: 4;
+    // If set, cs_pin must be the CSn pin of spi_inst. The SPI peripheral
+    // then drives chip select itself and pulses it between every word, which
+    // latches each one, so several words can be queued back to back.
+    uint8_t hw_cs: 1;
 };
 
 int mcp4921_init(struct mcp4921* mcp);
 
 int mcp4921_set_output(struct mcp4921 *dac, float volts);
 
+/*
+ * Converts a voltage in to the code that will produce it on the output
+ */
+uint16_t mcp4921_volts_to_code(struct mcp4921 *dac, float volts);
+
+/*
+ * Writes a raw code to one channel of the DAC
+ */
+int mcp4921_set_code(struct mcp4921 *dac, uint8_t channel, uint16_t code);
+
+/*
+ * Writes raw codes to both channels of a dual (MCP4922) DAC. When hw_cs is
+ * set, both words go out in a single SPI transfer.
+ */
+int mcp4921_set_codes(struct mcp4921 *dac, uint16_t code_a, uint16_t code_b);
+
+/*
+ * Puts a write to one channel on the SPI FIFO and returns without waiting
+ * for it to go out. Needs hw_cs. Returns 1 if the FIFO was full, in which
+ * case nothing is written.
+ */
+int mcp4921_queue_code(struct mcp4921 *dac, uint8_t channel, uint16_t code);
+
 #endif
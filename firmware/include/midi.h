@@ -0,0 +1,91 @@
+#ifndef __MIDI_H__
+#define __MIDI_H__
+/*
+ * MIDI message encoding and per-frame batching of USB-MIDI event
+ * packets. Nothing in here touches the hardware or TinyUSB so that it
+ * can be built and exercised on a host.
+ */
+
+#include <stdint.h>
+
+#define MIDI_NOTE_OFF 0x80
+#define MIDI_NOTE_ON 0x90
+#define MIDI_CONTROL_CHANGE 0xB0
+
+#define MIDI_MAX_DATA 127
+
+// Size of a USB-MIDI event packet
+#define MIDI_PACKET_LEN 4
+
+// Max number of packets that can be queued up in a single USB frame.
+// Anything past this is dropped and counted.
+#define MIDI_BATCH_SIZE 32
+
+struct midi_batch {
+    uint8_t packets[MIDI_BATCH_SIZE][MIDI_PACKET_LEN];
+    uint8_t count;
+    uint32_t dropped;
+};
+
+/*
+ * Writes up to count packets to the transport. Must return the number
+ * of packets that were actually accepted.
+ */
+typedef uint32_t (*midi_packet_writer_t)(const uint8_t packets[][MIDI_PACKET_LEN], uint32_t count);
+
+static inline void midi_batch_init(struct midi_batch *batch)
+{
+    batch->count = 0;
+    batch->dropped = 0;
+}
+
+/*
+ * Number of MIDI bytes carried by a channel voice packet
+ */
+static inline uint8_t midi_packet_size(const uint8_t *packet)
+{
+    uint8_t cin = packet[0] & 0x0f;
+
+    // Program change and channel pressure have a single data byte
+    return 0x0c == cin || 0x0d == cin ? 2 : 3;
+}
+
+/*
+ * Encodes a channel voice message as a USB-MIDI event packet and appends
+ * it to the batch. Returns 0 on success, or -1 if the batch is full.
+ */
+int midi_batch_add(struct midi_batch *batch, uint8_t cable, uint8_t status, uint8_t data1, uint8_t data2);
+
+/*
+ * Queues a note on message. channel is 0 based.
+ */
+static inline int midi_note_on(struct midi_batch *batch, uint8_t channel, uint8_t note, uint8_t velocity)
+{
+    return midi_batch_add(batch, 0, MIDI_NOTE_ON | (channel & 0x0f), note, velocity);
+}
+
+/*
+ * Queues a note off message. channel is 0 based.
+ */
+static inline int midi_note_off(struct midi_batch *batch, uint8_t channel, uint8_t note)
+{
+    return midi_batch_add(batch, 0, MIDI_NOTE_OFF | (channel & 0x0f), note, 0);
+}
+
+/*
+ * Queues a control change message. channel is 0 based.
+ */
+static inline int midi_control_change(struct midi_batch *batch, uint8_t channel, uint8_t control, uint8_t value)
+{
+    return midi_batch_add(batch, 0, MIDI_CONTROL_CHANGE | (channel & 0x0f), control, value);
+}
+
+/*
+ * Hands every queued packet to the writer in one call. Packets that the
+ * writer doesn't accept stay queued, in order, for the next flush.
+ *
+ * Returns the number of packets written.
+ */
+uint32_t midi_batch_flush(struct midi_batch *batch, midi_packet_writer_t writer);
+
+#endif
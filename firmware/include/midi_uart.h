@@ -0,0 +1,53 @@
+#ifndef __MIDI_UART_H__
+#define __MIDI_UART_H__
+/*
+ * DIN/TRS MIDI on a UART. Sends MIDI clock and transport messages that
+ * follow the clock engine, and feeds incoming MIDI clock in to it.
+ *
+ * Everything here runs on core1: the UART interrupt is enabled from
+ * midi_uart_init() and bytes are only queued from clock listeners.
+ */
+
+#include <stdint.h>
+
+#define MIDI_UART_BAUD 31250
+
+#define MIDI_CLOCK 0xF8
+#define MIDI_START 0xFA
+#define MIDI_CONTINUE 0xFB
+#define MIDI_STOP 0xFC
+#define MIDI_ACTIVE_SENSING 0xFE
+
+// Size of the software transmit buffer. The UART's FIFOs are off, so
+// this is all there is. Must be a power of two.
+#define MIDI_UART_TX_BUF_SIZE 64
+
+struct midi_uart_stats {
+    uint32_t rx_bytes;
+    uint32_t rx_clocks;
+    uint32_t tx_dropped;
+    uint32_t rx_errors;
+};
+
+/*
+ * Sets up the UART and its interrupt, and registers the clock listener
+ * that sends clock and transport messages. Must be called on core1
+ * before clock_run().
+ */
+int midi_uart_init(void);
+
+/*
+ * Enables the UART interrupt on core1 again after core1 has been reset
+ * (see io_restart()). Everything else set up by midi_uart_init() survives.
+ */
+void midi_uart_resume(void);
+
+/*
+ * Queues a byte to be sent. Never blocks; if the transmit buffer is full
+ * the byte is dropped and counted.
+ */
+void midi_uart_send(uint8_t byte);
+
+const struct midi_uart_stats *midi_uart_get_stats(void);
+
+#endif
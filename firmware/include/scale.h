@@ -0,0 +1,65 @@
+#ifndef __SCALE_H__
+#define __SCALE_H__
+/*
+ * Scale quantisation and transposition. Whenever the scale, root,
+ * transposition or octave shift change, every key is run through the
+ * quantiser once and the resulting DAC codes are stored in a table
+ * indexed by key id. Playing a note is then a single table lookup.
+ */
+
+#include <stdint.h>
+#include "mcp4921.h"
+#include "tuning.h"
+
+// Covers every key id, with room to spare
+#define SCALE_TABLE_SIZE 64
+
+enum scale_id {
+    SCALE_CHROMATIC = 0,
+    SCALE_MAJOR = 1,
+    SCALE_DORIAN = 2,
+    SCALE_PHRYGIAN = 3,
+    SCALE_LYDIAN = 4,
+    SCALE_MIXOLYDIAN = 5,
+    SCALE_MINOR = 6,
+    SCALE_LOCRIAN = 7,
+    SCALE_HARMONIC_MINOR = 8,
+    SCALE_PENTATONIC_MAJOR = 9,
+    SCALE_PENTATONIC_MINOR = 10,
+    SCALE_NUM_SCALES = 11
+};
+
+struct scale_config {
+    uint8_t scale;
+    uint8_t root; // 0 (C) to 11 (B)
+    int8_t transpose; // Semitones
+    int8_t octave_shift;
+};
+
+struct scale_table {
+    uint16_t codes[SCALE_TABLE_SIZE];
+};
+
+/*
+ * Quantises a semitone (0 being C) to the nearest note in the scale. Ties
+ * go to the lower note.
+ */
+int16_t scale_quantise(const struct scale_config *config, int16_t semitone);
+
+/*
+ * Compiles the key to DAC code table for the given configuration and
+ * tuning. Scale quantisation only applies to tunings with twelve notes per
+ * period; keys step straight through the degrees of anything else.
+ */
+void scale_build_table(const struct scale_config *config, const struct tuning *tuning,
+                       struct mcp4921 *dac, struct scale_table *table);
+
+/*
+ * Returns the DAC code for a key
+ */
+static inline uint16_t scale_lookup(const struct scale_table *table, uint32_t key_id)
+{
+    return table->codes[key_id & (SCALE_TABLE_SIZE - 1)];
+}
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef __SCHED_H__
+#define __SCHED_H__
+/*
+ * Time ordered scheduler for future actions on core0 (gate offs,
+ * retrigger pulses, sequencer steps, ...). Actions live in a fixed pool
+ * and are kept in a binary min-heap keyed on their due time, backed by a
+ * single hardware alarm that is always set for the earliest one.
+ *
+ * Callbacks run in timestamp order, normally from the alarm interrupt.
+ * Ones that are already due when they are scheduled, or when whatever
+ * was in front of them is cancelled or sched_unlock() is called, run
+ * straight away from the caller. The heap is only touched with
+ * interrupts disabled, but callbacks themselves run with them enabled.
+ */
+
+#include <stdint.h>
+#include "pico/stdlib.h"
+
+// Max number of pending actions
+#define SCHED_MAX_ACTIONS 32
+
+// Actions due within this many microseconds are run straight away rather
+// than going through the alarm, since setting it up would take longer
+#define SCHED_MIN_DELAY_US 2
+
+// Lateness is bucketed by powers of two: bucket 0 is < 1us late, bucket n
+// is [2^(n-1), 2^n) us late and the last bucket is everything past that
+#define SCHED_LATENESS_BUCKETS 16
+
+#define SCHED_INVALID_HANDLE 0
+
+typedef void (*sched_callback_t)(void *arg);
+
+/*
+ * Identifies a scheduled action so that it can be cancelled. Stale handles
+ * are detected, so cancelling an action that has already run is harmless.
+ */
+typedef uint32_t sched_handle_t;
+
+struct sched_stats {
+    uint32_t fired;
+    uint32_t dropped; // Actions that couldn't be scheduled because the pool was full
+    uint32_t max_lateness_us;
+    uint32_t lateness[SCHED_LATENESS_BUCKETS];
+};
+
+/*
+ * Claims a hardware alarm and sets up the action pool. Must be called on
+ * core0, which is where callbacks will run.
+ */
+int sched_init(void);
+
+/*
+ * Schedules callback to run at the given time (in time_us_64() terms).
+ * O(log n). Returns SCHED_INVALID_HANDLE if there is no room.
+ *
+ * If the time has passed, or is within SCHED_MIN_DELAY_US, the callback
+ * runs before this returns and the handle is already stale. Called from a
+ * callback or under sched_lock() it runs as soon as they are done
+ * instead.
+ */
+sched_handle_t sched_at(uint64_t time_us, sched_callback_t callback, void *arg);
+
+/*
+ * Schedules callback to run delay_us from now
+ */
+static inline sched_handle_t sched_in(uint32_t delay_us, sched_callback_t callback, void *arg)
+{
+    return sched_at(time_us_64() + delay_us, callback, arg);
+}
+
+/*
+ * Cancels a pending action. O(log n). Returns 1 if it was cancelled, 0
+ * if it had already run or been cancelled.
+ */
+uint8_t sched_cancel(sched_handle_t handle);
+
+/*
+ * Holds off callbacks while the main loop changes state that they also
+ * use. Other interrupts are left alone. Calls can be nested, and must be
+ * kept short since anything that comes due waits until the last unlock.
+ */
+void sched_lock(void);
+
+void sched_unlock(void);
+
+/*
+ * Copies out the firing statistics
+ */
+void sched_get_stats(struct sched_stats *stats);
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef __SETTINGS_H__
+#define __SETTINGS_H__
+/*
+ * User settings that survive a power cycle. Stored as a single record in
+ * the flash key/value store. Saving is deferred until the settings have
+ * stopped changing for a while, so that fiddling with a control doesn't
+ * turn in to a flash write per step.
+ */
+
+#include <stdint.h>
+
+#include "kvstore.h"
+
+// Keys used in the flash key/value store
+enum kv_key {
+    KV_KEY_SETTINGS = 1,
+    KV_KEY_TUNING_BASE = 16,
+    KV_KEY_PATTERN_BASE = 32,
+};
+
+// Patterns stored over the control protocol (see ctl.h). With everything
+// stored, this still leaves over half of a kvstore page free, so rolls
+// (and their erases) stay rare.
+#define KV_PATTERN_SLOTS 8
+#define KV_PATTERN_MAX_LEN KV_MAX_VALUE_LEN
+
+#define SETTINGS_SAVE_DELAY_US (2 * 1000 * 1000)
+
+/*
+ * New fields must only ever be added to the end. Values stored by older
+ * firmware are shorter, and the new fields keep their defaults.
+ */
+struct settings {
+    int8_t octave_shift;
+    uint8_t voice_mode;
+    uint8_t sync_in_ppqn;
+    uint16_t gate_time;
+    uint8_t scale;
+    uint8_t scale_root;
+    int8_t transpose;
+    uint8_t tuning; // Slot, see tuning.h
+    uint8_t latch_mode;
+    uint8_t sync_out_ppqn;
+    uint16_t sync_out_width_us;
+    uint8_t sync_out_thru;
+    uint8_t looper_grid;
+    uint8_t steps_per_quarter;
+    uint8_t swing;
+    uint8_t groove;
+    uint8_t lfo_shape;
+    uint8_t lfo_sync;
+    uint16_t lfo_rate_mhz;
+    uint8_t lfo_division;
+    uint8_t lfo_depth;
+} __attribute__((packed));
+
+/*
+ * Fills in the defaults. Doesn't touch flash, so it can be used before
+ * settings_load().
+ */
+void settings_defaults(struct settings *settings);
+
+/*
+ * Rebuilds the key/value store index and reads the stored settings in to
+ * settings, or the defaults if there aren't any. Returns 0 on success.
+ */
+int settings_load(struct settings *settings);
+
+/*
+ * Notes that a setting has changed and needs to be saved
+ */
+void settings_changed(void);
+
+/*
+ * Returns 1 once a change has been waiting for SETTINGS_SAVE_DELAY_US
+ */
+uint8_t settings_save_due(void);
+
+/*
+ * Writes the settings to flash. Returns 0 on success.
+ */
+int settings_save(const struct settings *settings);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef __SYNC_OUT_H__
+#define __SYNC_OUT_H__
+/*
+ * Pulses on SYNC_OUT, generated by a PIO state machine so that their
+ * timing doesn't depend on the CPU. Either:
+ *
+ *  - Clock pulses at a selectable PPQN. The clock engine's listener on
+ *    core1 queues a pulse per output tick, and the state machine times
+ *    its width to the cycle.
+ *  - A pulse per step (SYNC_OUT_PPQN_STEPS), following CLOCK_STEP events
+ *    so that it carries the clock's division, swing and groove.
+ *  - SYNC_IN passed straight through (thru mode), delayed by a fixed
+ *    SYNC_OUT_THRU_DELAY_CYCLES. The CPU isn't involved at all.
+ *
+ * 48 PPQN is twice the clock engine's resolution. The second pulse of
+ * each tick is queued with a delay of half the current tick period.
+ */
+
+#include <stdint.h>
+
+#define SYNC_OUT_DEFAULT_PPQN 4
+
+// In place of a PPQN, pulses on every step rather than at a fixed rate
+#define SYNC_OUT_PPQN_STEPS 0
+#define SYNC_OUT_DEFAULT_WIDTH_US 5000
+
+#define SYNC_OUT_MIN_WIDTH_US 100
+#define SYNC_OUT_MAX_WIDTH_US 50000
+
+// Input synchronizer, wait and set. See sync_out.pio.
+#define SYNC_OUT_THRU_DELAY_CYCLES 4
+
+/*
+ * Claims a state machine, loads the programs and registers the clock
+ * listener. Must be called from core0 after clock_init() and before core1
+ * is started.
+ */
+int sync_out_init(void);
+
+/*
+ * Sets the number of output pulses per quarter note. Must be one of 1, 2,
+ * 4, 24 or 48, or SYNC_OUT_PPQN_STEPS. Returns 0 on success.
+ */
+int sync_out_set_ppqn(uint8_t ppqn);
+
+uint8_t sync_out_get_ppqn(void);
+
+/*
+ * Sets the clock pulse width, clamped to the supported range. Pulses are
+ * also cut to half the output period, so they never run together.
+ */
+void sync_out_set_width_us(uint16_t width_us);
+
+uint16_t sync_out_get_width_us(void);
+
+/*
+ * Switches between clock pulses and passing SYNC_IN through. Must be
+ * called from core0.
+ */
+void sync_out_set_thru(uint8_t thru);
+
+uint8_t sync_out_get_thru(void);
+
+/*
+ * Returns the thru delay at the current system clock
+ */
+uint32_t sync_out_thru_delay_ns(void);
+
+/*
+ * Returns the number of pulses that were dropped because the FIFO was full
+ */
+uint32_t sync_out_dropped(void);
+
+#endif
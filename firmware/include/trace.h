@@ -0,0 +1,98 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+/*
+ * Binary trace log. Hot paths record fixed size records in to a
+ * per-core ring without doing any formatting. trace_drain() is called
+ * from the main loop when there is nothing better to do and emits the
+ * records as hex lines on stdio. The rings can also be dumped raw over
+ * SWD (see the g_trace symbol). util/trace_decode.py turns either form
+ * back in to a readable log.
+ */
+
+#include <stdint.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+// Number of records in each core's ring. Must be a power of two
+#define TRACE_RING_SIZE 256
+
+// Max number of records emitted by a single call to trace_drain()
+#define TRACE_DRAIN_BATCH 8
+
+// Keep in sync with TRACE_IDS in util/trace_decode.py
+enum trace_id {
+    TRACE_NONE = 0,
+    TRACE_BOOT = 1,         // a: unused, b: unused
+    TRACE_IO_EVENT = 2,     // a: event type, b: event value
+    TRACE_SYNC_CN = 3,      // a: new cable state
+    TRACE_SYNC_IN = 4,      // a: new sync level
+    TRACE_MATRIX_GHOST = 5, // a: ambiguous row pairs, b: ghost frames so far
+    TRACE_SCAN_WAKE = 6,    // a: unused, b: us from the probe to the first key event
+    TRACE_KEY_FRAME = 7,    // a: keys pressed, b: keys released
+    TRACE_KEY_REPAIR = 8,   // a: keys fixed up, b: keys fixed up so far
+    TRACE_CORE1_STALL = 9,  // a: 1 scan stalled, 2 analog stalled, b: restarts so far
+};
+
+struct trace_record {
+    uint32_t timestamp; // time_us_32() when the record was written
+    uint16_t id;
+    uint16_t a;
+    uint32_t b;
+};
+
+struct trace_ring {
+    volatile uint32_t head; // Only written by the producing core
+    volatile uint32_t tail; // Only written by trace_drain()
+    volatile uint32_t overflows;
+    struct trace_record records[TRACE_RING_SIZE];
+};
+
+// One ring per core, indexed by core number
+extern struct trace_ring g_trace[2];
+
+/*
+ * Resets both trace rings. Must be called before either core records
+ * anything.
+ */
+void trace_init(void);
+
+/*
+ * Emits up to TRACE_DRAIN_BATCH records from each ring on stdio. Returns
+ * the number of records emitted.
+ */
+uint32_t trace_drain(void);
+
+/*
+ * Records a trace event on the calling core's ring. Safe to call from
+ * interrupt handlers. If the ring is full the record is dropped and the
+ * overflow counter is bumped; this never blocks.
+ */
+static inline void trace_event(uint16_t id, uint16_t a, uint32_t b)
+{
+    struct trace_ring *ring = &g_trace[get_core_num()];
+
+    // Only need to guard against an interrupt on this core writing to the
+    // same ring. The other core never writes to it.
+    uint32_t irq_state = save_and_disable_interrupts();
+    uint32_t head = ring->head;
+
+    if (head - ring->tail >= TRACE_RING_SIZE) {
+        ring->overflows++;
+        restore_interrupts(irq_state);
+        return;
+    }
+
+    struct trace_record *record = &ring->records[head & (TRACE_RING_SIZE - 1)];
+    record->timestamp = time_us_32();
+    record->id = id;
+    record->a = a;
+    record->b = b;
+
+    // Make sure the record is visible to the draining core before the
+    // new head is
+    __dmb();
+    ring->head = head + 1;
+    restore_interrupts(irq_state);
+}
+
+#endif
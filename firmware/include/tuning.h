@@ -0,0 +1,106 @@
+#ifndef __TUNING_H__
+#define __TUNING_H__
+/*
+ * Microtonal tunings in Scala format. A tuning is a .scl scale (the
+ * pitch of each degree in cents, the last one being the period) plus an
+ * optional .kbm keyboard mapping saying which degree each note plays.
+ *
+ * Tunings are uploaded a line at a time over the console (see console.h),
+ * parsed in to a struct tuning and stored in the flash key/value store.
+ * They are only ever used to compile the scale table (see scale.h), so
+ * none of this runs on the note path.
+ *
+ * The .kbm reference note and frequency are parsed but not used. The CV
+ * output has no absolute pitch, so the middle note simply keeps the
+ * voltage it has in 12-TET.
+ */
+
+#include <stdint.h>
+
+// Slot 0 is the built in 12-TET tuning. Slots 1 onwards are stored in flash.
+#define TUNING_12TET 0
+#define TUNING_NUM_SLOTS 9
+
+// Max number of notes in a .scl scale, including the period
+#define TUNING_MAX_DEGREES 32
+
+// Max number of entries in a .kbm mapping
+#define TUNING_MAX_MAP 32
+
+#define TUNING_UNMAPPED -1
+
+// MIDI note number of KEY_C1, which .kbm note numbers are relative to
+#define TUNING_KEY_C1_NOTE 36
+
+// Has to fit in a single key/value store record
+struct tuning {
+    uint8_t num_degrees; // Notes per period
+    uint8_t map_size; // 0 for a linear mapping
+    uint8_t first_note;
+    uint8_t last_note;
+    uint8_t middle_note; // Note that plays degree 0
+    uint8_t octave_degree; // Degree that the mapping repeats at. 0 for the period.
+    uint8_t reserved[2];
+    // Cents for degrees 1 to num_degrees. Degree 0 is always 0 cents.
+    float cents[TUNING_MAX_DEGREES];
+    int8_t map[TUNING_MAX_MAP]; // Degree for each mapping entry, or TUNING_UNMAPPED
+};
+
+enum tuning_section {
+    TUNING_SECTION_SCL = 0,
+    TUNING_SECTION_KBM = 1
+};
+
+struct tuning_parser {
+    struct tuning tuning;
+    uint8_t section;
+    uint8_t line; // Number of lines parsed so far in the current section
+    uint8_t pitches; // Number of .scl pitches parsed so far
+    uint8_t error;
+};
+
+/*
+ * Fills in 12-TET with a linear mapping
+ */
+void tuning_set_12tet(struct tuning *tuning);
+
+/*
+ * Starts parsing a new .scl file. The mapping defaults to linear.
+ */
+void tuning_parser_begin(struct tuning_parser *parser);
+
+/*
+ * Starts parsing a .kbm file for the scale that was just parsed
+ */
+void tuning_parser_begin_kbm(struct tuning_parser *parser);
+
+/*
+ * Parses a single line of the current file. Returns 0 on success. Once a
+ * line fails, every following line does too.
+ */
+int tuning_parse_line(struct tuning_parser *parser, const char *line);
+
+/*
+ * Checks that the files were complete. Returns 0 if parser->tuning is
+ * ready to use.
+ */
+int tuning_parser_end(struct tuning_parser *parser);
+
+/*
+ * Reads the tuning in the given slot. Returns 0 on success, or 1 if the
+ * slot is empty, in which case tuning is set to 12-TET.
+ */
+int tuning_load(uint8_t slot, struct tuning *tuning);
+
+/*
+ * Stores a tuning in one of the flash slots. Returns 0 on success.
+ */
+int tuning_save(uint8_t slot, const struct tuning *tuning);
+
+/*
+ * Works out the voltage for a MIDI note, relative to KEY_C1 in 12-TET.
+ * Returns 1 if the note is unmapped.
+ */
+int tuning_note_volts(const struct tuning *tuning, int16_t note, float *volts);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef __TUSB_CONFIG_H__
+#define __TUSB_CONFIG_H__
+/*
+ * TinyUSB configuration. Picked up by the tinyusb_device library from
+ * the include path.
+ */
+
+#define CFG_TUSB_RHPORT0_MODE OPT_MODE_DEVICE
+
+#ifndef CFG_TUSB_OS
+#define CFG_TUSB_OS OPT_OS_PICO
+#endif
+
+#ifndef CFG_TUSB_MEM_SECTION
+#define CFG_TUSB_MEM_SECTION
+#endif
+
+#ifndef CFG_TUSB_MEM_ALIGN
+#define CFG_TUSB_MEM_ALIGN __attribute__ ((aligned(4)))
+#endif
+
+#define CFG_TUD_ENDPOINT0_SIZE 64
+
+#define CFG_TUD_CDC 2 // Console and the control protocol
+#define CFG_TUD_MSC 0
+#define CFG_TUD_HID 0
+#define CFG_TUD_MIDI 1
+#define CFG_TUD_VENDOR 0
+
+#define CFG_TUD_CDC_RX_BUFSIZE 64
+#define CFG_TUD_CDC_TX_BUFSIZE 512
+
+// One full speed bulk packet holds 16 USB-MIDI event packets
+#define CFG_TUD_MIDI_RX_BUFSIZE 64
+#define CFG_TUD_MIDI_TX_BUFSIZE 128
+
+#endif
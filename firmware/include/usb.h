@@ -0,0 +1,30 @@
+#ifndef __USB_H__
+#define __USB_H__
+/*
+ * USB device. Presents a composite device with a CDC console, which
+ * stdio is routed over, a MIDI interface (see usb_midi.h) and a second
+ * CDC interface for the binary control protocol (see ctl.h).
+ */
+
+#include <stdint.h>
+
+// CDC interface numbers
+#define USB_CDC_CONSOLE 0
+#define USB_CDC_CONTROL 1
+
+/*
+ * Initializes TinyUSB and the stdio driver for the console
+ */
+int usb_init(void);
+
+/*
+ * Returns true once the host has opened the console
+ */
+int usb_console_connected(void);
+
+/*
+ * Services the USB stack. Needs to be called regularly from the main loop.
+ */
+void usb_task(void);
+
+#endif
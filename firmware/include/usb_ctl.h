@@ -0,0 +1,12 @@
+#ifndef __USB_CTL_H__
+#define __USB_CTL_H__
+/*
+ * Runs the control protocol (see ctl.h) over the second USB CDC
+ * interface.
+ */
+
+#include "ctl.h"
+
+extern const struct ctl_io usb_ctl_io;
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __USB_MIDI_H__
+#define __USB_MIDI_H__
+/*
+ * Class compliant USB MIDI device. Key events are turned in to MIDI
+ * messages and batched up so that everything generated within a 1ms
+ * USB frame (eg a chord) goes out together.
+ */
+
+#include <stdint.h>
+
+// MIDI channel used for everything we send. 0 based.
+#define USB_MIDI_CHANNEL 0
+
+// MIDI note sent for KEY_C1 when there is no octave shift
+#define USB_MIDI_BASE_NOTE 36
+
+#define USB_MIDI_VELOCITY 100
+
+// Function keys are sent as CCs starting at this controller number.
+// 102-119 are undefined in the MIDI spec.
+#define USB_MIDI_FUNC_KEY_CC_BASE 102
+
+/*
+ * Initializes the MIDI batch. The USB stack itself is brought up by
+ * usb_init().
+ */
+int usb_midi_init(void);
+
+/*
+ * Flushes the MIDI batch once per 1ms frame. Called from usb_task().
+ */
+void usb_midi_flush_frame(void);
+
+/*
+ * Queues the MIDI message for a key press or release. Keybed keys are
+ * sent as notes and function keys as CCs.
+ */
+void usb_midi_key_event(uint8_t event_type, uint8_t key_id, int8_t octave_shift);
+
+/*
+ * Returns the number of MIDI messages that have been dropped because
+ * the batch was full.
+ */
+uint32_t usb_midi_dropped(void);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef __VOICE_H__
+#define __VOICE_H__
+/*
+ * Voice allocation across the two CV/gate outputs. CV for voice 0 comes
+ * from DAC channel A and voice 1 from channel B.
+ */
+
+#include <stdint.h>
+#include "mcp4921.h"
+#include "lkp_stack.h"
+#include "sched.h"
+
+#define NUM_VOICES 2
+
+// How long a gate that is already high is held low to retrigger it
+#define VOICE_RETRIGGER_US 1000
+
+enum voice_mode {
+    // Single voice following the last key pressed. Channel B isn't touched.
+    VOICE_MODE_MONO = 0,
+    // Voice 0 plays the lowest held key and voice 1 the highest
+    VOICE_MODE_SPLIT = 1,
+    // Each new key goes to the next voice, preferring a free one
+    VOICE_MODE_ROUND_ROBIN = 2,
+    // Voice 0 plays the last key pressed and voice 1 the one before it
+    VOICE_MODE_LAST_TWO = 3,
+    VOICE_NUM_MODES = 4
+};
+
+/*
+ * Returns the DAC code for a key
+ */
+typedef uint16_t (*voice_key_to_code_t)(uint32_t key_id);
+
+struct voice {
+    uint32_t key_id; // KEY_NONE when the voice is free
+    uint16_t code;
+    uint8_t gate_pin;
+    uint8_t gate; // Set while the gate is high or about to go high
+    sched_handle_t gate_on; // Pending end of a retrigger pulse
+};
+
+struct voice_state {
+    uint8_t mode;
+    uint8_t next_voice; // Used by VOICE_MODE_ROUND_ROBIN
+    struct voice voices[NUM_VOICES];
+    struct mcp4921 *dac;
+    voice_key_to_code_t key_to_code;
+};
+
+/*
+ * Sets up the gate outputs. dac and the scheduler must already be
+ * initialized.
+ */
+int voice_init(struct voice_state *state, struct mcp4921 *dac, voice_key_to_code_t key_to_code);
+
+/*
+ * Changes the allocation mode and frees all voices
+ */
+void voice_set_mode(struct voice_state *state, uint8_t mode);
+
+/*
+ * Updates the voices after a set of keybed keys (IO_KEY_BIT masks) have
+ * been pushed on to and popped off of the held key stack. The DAC and
+ * gates are only updated once, so chords land together.
+ */
+void voice_key_frame(struct voice_state *state, struct lkp_stack *held, uint64_t pressed, uint64_t released);
+
+#endif
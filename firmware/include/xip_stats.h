@@ -0,0 +1,22 @@
+#ifndef __XIP_STATS_H__
+#define __XIP_STATS_H__
+/*
+ * Readout of the XIP cache's hit and access counters. The counters are
+ * shared by both cores and by DMA, and saturate rather than wrap.
+ */
+
+#include <stdint.h>
+
+struct xip_stats {
+    uint32_t hits;
+    uint32_t accesses;
+};
+
+/*
+ * Zeroes both counters
+ */
+void xip_stats_reset(void);
+
+void xip_stats_read(struct xip_stats *stats);
+
+#endif
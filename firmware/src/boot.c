@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "pico/stdlib.h"
+
+#include "boot.h"
+
+volatile uint32_t g_boot_marks[BOOT_NUM_MARKS];
+
+static const char *g_boot_mark_names[BOOT_NUM_MARKS] = {
+    [BOOT_MARK_FIRST_DAC] = "first_dac",
+    [BOOT_MARK_CORE1] = "core1",
+    [BOOT_MARK_FIRST_SCAN] = "first_scan",
+    [BOOT_MARK_SETTINGS] = "settings",
+    [BOOT_MARK_USB] = "usb",
+};
+
+void boot_print(void)
+{
+    printf("boot:");
+
+    for (uint8_t i = 0; i < BOOT_NUM_MARKS; i++) {
+        if (g_boot_marks[i]) {
+            printf(" %s=%luus", g_boot_mark_names[i], (unsigned long) g_boot_marks[i]);
+        } else {
+            printf(" %s=-", g_boot_mark_names[i]);
+        }
+    }
+
+    printf("\n");
+}
@@ -0,0 +1,528 @@
+#include <stdint.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+#include "clock.h"
+#include "hot.h"
+
+#define CLOCK_US_PER_MINUTE (60 * 1000 * 1000)
+
+// Steps are delayed by less than a whole one, so they stay in order
+#define CLOCK_GROOVE_MAX (CLOCK_GROOVE_ONE - 1)
+
+// Offsets for each 16th of a bar, before swing
+static const uint8_t g_clock_grooves[CLOCK_NUM_GROOVES][CLOCK_GROOVE_STEPS] = {
+    [CLOCK_GROOVE_STRAIGHT] = {0},
+    [CLOCK_GROOVE_LAID_BACK] = {0, 0, 0, 0, 24, 0, 0, 0, 0, 0, 0, 0, 24, 0, 0, 0},
+    [CLOCK_GROOVE_HUMAN] = {0, 10, 4, 16, 6, 12, 2, 20, 0, 14, 6, 18, 4, 10, 2, 22},
+};
+
+struct clock_state {
+    alarm_pool_t *pool;
+    alarm_id_t alarm;
+    uint8_t source;
+    uint8_t running;
+    uint32_t tick;
+    uint32_t tick_period_us;
+    // Interpolated ticks still to be generated before the next SYNC_IN pulse
+    uint8_t subticks_remaining;
+    uint8_t sync_in_ppqn;
+    struct clock_period_est est;
+    uint64_t last_pulse_us[CLOCK_NUM_SOURCES];
+
+    // Written by core0, read by core1
+    volatile uint32_t internal_period_us;
+    volatile uint8_t transport_request;
+    volatile uint32_t transport_request_seq;
+
+    uint32_t transport_handled_seq;
+
+    // Feel. Written by core0, picked up by core1 when groove_seq changes.
+    volatile uint8_t steps_per_quarter;
+    volatile uint8_t swing;
+    volatile uint8_t groove;
+    volatile uint32_t groove_seq;
+
+    // Step delays in microseconds, and what they were worked out for
+    uint32_t step_delay_us[CLOCK_GROOVE_STEPS];
+    uint8_t ticks_per_step;
+    uint32_t step_delay_seq;
+    uint32_t step_delay_period_us;
+    uint32_t step; // Step waiting on step_alarm
+    alarm_id_t step_alarm;
+
+    clock_listener_t listeners[CLOCK_MAX_LISTENERS];
+    uint8_t num_listeners;
+
+    // Read by core0. Guarded by position_seq, which is odd while core1 is
+    // part way through updating it.
+    volatile uint32_t position_seq;
+    struct clock_position position;
+} g_clock;
+
+static inline void clock_publish_position(void)
+{
+    g_clock.position_seq++;
+    __dmb();
+
+    g_clock.position.tick = g_clock.tick;
+    g_clock.position.tick_us = time_us_32();
+    g_clock.position.tick_period_us = g_clock.tick_period_us;
+    g_clock.position.running = g_clock.running;
+
+    __dmb();
+    g_clock.position_seq++;
+}
+
+static inline void clock_notify(uint8_t event)
+{
+    clock_publish_position();
+
+    for (uint8_t i = 0; i < g_clock.num_listeners; i++) {
+        g_clock.listeners[i](event, g_clock.tick);
+    }
+}
+
+static void HOT_FUNC(clock_emit_step)(uint32_t step)
+{
+    for (uint8_t i = 0; i < g_clock.num_listeners; i++) {
+        g_clock.listeners[i](CLOCK_STEP, step);
+    }
+}
+
+static int64_t HOT_FUNC(clock_step_alarm_callback)(alarm_id_t id, void *user_data)
+{
+    g_clock.step_alarm = 0;
+    clock_emit_step(g_clock.step);
+
+    return 0;
+}
+
+/*
+ * Sends a delayed step straight away, eg because the next one is due
+ */
+static void HOT_FUNC(clock_flush_step)(void)
+{
+    if (g_clock.step_alarm <= 0) {
+        return;
+    }
+
+    alarm_pool_cancel_alarm(g_clock.pool, g_clock.step_alarm);
+    g_clock.step_alarm = 0;
+    clock_emit_step(g_clock.step);
+}
+
+/*
+ * Works the step delays out in microseconds for the current feel and
+ * tick period
+ */
+static void HOT_FUNC(clock_update_step_delays)(void)
+{
+    g_clock.step_delay_seq = g_clock.groove_seq;
+    __dmb();
+
+    g_clock.step_delay_period_us = g_clock.tick_period_us;
+    g_clock.ticks_per_step = CLOCK_PPQN / g_clock.steps_per_quarter;
+
+    const uint8_t *groove = g_clock_grooves[g_clock.groove];
+    uint32_t step_us = g_clock.tick_period_us * g_clock.ticks_per_step;
+    // At 50% the steps are even. At 75% every other one is half a step late.
+    uint32_t swing = ((g_clock.swing - CLOCK_MIN_SWING) * 2 * CLOCK_GROOVE_ONE) / 100;
+
+    for (uint8_t i = 0; i < CLOCK_GROOVE_STEPS; i++) {
+        uint32_t delay = groove[i] + ((i & 1) ? swing : 0);
+        if (delay > CLOCK_GROOVE_MAX) {
+            delay = CLOCK_GROOVE_MAX;
+        }
+
+        g_clock.step_delay_us[i] = (step_us * delay) / CLOCK_GROOVE_ONE;
+    }
+}
+
+/*
+ * Called on every tick while running. Starts a step if the tick is on a
+ * step boundary.
+ */
+static void HOT_FUNC(clock_check_step)(void)
+{
+    if (g_clock.step_delay_seq != g_clock.groove_seq || g_clock.step_delay_period_us != g_clock.tick_period_us) {
+        clock_update_step_delays();
+    }
+
+    if (g_clock.tick % g_clock.ticks_per_step) {
+        return;
+    }
+
+    uint32_t step = g_clock.tick / g_clock.ticks_per_step;
+    uint32_t delay_us = g_clock.step_delay_us[step % CLOCK_GROOVE_STEPS];
+
+    clock_flush_step();
+
+    if (!delay_us) {
+        clock_emit_step(step);
+        return;
+    }
+
+    g_clock.step = step;
+    // Not fire_if_past, which would call the callback itself and have the
+    // step sent twice. 0 means the time has already passed and -1 that the
+    // pool is full, and either way the step goes now.
+    alarm_id_t alarm = alarm_pool_add_alarm_in_us(g_clock.pool, delay_us, clock_step_alarm_callback, 0, false);
+    if (alarm <= 0) {
+        clock_emit_step(step);
+        return;
+    }
+
+    g_clock.step_alarm = alarm;
+}
+
+static void HOT_FUNC(clock_apply_transport)(uint8_t event)
+{
+    switch (event) {
+        case CLOCK_START:
+            clock_flush_step();
+            g_clock.tick = 0;
+            g_clock.running = 1;
+            break;
+        case CLOCK_CONTINUE:
+            g_clock.running = 1;
+            break;
+        case CLOCK_STOP:
+            clock_flush_step();
+            g_clock.running = 0;
+            break;
+        default:
+            return;
+    }
+
+    clock_notify(event);
+}
+
+static void HOT_FUNC(clock_emit_tick)(void)
+{
+    uint32_t seq = g_clock.transport_request_seq;
+    if (seq != g_clock.transport_handled_seq) {
+        g_clock.transport_handled_seq = seq;
+        clock_apply_transport(g_clock.transport_request);
+    }
+
+    clock_notify(CLOCK_TICK);
+
+    if (g_clock.running) {
+        clock_check_step();
+        g_clock.tick++;
+    }
+}
+
+static int64_t HOT_FUNC(clock_alarm_callback)(alarm_id_t id, void *user_data)
+{
+    if (CLOCK_SRC_INTERNAL == g_clock.source) {
+        clock_emit_tick();
+        g_clock.tick_period_us = g_clock.internal_period_us;
+
+        // Negative values reschedule relative to when this alarm was
+        // supposed to fire, so the clock doesn't drift by however long the
+        // listeners take. Positive ones would count from now.
+        return -(int64_t) g_clock.tick_period_us;
+    }
+
+    if (g_clock.subticks_remaining) {
+        g_clock.subticks_remaining--;
+        clock_emit_tick();
+    }
+
+    if (!g_clock.subticks_remaining) {
+        g_clock.alarm = 0;
+        return 0;
+    }
+
+    return -(int64_t) g_clock.tick_period_us;
+}
+
+static void HOT_FUNC(clock_cancel_alarm)(void)
+{
+    if (g_clock.alarm > 0) {
+        alarm_pool_cancel_alarm(g_clock.pool, g_clock.alarm);
+    }
+
+    g_clock.alarm = 0;
+}
+
+static void HOT_FUNC(clock_schedule_alarm)(uint32_t delay_us)
+{
+    alarm_id_t alarm = alarm_pool_add_alarm_in_us(
+        g_clock.pool,
+        delay_us,
+        clock_alarm_callback,
+        0,
+        true
+    );
+
+    g_clock.alarm = alarm > 0 ? alarm : 0;
+}
+
+static void HOT_FUNC(clock_set_source)(uint8_t source)
+{
+    clock_cancel_alarm();
+    clock_period_est_reset(&g_clock.est);
+    g_clock.subticks_remaining = 0;
+    g_clock.source = source;
+
+    if (CLOCK_SRC_INTERNAL == source) {
+        g_clock.tick_period_us = g_clock.internal_period_us;
+        clock_schedule_alarm(g_clock.tick_period_us);
+    }
+}
+
+uint32_t HOT_FUNC(clock_period_est_update)(struct clock_period_est *est, uint64_t now_us)
+{
+    uint64_t last = est->last_pulse_us;
+    est->last_pulse_us = now_us;
+
+    if (!last || now_us - last > CLOCK_EXT_TIMEOUT_US) {
+        est->period_us = 0;
+        return 0;
+    }
+
+    uint32_t measured = now_us - last;
+
+    if (!est->period_us || measured < est->period_us / 2 || measured > est->period_us * 2) {
+        // First measurement, or the tempo jumped. Don't smooth across it.
+        est->period_us = measured;
+    } else {
+        // Exponential moving average to take the edge off of jitter
+        est->period_us = (3 * est->period_us + measured) / 4;
+    }
+
+    return est->period_us;
+}
+
+int clock_init(void)
+{
+    memset(&g_clock, 0, sizeof(struct clock_state));
+
+    g_clock.source = CLOCK_SRC_INTERNAL;
+    g_clock.sync_in_ppqn = CLOCK_SYNC_IN_DEFAULT_PPQN;
+    g_clock.steps_per_quarter = CLOCK_DEFAULT_STEPS_PER_QUARTER;
+    g_clock.swing = CLOCK_MIN_SWING;
+    g_clock.groove = CLOCK_GROOVE_STRAIGHT;
+    g_clock.groove_seq = 1;
+    g_clock.running = 1;
+    clock_set_bpm(CLOCK_DEFAULT_BPM);
+    g_clock.tick_period_us = g_clock.internal_period_us;
+
+    return 0;
+}
+
+void clock_run(alarm_pool_t *pool)
+{
+    g_clock.pool = pool;
+
+    uint32_t irq_state = save_and_disable_interrupts();
+    clock_set_source(CLOCK_SRC_INTERNAL);
+    restore_interrupts(irq_state);
+}
+
+void clock_recover(void)
+{
+    // Pending alarms went with the old pool
+    g_clock.alarm = 0;
+    g_clock.step_alarm = 0;
+    g_clock.pool = NULL;
+
+    if (g_clock.position_seq & 1) {
+        g_clock.position_seq++;
+    }
+}
+
+int clock_add_listener(clock_listener_t listener)
+{
+    if (g_clock.num_listeners >= CLOCK_MAX_LISTENERS) {
+        return 1;
+    }
+
+    g_clock.listeners[g_clock.num_listeners++] = listener;
+
+    return 0;
+}
+
+void HOT_FUNC(clock_ext_pulse)(uint8_t source)
+{
+    uint64_t now = time_us_64();
+    g_clock.last_pulse_us[source] = now;
+
+    if (source != g_clock.source) {
+        return;
+    }
+
+    uint32_t pulse_period = clock_period_est_update(&g_clock.est, now);
+    uint8_t ticks_per_pulse = CLOCK_SRC_SYNC_IN == source ? CLOCK_PPQN / g_clock.sync_in_ppqn : 1;
+
+    // If the pulse came in early, catch up on the interpolated ticks that
+    // didn't get to fire so that the tick count stays locked to the pulses
+    clock_cancel_alarm();
+    while (g_clock.subticks_remaining) {
+        g_clock.subticks_remaining--;
+        clock_emit_tick();
+    }
+
+    clock_emit_tick();
+
+    if (!pulse_period) {
+        return;
+    }
+
+    g_clock.tick_period_us = pulse_period / ticks_per_pulse;
+
+    if (ticks_per_pulse > 1) {
+        g_clock.subticks_remaining = ticks_per_pulse - 1;
+        clock_schedule_alarm(g_clock.tick_period_us);
+    }
+}
+
+void HOT_FUNC(clock_ext_transport)(uint8_t source, uint8_t event)
+{
+    if (source != g_clock.source) {
+        return;
+    }
+
+    clock_apply_transport(event);
+}
+
+void clock_update_source(uint8_t sync_cable_connected)
+{
+    uint8_t source = CLOCK_SRC_INTERNAL;
+    uint64_t now = time_us_64();
+
+    if (sync_cable_connected) {
+        source = CLOCK_SRC_SYNC_IN;
+    } else if (g_clock.last_pulse_us[CLOCK_SRC_MIDI]
+            && now - g_clock.last_pulse_us[CLOCK_SRC_MIDI] < CLOCK_EXT_TIMEOUT_US) {
+        source = CLOCK_SRC_MIDI;
+    }
+
+    if (source == g_clock.source) {
+        return;
+    }
+
+    // The clock interrupts also run on this core
+    uint32_t irq_state = save_and_disable_interrupts();
+    clock_set_source(source);
+    restore_interrupts(irq_state);
+}
+
+void clock_request_transport(uint8_t event)
+{
+    g_clock.transport_request = event;
+    __dmb();
+    g_clock.transport_request_seq++;
+}
+
+void clock_set_bpm(uint16_t bpm)
+{
+    if (bpm < CLOCK_MIN_BPM) {
+        bpm = CLOCK_MIN_BPM;
+    } else if (bpm > CLOCK_MAX_BPM) {
+        bpm = CLOCK_MAX_BPM;
+    }
+
+    g_clock.internal_period_us = CLOCK_US_PER_MINUTE / (bpm * CLOCK_PPQN);
+}
+
+int clock_set_sync_in_ppqn(uint8_t ppqn)
+{
+    if (!ppqn || ppqn > CLOCK_PPQN || CLOCK_PPQN % ppqn) {
+        return 1;
+    }
+
+    g_clock.sync_in_ppqn = ppqn;
+
+    return 0;
+}
+
+uint8_t clock_get_sync_in_ppqn(void)
+{
+    return g_clock.sync_in_ppqn;
+}
+
+int clock_set_steps_per_quarter(uint8_t steps)
+{
+    if (!steps || steps > CLOCK_PPQN || CLOCK_PPQN % steps) {
+        return 1;
+    }
+
+    g_clock.steps_per_quarter = steps;
+    __dmb();
+    g_clock.groove_seq++;
+
+    return 0;
+}
+
+uint8_t clock_get_steps_per_quarter(void)
+{
+    return g_clock.steps_per_quarter;
+}
+
+void clock_set_swing(uint8_t swing)
+{
+    if (swing < CLOCK_MIN_SWING) {
+        swing = CLOCK_MIN_SWING;
+    } else if (swing > CLOCK_MAX_SWING) {
+        swing = CLOCK_MAX_SWING;
+    }
+
+    g_clock.swing = swing;
+    __dmb();
+    g_clock.groove_seq++;
+}
+
+uint8_t clock_get_swing(void)
+{
+    return g_clock.swing;
+}
+
+int clock_set_groove(uint8_t groove)
+{
+    if (groove >= CLOCK_NUM_GROOVES) {
+        return 1;
+    }
+
+    g_clock.groove = groove;
+    __dmb();
+    g_clock.groove_seq++;
+
+    return 0;
+}
+
+uint8_t clock_get_groove(void)
+{
+    return g_clock.groove;
+}
+
+uint32_t HOT_FUNC(clock_get_tick_period_us)(void)
+{
+    return g_clock.tick_period_us;
+}
+
+uint8_t clock_get_source(void)
+{
+    return g_clock.source;
+}
+
+uint8_t clock_is_running(void)
+{
+    return g_clock.running;
+}
+
+void HOT_FUNC(clock_read_position)(struct clock_position *position)
+{
+    uint32_t seq;
+
+    do {
+        seq = g_clock.position_seq;
+        __dmb();
+        memcpy(position, &g_clock.position, sizeof(struct clock_position));
+        __dmb();
+    } while ((seq & 1) || seq != g_clock.position_seq);
+}
@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+
+#include "boot.h"
+#include "console.h"
+#include "health.h"
+#include "hot.h"
+#include "io.h"
+#include "lfo.h"
+#include "settings.h"
+#include "sync_out.h"
+#include "tuning.h"
+#include "xip_stats.h"
+
+struct console_state {
+    char line[CONSOLE_LINE_LEN];
+    uint8_t line_len;
+    uint8_t overflowed; // Discarding until the end of an overlong line
+    uint8_t uploading;
+    uint8_t upload_slot;
+    struct tuning_parser parser;
+    console_tuning_callback_t on_tuning;
+} g_console;
+
+static void console_tuning_command(const char *args)
+{
+    if (!strncmp(args, "scl ", 4)) {
+        long slot = strtol(args + 4, NULL, 10);
+        if (slot <= TUNING_12TET || slot >= TUNING_NUM_SLOTS) {
+            printf("tuning: error bad slot\n");
+            return;
+        }
+
+        tuning_parser_begin(&g_console.parser);
+        g_console.uploading = 1;
+        g_console.upload_slot = slot;
+    } else if (!strcmp(args, "kbm")) {
+        if (!g_console.uploading) {
+            printf("tuning: error no upload\n");
+            return;
+        }
+
+        tuning_parser_begin_kbm(&g_console.parser);
+    } else if (!strcmp(args, "end")) {
+        if (!g_console.uploading) {
+            printf("tuning: error no upload\n");
+            return;
+        }
+
+        g_console.uploading = 0;
+
+        if (tuning_parser_end(&g_console.parser)) {
+            printf("tuning: error parse\n");
+            return;
+        }
+
+        if (tuning_save(g_console.upload_slot, &g_console.parser.tuning)) {
+            printf("tuning: error save\n");
+            return;
+        }
+
+        g_console.on_tuning(g_console.upload_slot, 0);
+        printf("tuning: ok\n");
+    } else if (!strncmp(args, "select ", 7)) {
+        long slot = strtol(args + 7, NULL, 10);
+        if (slot < TUNING_12TET || slot >= TUNING_NUM_SLOTS) {
+            printf("tuning: error bad slot\n");
+            return;
+        }
+
+        g_console.on_tuning(slot, 1);
+        printf("tuning: ok\n");
+    } else {
+        printf("tuning: error unknown command\n");
+    }
+}
+
+static void console_xip_command(void)
+{
+    struct xip_stats stats;
+    xip_stats_read(&stats);
+
+    uint32_t misses = stats.accesses - stats.hits;
+    uint32_t permille = stats.accesses ? (uint32_t) (((uint64_t) stats.hits * 1000) / stats.accesses) : 0;
+
+    printf("xip: hits=%lu misses=%lu hit_rate=%lu.%lu%% hot_in_ram=%d\n",
+        (unsigned long) stats.hits, (unsigned long) misses,
+        (unsigned long) permille / 10, (unsigned long) permille % 10, KEYBOARD_HOT_IN_RAM);
+}
+
+static void console_health_command(void)
+{
+    struct health_stats health;
+    struct io_scan_stats scan;
+
+    health_get_stats(&health);
+    io_get_scan_stats(&scan);
+
+    printf("health: checks=%lu late_checks=%lu scan_stalls=%lu analog_stalls=%lu recoveries=%lu watchdog_reboot=%d\n",
+        (unsigned long) health.checks, (unsigned long) health.late_checks, (unsigned long) health.scan_stalls,
+        (unsigned long) health.analog_stalls, (unsigned long) health.recoveries, health.watchdog_reboot);
+    printf("health: poll_period_us=%lu..%lu late_polls=%lu\n",
+        (unsigned long) (scan.min_poll_period_us == UINT32_MAX ? 0 : scan.min_poll_period_us),
+        (unsigned long) scan.max_poll_period_us, (unsigned long) scan.late_polls);
+}
+
+static void console_keys_command(void)
+{
+    struct io_key_snapshot snapshot;
+    io_read_key_snapshot(&snapshot);
+
+    printf("keys:");
+    for (uint64_t keys = snapshot.keys; keys; keys &= keys - 1) {
+        uint32_t key_id = __builtin_ctzll(keys);
+        printf(" %lu@r%d/c%d", (unsigned long) key_id, key_positions[key_id].row, key_positions[key_id].col);
+    }
+    printf("\n");
+}
+
+static void console_sync_command(const char *args)
+{
+    if (!*args) {
+        printf("sync: ppqn=%d width_us=%d thru=%d thru_delay_ns=%lu dropped=%lu\n",
+            sync_out_get_ppqn(), sync_out_get_width_us(), sync_out_get_thru(),
+            (unsigned long) sync_out_thru_delay_ns(), (unsigned long) sync_out_dropped());
+        return;
+    }
+
+    if (!strncmp(args, " ppqn ", 6)) {
+        if (sync_out_set_ppqn(strtol(args + 6, NULL, 10))) {
+            printf("sync: error bad ppqn\n");
+            return;
+        }
+    } else if (!strncmp(args, " width ", 7)) {
+        long width_us = strtol(args + 7, NULL, 10);
+        if (width_us < SYNC_OUT_MIN_WIDTH_US || width_us > SYNC_OUT_MAX_WIDTH_US) {
+            printf("sync: error bad width\n");
+            return;
+        }
+
+        sync_out_set_width_us(width_us);
+    } else if (!strncmp(args, " thru ", 6)) {
+        sync_out_set_thru(strtol(args + 6, NULL, 10) != 0);
+    } else {
+        printf("sync: error unknown command\n");
+        return;
+    }
+
+    settings_changed();
+    printf("sync: ok\n");
+}
+
+static void console_lfo_command(const char *args)
+{
+    if (!*args) {
+        struct lfo_stats stats;
+        lfo_get_stats(&stats);
+
+        printf("lfo: shape=%d sync=%d rate_mhz=%d division=%d depth=%d\n",
+            lfo_get_shape(), lfo_get_sync(), lfo_get_rate_mhz(), lfo_get_division(), lfo_get_depth());
+        printf("lfo: updates=%lu dropped=%lu max_update_us=%lu\n",
+            (unsigned long) stats.updates, (unsigned long) stats.dropped, (unsigned long) stats.max_update_us);
+        return;
+    }
+
+    if (!strncmp(args, " shape ", 7)) {
+        if (lfo_set_shape(strtol(args + 7, NULL, 10))) {
+            printf("lfo: error bad shape\n");
+            return;
+        }
+    } else if (!strncmp(args, " rate ", 6)) {
+        long rate_mhz = strtol(args + 6, NULL, 10);
+        if (rate_mhz < LFO_MIN_RATE_MHZ || rate_mhz > LFO_MAX_RATE_MHZ || lfo_set_rate_mhz(rate_mhz)) {
+            printf("lfo: error bad rate\n");
+            return;
+        }
+
+        lfo_set_sync(0);
+    } else if (!strncmp(args, " sync ", 6)) {
+        if (lfo_set_division(strtol(args + 6, NULL, 10))) {
+            printf("lfo: error bad division\n");
+            return;
+        }
+
+        lfo_set_sync(1);
+    } else if (!strncmp(args, " depth ", 7)) {
+        long depth = strtol(args + 7, NULL, 10);
+        if (depth < 0 || depth > LFO_MAX_DEPTH) {
+            printf("lfo: error bad depth\n");
+            return;
+        }
+
+        lfo_set_depth(depth);
+    } else {
+        printf("lfo: error unknown command\n");
+        return;
+    }
+
+    settings_changed();
+    printf("lfo: ok\n");
+}
+
+static void console_handle_line(const char *line)
+{
+    if (!strncmp(line, "tuning ", 7)) {
+        console_tuning_command(line + 7);
+    } else if (!strcmp(line, "xip")) {
+        console_xip_command();
+    } else if (!strcmp(line, "xip reset")) {
+        xip_stats_reset();
+        printf("xip: ok\n");
+    } else if (!strcmp(line, "boot")) {
+        boot_print();
+    } else if (!strcmp(line, "health")) {
+        console_health_command();
+    } else if (!strcmp(line, "keys")) {
+        console_keys_command();
+    } else if (!strncmp(line, "sync", 4) && (!line[4] || ' ' == line[4])) {
+        console_sync_command(line + 4);
+    } else if (!strncmp(line, "lfo", 3) && (!line[3] || ' ' == line[3])) {
+        console_lfo_command(line + 3);
+    } else if (g_console.uploading) {
+        tuning_parse_line(&g_console.parser, line);
+    }
+}
+
+int console_init(console_tuning_callback_t on_tuning)
+{
+    memset(&g_console, 0, sizeof(struct console_state));
+    g_console.on_tuning = on_tuning;
+
+    return 0;
+}
+
+void console_task(void)
+{
+    for (uint8_t i = 0; i < CONSOLE_READ_BUDGET; i++) {
+        int c = getchar_timeout_us(0);
+        if (c < 0) {
+            return;
+        }
+
+        if ('\r' == c) {
+            continue;
+        }
+
+        if ('\n' != c) {
+            if (g_console.line_len < CONSOLE_LINE_LEN - 1) {
+                g_console.line[g_console.line_len++] = c;
+            } else {
+                g_console.overflowed = 1;
+            }
+            continue;
+        }
+
+        g_console.line[g_console.line_len] = '\0';
+
+        if (g_console.overflowed) {
+            // Poisons any upload in progress
+            g_console.parser.error = 1;
+        } else {
+            console_handle_line(g_console.line);
+        }
+
+        g_console.line_len = 0;
+        g_console.overflowed = 0;
+    }
+}
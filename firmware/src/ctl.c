@@ -0,0 +1,535 @@
+#include <stdint.h>
+#include <string.h>
+#include "pico/stdlib.h"
+
+#include "clock.h"
+#include "ctl.h"
+#include "frame.h"
+#include "health.h"
+#include "io.h"
+#include "kvstore.h"
+#include "lfo.h"
+#include "looper.h"
+#include "sched.h"
+#include "settings.h"
+#include "sync_out.h"
+#include "tuning.h"
+#include "xip_stats.h"
+
+#define CTL_FRAME_LEN FRAME_ENCODED_LEN(CTL_MAX_PAYLOAD)
+
+// Response header: cmd, seq, status
+#define CTL_HEADER_LEN 3
+
+struct ctl_param_entry {
+    int32_t (*get)(void);
+    int (*set)(int32_t value); // Returns 0 on success
+};
+
+struct ctl_state {
+    // Encoded bytes as they come in. Frames are decoded in place.
+    uint8_t rx[CTL_FRAME_LEN];
+    uint16_t rx_len;
+    uint8_t discarding; // Skipping the rest of an overlong frame
+    uint8_t tx[CTL_MAX_PAYLOAD];
+    uint8_t tx_frame[CTL_FRAME_LEN];
+    uint32_t bad_frames;
+    uint32_t tx_dropped;
+    uint32_t stream_interval_us; // 0 when not streaming
+    uint64_t last_stream_us;
+    const struct ctl_io *io;
+    ctl_tuning_callback_t on_tuning;
+} g_ctl;
+
+static inline void ctl_put_u16(uint8_t *buf, uint16_t value)
+{
+    buf[0] = value & 0xff;
+    buf[1] = value >> 8;
+}
+
+static inline void ctl_put_u32(uint8_t *buf, uint32_t value)
+{
+    ctl_put_u16(buf, value & 0xffff);
+    ctl_put_u16(buf + 2, value >> 16);
+}
+
+static inline uint32_t ctl_get_u32(const uint8_t *buf)
+{
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t) buf[3] << 24);
+}
+
+static int32_t ctl_get_bpm(void)
+{
+    uint32_t quarter_us = clock_get_tick_period_us() * CLOCK_PPQN;
+    return (60000000 + quarter_us / 2) / quarter_us;
+}
+
+static int ctl_set_bpm(int32_t value)
+{
+    if (value < CLOCK_MIN_BPM || value > CLOCK_MAX_BPM) {
+        return 1;
+    }
+
+    clock_set_bpm(value);
+    return 0;
+}
+
+static int32_t ctl_get_steps_per_quarter(void)
+{
+    return clock_get_steps_per_quarter();
+}
+
+static int ctl_set_steps_per_quarter(int32_t value)
+{
+    return value < 0 || value > UINT8_MAX || clock_set_steps_per_quarter(value);
+}
+
+static int32_t ctl_get_swing(void)
+{
+    return clock_get_swing();
+}
+
+static int ctl_set_swing(int32_t value)
+{
+    if (value < CLOCK_MIN_SWING || value > CLOCK_MAX_SWING) {
+        return 1;
+    }
+
+    clock_set_swing(value);
+    return 0;
+}
+
+static int32_t ctl_get_groove(void)
+{
+    return clock_get_groove();
+}
+
+static int ctl_set_groove(int32_t value)
+{
+    return value < 0 || value > UINT8_MAX || clock_set_groove(value);
+}
+
+static int32_t ctl_get_sync_in_ppqn(void)
+{
+    return clock_get_sync_in_ppqn();
+}
+
+static int ctl_set_sync_in_ppqn(int32_t value)
+{
+    return value < 0 || value > UINT8_MAX || clock_set_sync_in_ppqn(value);
+}
+
+static int32_t ctl_get_sync_out_ppqn(void)
+{
+    return sync_out_get_ppqn();
+}
+
+static int ctl_set_sync_out_ppqn(int32_t value)
+{
+    return value < 0 || value > UINT8_MAX || sync_out_set_ppqn(value);
+}
+
+static int32_t ctl_get_sync_out_width_us(void)
+{
+    return sync_out_get_width_us();
+}
+
+static int ctl_set_sync_out_width_us(int32_t value)
+{
+    if (value < SYNC_OUT_MIN_WIDTH_US || value > SYNC_OUT_MAX_WIDTH_US) {
+        return 1;
+    }
+
+    sync_out_set_width_us(value);
+    return 0;
+}
+
+static int32_t ctl_get_sync_out_thru(void)
+{
+    return sync_out_get_thru();
+}
+
+static int ctl_set_sync_out_thru(int32_t value)
+{
+    sync_out_set_thru(value != 0);
+    return 0;
+}
+
+static int32_t ctl_get_looper_grid(void)
+{
+    return looper_get_grid();
+}
+
+static int ctl_set_looper_grid(int32_t value)
+{
+    if (value < 0 || value >= LOOPER_NUM_GRIDS) {
+        return 1;
+    }
+
+    looper_set_grid(value);
+    return 0;
+}
+
+static int32_t ctl_get_lfo_shape(void)
+{
+    return lfo_get_shape();
+}
+
+static int ctl_set_lfo_shape(int32_t value)
+{
+    return value < 0 || value > UINT8_MAX || lfo_set_shape(value);
+}
+
+static int32_t ctl_get_lfo_sync(void)
+{
+    return lfo_get_sync();
+}
+
+static int ctl_set_lfo_sync(int32_t value)
+{
+    lfo_set_sync(value != 0);
+    return 0;
+}
+
+static int32_t ctl_get_lfo_rate_mhz(void)
+{
+    return lfo_get_rate_mhz();
+}
+
+static int ctl_set_lfo_rate_mhz(int32_t value)
+{
+    return value < 0 || value > UINT16_MAX || lfo_set_rate_mhz(value);
+}
+
+static int32_t ctl_get_lfo_division(void)
+{
+    return lfo_get_division();
+}
+
+static int ctl_set_lfo_division(int32_t value)
+{
+    return value < 0 || value > UINT8_MAX || lfo_set_division(value);
+}
+
+static int32_t ctl_get_lfo_depth(void)
+{
+    return lfo_get_depth();
+}
+
+static int ctl_set_lfo_depth(int32_t value)
+{
+    if (value < 0 || value > LFO_MAX_DEPTH) {
+        return 1;
+    }
+
+    lfo_set_depth(value);
+    return 0;
+}
+
+static const struct ctl_param_entry g_ctl_params[CTL_NUM_PARAMS] = {
+    [CTL_PARAM_BPM] = {ctl_get_bpm, ctl_set_bpm},
+    [CTL_PARAM_STEPS_PER_QUARTER] = {ctl_get_steps_per_quarter, ctl_set_steps_per_quarter},
+    [CTL_PARAM_SWING] = {ctl_get_swing, ctl_set_swing},
+    [CTL_PARAM_GROOVE] = {ctl_get_groove, ctl_set_groove},
+    [CTL_PARAM_SYNC_IN_PPQN] = {ctl_get_sync_in_ppqn, ctl_set_sync_in_ppqn},
+    [CTL_PARAM_SYNC_OUT_PPQN] = {ctl_get_sync_out_ppqn, ctl_set_sync_out_ppqn},
+    [CTL_PARAM_SYNC_OUT_WIDTH_US] = {ctl_get_sync_out_width_us, ctl_set_sync_out_width_us},
+    [CTL_PARAM_SYNC_OUT_THRU] = {ctl_get_sync_out_thru, ctl_set_sync_out_thru},
+    [CTL_PARAM_LOOPER_GRID] = {ctl_get_looper_grid, ctl_set_looper_grid},
+    [CTL_PARAM_LFO_SHAPE] = {ctl_get_lfo_shape, ctl_set_lfo_shape},
+    [CTL_PARAM_LFO_SYNC] = {ctl_get_lfo_sync, ctl_set_lfo_sync},
+    [CTL_PARAM_LFO_RATE_MHZ] = {ctl_get_lfo_rate_mhz, ctl_set_lfo_rate_mhz},
+    [CTL_PARAM_LFO_DIVISION] = {ctl_get_lfo_division, ctl_set_lfo_division},
+    [CTL_PARAM_LFO_DEPTH] = {ctl_get_lfo_depth, ctl_set_lfo_depth},
+};
+
+/*
+ * Frames the response in g_ctl.tx and queues it. Responses are dropped
+ * rather than waited on if the host isn't keeping up.
+ */
+static void ctl_send(uint16_t len)
+{
+    size_t frame_len = frame_encode(g_ctl.tx, len, g_ctl.tx_frame);
+
+    if (g_ctl.io->write(g_ctl.tx_frame, frame_len)) {
+        g_ctl.tx_dropped++;
+    }
+}
+
+/*
+ * Fills in the stats after the response header. Returns the length of
+ * the response.
+ */
+static uint16_t ctl_fill_stats(void)
+{
+    struct sched_stats sched;
+    struct io_scan_stats scan;
+    struct xip_stats xip;
+    struct health_stats health;
+    uint8_t *out = g_ctl.tx + CTL_HEADER_LEN;
+
+    sched_get_stats(&sched);
+    io_get_scan_stats(&scan);
+    xip_stats_read(&xip);
+    health_get_stats(&health);
+
+    *out++ = CTL_STATS_VERSION;
+
+    const uint32_t counters[] = {
+        sched.fired, sched.dropped, sched.max_lateness_us,
+        scan.frames, scan.probes, scan.idle_entries, scan.wakes,
+        scan.last_wake_latency_us, scan.max_wake_latency_us, scan.frame_queue_full,
+        xip.hits, xip.accesses,
+        sync_out_dropped(), looper_dropped(), kv_erase_count(),
+        g_ctl.bad_frames, g_ctl.tx_dropped,
+        scan.min_poll_period_us, scan.max_poll_period_us, scan.late_polls,
+        health.late_checks, health.scan_stalls, health.analog_stalls, health.recoveries,
+        health.watchdog_reboot,
+    };
+
+    for (uint8_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++, out += 4) {
+        ctl_put_u32(out, counters[i]);
+    }
+
+    // The lateness histogram goes last, see SCHED_LATENESS_BUCKETS
+    for (uint8_t i = 0; i < SCHED_LATENESS_BUCKETS; i++, out += 4) {
+        ctl_put_u32(out, sched.lateness[i]);
+    }
+
+    return out - g_ctl.tx;
+}
+
+static uint8_t ctl_param_command(uint8_t cmd, const uint8_t *args, uint16_t len, uint16_t *out_len)
+{
+    uint8_t *out = g_ctl.tx + CTL_HEADER_LEN;
+
+    if (len < 1 || args[0] >= CTL_NUM_PARAMS) {
+        return CTL_ERR_BAD_ARGS;
+    }
+
+    const struct ctl_param_entry *param = &g_ctl_params[args[0]];
+
+    if (CTL_CMD_PARAM_SET == cmd) {
+        if (len != 5 || param->set((int32_t) ctl_get_u32(args + 1))) {
+            return CTL_ERR_BAD_ARGS;
+        }
+
+        settings_changed();
+    }
+
+    out[0] = args[0];
+    ctl_put_u32(out + 1, param->get());
+    *out_len += 5;
+
+    return CTL_OK;
+}
+
+static uint8_t ctl_tuning_command(uint8_t cmd, const uint8_t *args, uint16_t len, uint16_t *out_len)
+{
+    uint8_t *out = g_ctl.tx + CTL_HEADER_LEN;
+    struct tuning tuning;
+
+    if (len < 1 || args[0] >= TUNING_NUM_SLOTS) {
+        return CTL_ERR_BAD_ARGS;
+    }
+
+    uint8_t slot = args[0];
+    out[0] = slot;
+    *out_len += 1;
+
+    switch (cmd) {
+        case CTL_CMD_TUNING_READ:
+            if (tuning_load(slot, &tuning)) {
+                return CTL_ERR_EMPTY;
+            }
+
+            memcpy(out + 1, &tuning, sizeof(struct tuning));
+            *out_len += sizeof(struct tuning);
+            return CTL_OK;
+        case CTL_CMD_TUNING_WRITE:
+            if (TUNING_12TET == slot || len != 1 + sizeof(struct tuning)) {
+                return CTL_ERR_BAD_ARGS;
+            }
+
+            memcpy(&tuning, args + 1, sizeof(struct tuning));
+
+            // Everything that tuning_note_volts() relies on
+            if (!tuning.num_degrees || tuning.num_degrees > TUNING_MAX_DEGREES
+                || tuning.map_size > TUNING_MAX_MAP || tuning.octave_degree > tuning.num_degrees) {
+                return CTL_ERR_BAD_ARGS;
+            }
+
+            if (tuning_save(slot, &tuning)) {
+                return CTL_ERR_FAILED;
+            }
+
+            g_ctl.on_tuning(slot, 0);
+            return CTL_OK;
+        default:
+            g_ctl.on_tuning(slot, 1);
+            return CTL_OK;
+    }
+}
+
+static uint8_t ctl_pattern_command(uint8_t cmd, const uint8_t *args, uint16_t len, uint16_t *out_len)
+{
+    uint8_t *out = g_ctl.tx + CTL_HEADER_LEN;
+
+    if (len < 1 || args[0] >= CTL_PATTERN_SLOTS) {
+        return CTL_ERR_BAD_ARGS;
+    }
+
+    uint8_t key = KV_KEY_PATTERN_BASE + args[0];
+    out[0] = args[0];
+    *out_len += 1;
+
+    if (CTL_CMD_PATTERN_WRITE == cmd) {
+        if (len < 2 || len - 1 > KV_PATTERN_MAX_LEN) {
+            return CTL_ERR_BAD_ARGS;
+        }
+
+        return kv_write(key, args + 1, len - 1) ? CTL_ERR_FAILED : CTL_OK;
+    }
+
+    int pattern_len = kv_read(key, out + 1, KV_PATTERN_MAX_LEN);
+    if (pattern_len < 0) {
+        return CTL_ERR_EMPTY;
+    }
+
+    *out_len += pattern_len;
+    return CTL_OK;
+}
+
+/*
+ * Handles a decoded request and sends the response
+ */
+static void ctl_handle_frame(const uint8_t *frame, uint16_t len)
+{
+    if (len < 2) {
+        g_ctl.bad_frames++;
+        return;
+    }
+
+    uint8_t cmd = frame[0];
+    const uint8_t *args = frame + 2;
+    uint16_t args_len = len - 2;
+    uint16_t out_len = CTL_HEADER_LEN;
+    uint8_t status = CTL_OK;
+
+    switch (cmd) {
+        case CTL_CMD_PING:
+            g_ctl.tx[CTL_HEADER_LEN] = CTL_VERSION;
+            ctl_put_u16(g_ctl.tx + CTL_HEADER_LEN + 1, CTL_MAX_PAYLOAD);
+            out_len += 3;
+            break;
+        case CTL_CMD_PARAM_GET:
+        case CTL_CMD_PARAM_SET:
+            status = ctl_param_command(cmd, args, args_len, &out_len);
+            break;
+        case CTL_CMD_TUNING_READ:
+        case CTL_CMD_TUNING_WRITE:
+        case CTL_CMD_TUNING_SELECT:
+            status = ctl_tuning_command(cmd, args, args_len, &out_len);
+            break;
+        case CTL_CMD_PATTERN_READ:
+        case CTL_CMD_PATTERN_WRITE:
+            status = ctl_pattern_command(cmd, args, args_len, &out_len);
+            break;
+        case CTL_CMD_STATS:
+            out_len = ctl_fill_stats();
+            break;
+        case CTL_CMD_STREAM:
+            if (2 != args_len) {
+                status = CTL_ERR_BAD_ARGS;
+                break;
+            }
+
+            uint16_t interval_ms = args[0] | (args[1] << 8);
+            if (interval_ms && interval_ms < CTL_MIN_STREAM_INTERVAL_MS) {
+                interval_ms = CTL_MIN_STREAM_INTERVAL_MS;
+            }
+
+            g_ctl.stream_interval_us = interval_ms * 1000;
+            g_ctl.last_stream_us = time_us_64();
+            break;
+        default:
+            status = CTL_ERR_UNKNOWN_CMD;
+            break;
+    }
+
+    // The header goes in last, since handlers may have overwritten it
+    g_ctl.tx[0] = cmd | CTL_RESPONSE;
+    g_ctl.tx[1] = frame[1];
+    g_ctl.tx[2] = status;
+
+    ctl_send(CTL_OK == status ? out_len : CTL_HEADER_LEN);
+}
+
+int ctl_init(const struct ctl_io *io, ctl_tuning_callback_t on_tuning)
+{
+    memset(&g_ctl, 0, sizeof(struct ctl_state));
+    g_ctl.io = io;
+    g_ctl.on_tuning = on_tuning;
+
+    return 0;
+}
+
+void ctl_task(void)
+{
+    if (g_ctl.stream_interval_us && time_us_64() - g_ctl.last_stream_us >= g_ctl.stream_interval_us) {
+        g_ctl.last_stream_us = time_us_64();
+        uint16_t len = ctl_fill_stats();
+        g_ctl.tx[0] = CTL_CMD_STATS | CTL_RESPONSE;
+        g_ctl.tx[1] = 0;
+        g_ctl.tx[2] = CTL_OK;
+        ctl_send(len);
+    }
+
+    if (g_ctl.rx_len == sizeof(g_ctl.rx)) {
+        // Too long to be a frame, so skip to the next delimiter. It may
+        // already be being skipped if it's more than a buffer's worth.
+        if (!g_ctl.discarding) {
+            g_ctl.bad_frames++;
+        }
+        g_ctl.discarding = 1;
+        g_ctl.rx_len = 0;
+    }
+
+    uint16_t scanned = g_ctl.rx_len;
+    uint32_t received = g_ctl.io->read(g_ctl.rx + g_ctl.rx_len, sizeof(g_ctl.rx) - g_ctl.rx_len);
+
+    if (!received) {
+        return;
+    }
+
+    g_ctl.rx_len += received;
+
+    uint16_t start = 0;
+    for (uint16_t i = scanned; i < g_ctl.rx_len; i++) {
+        if (FRAME_DELIMITER != g_ctl.rx[i]) {
+            continue;
+        }
+
+        if (!g_ctl.discarding && i > start) {
+            int len = frame_decode(g_ctl.rx + start, i - start);
+
+            if (len < 0) {
+                g_ctl.bad_frames++;
+            } else {
+                ctl_handle_frame(g_ctl.rx + start, len);
+            }
+        }
+
+        g_ctl.discarding = 0;
+        start = i + 1;
+    }
+
+    // Keep the start of the next frame
+    g_ctl.rx_len -= start;
+    memmove(g_ctl.rx, g_ctl.rx + start, g_ctl.rx_len);
+}
+
+uint32_t ctl_bad_frames(void)
+{
+    return g_ctl.bad_frames;
+}
@@ -0,0 +1,110 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "frame.h"
+
+uint16_t frame_crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xffff;
+
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t) data[i] << 8;
+
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+/*
+ * COBS encoder that can be fed a byte at a time. code_idx is where the
+ * length code for the current run goes once the run ends.
+ */
+struct frame_encoder {
+    uint8_t *out;
+    size_t len;
+    size_t code_idx;
+    uint8_t code;
+};
+
+static inline void frame_encoder_put(struct frame_encoder *enc, uint8_t byte)
+{
+    if (byte) {
+        enc->out[enc->len++] = byte;
+        enc->code++;
+    }
+
+    // Runs end at a zero, or once they are as long as a code can say
+    if (!byte || 0xff == enc->code) {
+        enc->out[enc->code_idx] = enc->code;
+        enc->code_idx = enc->len++;
+        enc->code = 1;
+    }
+}
+
+size_t frame_encode(const uint8_t *payload, size_t len, uint8_t *out)
+{
+    struct frame_encoder enc = {
+        .out = out,
+        .len = 1,
+        .code_idx = 0,
+        .code = 1
+    };
+    uint16_t crc = frame_crc16(payload, len);
+
+    for (size_t i = 0; i < len; i++) {
+        frame_encoder_put(&enc, payload[i]);
+    }
+
+    frame_encoder_put(&enc, crc & 0xff);
+    frame_encoder_put(&enc, crc >> 8);
+
+    out[enc.code_idx] = enc.code;
+    out[enc.len++] = FRAME_DELIMITER;
+
+    return enc.len;
+}
+
+int frame_decode(uint8_t *buf, size_t len)
+{
+    size_t in = 0;
+    size_t out = 0;
+
+    // Decoded data is never longer than the encoded data, so it can be
+    // written over it
+    while (in < len) {
+        uint8_t code = buf[in++];
+
+        if (!code || in + code - 1 > len) {
+            return -1;
+        }
+
+        for (uint8_t i = 1; i < code; i++) {
+            if (!buf[in]) {
+                return -1;
+            }
+            buf[out++] = buf[in++];
+        }
+
+        // A full length run isn't followed by a zero, and neither is the
+        // last one
+        if (0xff != code && in < len) {
+            buf[out++] = 0;
+        }
+    }
+
+    if (out < FRAME_CRC_LEN) {
+        return -1;
+    }
+
+    out -= FRAME_CRC_LEN;
+
+    uint16_t crc = buf[out] | (buf[out + 1] << 8);
+    if (crc != frame_crc16(buf, out)) {
+        return -1;
+    }
+
+    return out;
+}
@@ -0,0 +1,124 @@
+#include <stdint.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/watchdog.h"
+
+#include "health.h"
+#include "io.h"
+#include "trace.h"
+
+struct health_state {
+    struct health_stats stats;
+    struct io_heartbeat heartbeat; // As of the last check
+    uint64_t last_check_us;
+    uint64_t scan_seen_us; // Last check that saw each counter move
+    uint64_t analog_seen_us;
+    uint64_t window_start_us;
+    uint8_t window_recoveries;
+    uint8_t gave_up; // Waiting on the watchdog
+} g_health;
+
+/*
+ * Starts timing both counters from now
+ */
+static void health_rebaseline(uint64_t now)
+{
+    io_read_heartbeat(&g_health.heartbeat);
+    g_health.scan_seen_us = now;
+    g_health.analog_seen_us = now;
+}
+
+/*
+ * Restarts core1, unless it has had too many chances already
+ */
+static void health_recover(uint64_t now)
+{
+    if (now - g_health.window_start_us >= HEALTH_RECOVERY_WINDOW_US) {
+        g_health.window_start_us = now;
+        g_health.window_recoveries = 0;
+    }
+
+    if (g_health.window_recoveries >= HEALTH_MAX_RECOVERIES) {
+        g_health.gave_up = 1;
+        return;
+    }
+
+    g_health.window_recoveries++;
+    g_health.stats.recoveries++;
+    io_restart();
+    health_rebaseline(time_us_64());
+}
+
+int health_init(void)
+{
+    memset(&g_health, 0, sizeof(struct health_state));
+    g_health.stats.watchdog_reboot = watchdog_caused_reboot();
+    g_health.last_check_us = time_us_64();
+    health_rebaseline(g_health.last_check_us);
+
+    watchdog_enable(HEALTH_WATCHDOG_MS, true);
+
+    return 0;
+}
+
+void health_task(void)
+{
+    uint64_t now = time_us_64();
+    uint64_t elapsed = now - g_health.last_check_us;
+
+    if (elapsed < HEALTH_CHECK_INTERVAL_US) {
+        return;
+    }
+
+    g_health.last_check_us = now;
+    g_health.stats.checks++;
+
+    if (g_health.gave_up) {
+        return;
+    }
+
+    watchdog_update();
+
+    // core1 is paused for flash writes, which also hold up the main loop,
+    // so a long gap says nothing about core1
+    if (elapsed >= 2 * HEALTH_CHECK_INTERVAL_US) {
+        g_health.stats.late_checks++;
+        health_rebaseline(now);
+        return;
+    }
+
+    struct io_heartbeat heartbeat;
+    io_read_heartbeat(&heartbeat);
+
+    if (heartbeat.scans != g_health.heartbeat.scans) {
+        g_health.scan_seen_us = now;
+    }
+
+    if (heartbeat.analog != g_health.heartbeat.analog) {
+        g_health.analog_seen_us = now;
+    }
+
+    g_health.heartbeat = heartbeat;
+
+    uint16_t stalled = 0;
+
+    if (now - g_health.scan_seen_us >= HEALTH_STALL_US) {
+        g_health.stats.scan_stalls++;
+        stalled |= 1;
+    }
+
+    if (now - g_health.analog_seen_us >= HEALTH_STALL_US) {
+        g_health.stats.analog_stalls++;
+        stalled |= 2;
+    }
+
+    if (stalled) {
+        trace_event(TRACE_CORE1_STALL, stalled, g_health.stats.recoveries);
+        health_recover(now);
+    }
+}
+
+void health_get_stats(struct health_stats *stats)
+{
+    memcpy(stats, &g_health.stats, sizeof(struct health_stats));
+}
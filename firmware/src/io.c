@@ -6,19 +6,33 @@
 #include "pico/util/queue.h"
 #include "hardware/gpio.h"
 #include "hardware/adc.h"
+#include "hardware/sync.h"
+#include "hardware/structs/sio.h"
 
 #include "hardware_config.h"
 #include "io.h"
+#include "trace.h"
+#include "clock.h"
+#include "lfo.h"
+#include "midi_uart.h"
+#include "hot.h"
+#include "boot.h"
 
 
 // Determines how frequently the entire key matrix is
-// scanned. One col is scanned per poll, so this number
-// is divided by KEYBOARD_COLS to determine how frequently
-// the poll function runs
-#define KEY_POLL_INTERVAL_US 2000
+// scanned while keys are being played. One col is scanned
+// per poll, so this number is divided by KEYBOARD_COLS to
+// determine how frequently the poll function runs
+#define KEY_POLL_INTERVAL_US 1000
+
+// How often the matrix is probed for any key at all while idle
+#define KEY_PROBE_INTERVAL_US 500
 
 #define NUM_ANALOG_SAMPLES 16
 
+// Max number of timers and alarms in use on core1 at once
+#define IO_MAX_TIMERS 5
+
 const uint8_t key_row_pins[MATRIX_ROWS] = {
     MATRIX_R1_PIN, MATRIX_R2_PIN, MATRIX_R3_PIN,
     MATRIX_R4_PIN, MATRIX_R5_PIN, MATRIX_R6_PIN
@@ -32,6 +46,18 @@ const uint8_t key_row_pins[MATRIX_ROWS] = {
 #define AN_DEFAULT_THRESHOLD 30
 #define AN_READ_SAMPLES 30
 
+// Fewer samples for the CV inputs, which are read far more often
+#define CV_READ_SAMPLES 8
+
+// Semitones per ADC count in 16.16 fixed point, at 1V/oct. 65536 / 4096
+// counts is 16.
+#define CV_SEMITONE_Q16_PER_COUNT ((CV_IN_RANGE_MV * 12 * 16) / 1000)
+#define CV_SEMITONE_Q16 (1 << 16)
+
+// How far past the middle of two semitones the input has to go before it
+// moves to the next one, so a CV sitting on the boundary doesn't flap
+#define CV_HYSTERESIS_Q16 (CV_SEMITONE_Q16 / 8)
+
 const uint16_t g_analog_config[NUM_ANALOG_INPUTS][AN_NUM_CONFIGS] = {
     {IO_CLK_SPEED_CHANGED, MASK_CLK_SPEED, AN_DEFAULT_THRESHOLD},
     {IO_PORTAMENTO_CHANGED, MASK_PORTAMENTO, AN_DEFAULT_THRESHOLD},
@@ -40,21 +66,61 @@ const uint16_t g_analog_config[NUM_ANALOG_INPUTS][AN_NUM_CONFIGS] = {
     {IO_SUB_MODE_CHANGED, MASK_SUB_MODE, AN_DEFAULT_THRESHOLD},
 };
 
+enum cv_input {
+    CV_TRANSPOSE = 0 // 1V/oct
+};
+
+const uint16_t g_cv_masks[NUM_CV_INPUTS] = {
+    [CV_TRANSPOSE] = MASK_CV1,
+};
+
+#define IO_MATRIX_ENTRY(key, row, col, ...) [row][col] = key,
+#define IO_POSITION_ENTRY(key, row, col, ...) [key] = {row, col},
+
+// Spots with nothing in them are left as KEY_NONE
 const uint8_t key_matrix[MATRIX_ROWS][MATRIX_COLS] = {
-    {KEY_OCTAVE_UP, KEY_CS1, KEY_G1, KEY_CS2, KEY_G2, KEY_CS3, KEY_G3, KEY_CS4, KEY_G4, KEY_REST},
-    {KEY_OCTAVE_DOWN, KEY_D1, KEY_GS1, KEY_D2, KEY_GS2, KEY_D3, KEY_GS3, KEY_D4, KEY_GS4, KEY_HOLD},
-    {KEY_PLAY_PAUSE, KEY_DS1, KEY_A1, KEY_DS2, KEY_A2, KEY_DS3, KEY_A3, KEY_DS4, KEY_A4, KEY_FUNC},
-    {KEY_RECORD, KEY_E1, KEY_AS1, KEY_E2, KEY_AS2, KEY_E3, KEY_AS3, KEY_E4, KEY_AS4, KEY_MODE},
-    {KEY_STOP, KEY_F1, KEY_B1, KEY_F2, KEY_B2, KEY_F3, KEY_B3, KEY_F4, KEY_B4, KEY_NONE},
-    {KEY_C1, KEY_FS1, KEY_C2, KEY_FS2, KEY_C3, KEY_FS3, KEY_C4, KEY_FS4, KEY_C5, KEY_NONE},
+    KEYMAP(IO_MATRIX_ENTRY)
+};
+
+const struct io_key_position key_positions[NUM_KEYS] = {
+    KEYMAP(IO_POSITION_ENTRY)
 };
 
 struct io_state {
-    uint8_t key_state[NUM_MATRIX_KEYS];
+    // One bit per column for each row. frame_rows is filled in as the
+    // columns are scanned, and reported_rows is the state that core0 has
+    // been told about.
+    uint16_t frame_rows[MATRIX_ROWS];
+    uint16_t reported_rows[MATRIX_ROWS];
+    uint32_t ghost_frames; // Frames where keys had to be held back
+    uint32_t row_mask; // All of the row pins
+    uint8_t scan_idle;
+    uint32_t last_active_us; // Last frame with a key down
+    uint32_t wake_us; // When the probe last saw a key, 0 once handled
+    struct io_scan_stats scan_stats;
     queue_t event_queue;
+    queue_t frame_queue;
+    struct io_key_frame pending_frame;
+    uint8_t frame_pending;
+    // Key state as of the last frame that made it on to the queue, for
+    // core0 to check itself against. Guarded by snapshot_seq, which is odd
+    // while core1 is part way through updating it.
+    volatile uint32_t snapshot_seq;
+    struct io_key_snapshot snapshot;
     uint8_t current_col;
+    alarm_pool_t *alarm_pool;
     repeating_timer_t poll_timer;
     uint16_t analog_values[NUM_ANALOG_INPUTS]; // Indices should match g_analog_config
+    uint8_t next_pot;
+    uint8_t pots_primed;
+    uint32_t last_pot_us;
+    uint32_t last_cv_us;
+    int16_t cv_semitone;
+    uint32_t last_poll_us;
+    uint8_t started; // io_main() has run before
+    // See struct io_heartbeat. Only written by core1.
+    volatile uint32_t scan_heartbeat;
+    volatile uint32_t analog_heartbeat;
 } g_io_state;
 
 static inline uint16_t io_analog_read(uint32_t mask, uint16_t num_samples)
@@ -76,6 +142,22 @@ static inline uint16_t io_analog_read(uint32_t mask, uint16_t num_samples)
     return temp / num_samples;
 }
 
+/*
+ * Converts a 1V/oct CV reading to the nearest semitone, sticking with the
+ * current one until the input is clearly past the halfway point
+ */
+static inline int16_t io_cv_to_semitone(uint16_t counts, int16_t current)
+{
+    int32_t value = (int32_t) counts * CV_SEMITONE_Q16_PER_COUNT;
+    int32_t delta = value - (int32_t) current * CV_SEMITONE_Q16;
+
+    if (abs(delta) <= CV_SEMITONE_Q16 / 2 + CV_HYSTERESIS_Q16) {
+        return current;
+    }
+
+    return (value + CV_SEMITONE_Q16 / 2) >> 16;
+}
+
 static inline void io_clock_shift_reg(int clk_pin)
 {
     sleep_us(1); // TODO figure out a better way to make sure timing is correct.
@@ -90,6 +172,39 @@ int io_event_queue_ready(void)
     return !queue_is_empty(&g_io_state.event_queue);
 }
 
+int io_frame_queue_ready(void)
+{
+    return !queue_is_empty(&g_io_state.frame_queue);
+}
+
+void io_frame_queue_pop_blocking(struct io_key_frame *frame)
+{
+    queue_remove_blocking(&g_io_state.frame_queue, frame);
+}
+
+void io_read_key_snapshot(struct io_key_snapshot *snapshot)
+{
+    uint32_t seq;
+
+    do {
+        seq = g_io_state.snapshot_seq;
+        __dmb();
+        memcpy(snapshot, &g_io_state.snapshot, sizeof(struct io_key_snapshot));
+        __dmb();
+    } while ((seq & 1) || seq != g_io_state.snapshot_seq);
+}
+
+void io_get_scan_stats(struct io_scan_stats *stats)
+{
+    memcpy(stats, &g_io_state.scan_stats, sizeof(struct io_scan_stats));
+}
+
+void io_read_heartbeat(struct io_heartbeat *heartbeat)
+{
+    heartbeat->scans = g_io_state.scan_heartbeat;
+    heartbeat->analog = g_io_state.analog_heartbeat;
+}
+
 io_event_t io_event_queue_pop_blocking(void)
 {
     io_event_t temp;
@@ -123,7 +238,14 @@ int io_init(void)
 
     memset(&g_io_state, 0, sizeof(struct io_state));
 
+    for (uint8_t i = 0; i < MATRIX_ROWS; i++) {
+        g_io_state.row_mask |= 1u << key_row_pins[i];
+    }
+
+    g_io_state.scan_stats.min_poll_period_us = UINT32_MAX;
+
     queue_init(&g_io_state.event_queue, sizeof(io_event_t), IO_EVENT_QUEUE_SIZE);
+    queue_init(&g_io_state.frame_queue, sizeof(struct io_key_frame), IO_FRAME_QUEUE_SIZE);
 
     adc_init();
     adc_gpio_init(ANALOG_IN_PIN);
@@ -146,20 +268,265 @@ int io_init(void)
     gpio_set_dir(SYNC_IN_PIN, GPIO_IN);
     gpio_disable_pulls(SYNC_IN_PIN);
 
-    gpio_init(SYNC_OUT_PIN);
-    gpio_set_dir(SYNC_OUT_PIN, GPIO_OUT);
-    gpio_pull_down(SYNC_OUT_PIN);
+    // SYNC_OUT is driven by PIO, see sync_out.h
 
     return 0;
 }
 
 /*
- * Repeating timer function which checks a single column of the matrix for
- * state changes, pushes any changes to the io event queue, and then
- * increments the column counter.
+ * Without a diode per key, holding three corners of a row/column
+ * rectangle makes the fourth read as pressed too. Any pair of rows that
+ * share two or more columns might contain a ghost, and there's no way to
+ * tell which of the keys in those columns it is, so all of them are
+ * flagged as ambiguous. Returns the number of row pairs involved.
+ */
+static inline uint8_t io_find_ghosts(const uint16_t *rows, uint16_t *ambiguous)
+{
+    uint8_t pairs = 0;
+
+    for (uint8_t r1 = 0; r1 < MATRIX_ROWS - 1; r1++) {
+        if (!rows[r1]) {
+            continue;
+        }
+
+        for (uint8_t r2 = r1 + 1; r2 < MATRIX_ROWS; r2++) {
+            uint16_t shared = rows[r1] & rows[r2];
+
+            // More than one bit set
+            if (shared & (shared - 1)) {
+                ambiguous[r1] |= shared;
+                ambiguous[r2] |= shared;
+                pairs++;
+            }
+        }
+    }
+
+    return pairs;
+}
+
+static inline uint64_t io_reported_keys(void)
+{
+    uint64_t keys = 0;
+
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        for (uint16_t cols = g_io_state.reported_rows[row]; cols; cols &= cols - 1) {
+            keys |= IO_KEY_BIT(key_matrix[row][__builtin_ctz(cols)]);
+        }
+    }
+
+    // The empty spots in the matrix
+    return keys & ~IO_KEY_BIT(KEY_NONE);
+}
+
+/*
+ * Seqlock write side. Only ever called on core1.
+ */
+static void HOT_FUNC(io_publish_snapshot)(void)
+{
+    g_io_state.snapshot_seq++;
+    __dmb();
+
+    g_io_state.snapshot.keys = io_reported_keys();
+    g_io_state.snapshot.frames_posted++;
+
+    __dmb();
+    g_io_state.snapshot_seq++;
+}
+
+/*
+ * Queues the changes from a frame. If the queue is full they are merged
+ * in to a pending frame that is retried at the end of the next one, so
+ * core0 can fall behind but never ends up with a press and no release.
+ */
+static void HOT_FUNC(io_push_frame)(const struct io_key_frame *frame)
+{
+    struct io_key_frame *pending = &g_io_state.pending_frame;
+
+    if (g_io_state.frame_pending) {
+        // A key that changed back again before core0 saw the first change
+        // cancels out
+        uint64_t pressed = (pending->pressed & ~frame->released) | (frame->pressed & ~pending->released);
+        uint64_t released = (pending->released & ~frame->pressed) | (frame->released & ~pending->pressed);
+
+        pending->pressed = pressed;
+        pending->released = released;
+        pending->timestamp = frame->timestamp;
+    } else {
+        memcpy(pending, frame, sizeof(struct io_key_frame));
+    }
+
+    if (queue_try_add(&g_io_state.frame_queue, pending)) {
+        g_io_state.frame_pending = 0;
+        io_publish_snapshot();
+    } else {
+        g_io_state.frame_pending = 1;
+        g_io_state.scan_stats.frame_queue_full++;
+    }
+}
+
+/*
+ * Called once every column has been scanned. Pushes a single frame
+ * holding every key that has changed since the last one. Ambiguous keys keep their
+ * last reported state until the frame resolves.
  */
-bool io_poll_keys(repeating_timer_t *timer)
+static uint8_t HOT_FUNC(io_end_frame)(void)
 {
+    uint16_t ambiguous[MATRIX_ROWS] = {0};
+    uint16_t any_down = 0;
+    struct io_key_frame frame = {0};
+    uint8_t ghost_pairs = io_find_ghosts(g_io_state.frame_rows, ambiguous);
+
+    if (ghost_pairs) {
+        g_io_state.ghost_frames++;
+        trace_event(TRACE_MATRIX_GHOST, ghost_pairs, g_io_state.ghost_frames);
+    }
+
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        uint16_t reported = g_io_state.reported_rows[row];
+        uint16_t resolved = (g_io_state.frame_rows[row] & ~ambiguous[row]) | (reported & ambiguous[row]);
+        uint16_t changed = resolved ^ reported;
+
+        while (changed) {
+            uint8_t col = __builtin_ctz(changed);
+            uint8_t key = key_matrix[row][col];
+            changed &= changed - 1;
+
+            if (KEY_NONE == key) {
+                continue;
+            }
+
+            // TODO debouncing: http://www.ganssle.com/debouncing-pt2.htm
+            // https://my.eng.utah.edu/~cs5780/debouncing.pdf
+            // I'm working with conductive elastomer switches on the keybed. I have not seen bouncing
+            // on the keybed keys, but I think it's possible, and will almost certainly happen
+            // with the buttons I plan to use for other functions
+            if ((resolved >> col) & 1) {
+                frame.pressed |= IO_KEY_BIT(key);
+            } else {
+                frame.released |= IO_KEY_BIT(key);
+            }
+        }
+
+        any_down |= g_io_state.frame_rows[row] | resolved;
+        g_io_state.reported_rows[row] = resolved;
+        g_io_state.frame_rows[row] = 0;
+    }
+
+    g_io_state.scan_stats.frames++;
+    boot_mark(BOOT_MARK_FIRST_SCAN);
+
+    uint8_t events = frame.pressed || frame.released;
+    if (events || g_io_state.frame_pending) {
+        frame.timestamp = time_us_32();
+        io_push_frame(&frame);
+    }
+
+    if (g_io_state.wake_us && events) {
+        uint32_t latency = time_us_32() - g_io_state.wake_us;
+
+        g_io_state.scan_stats.last_wake_latency_us = latency;
+        if (latency > g_io_state.scan_stats.max_wake_latency_us) {
+            g_io_state.scan_stats.max_wake_latency_us = latency;
+        }
+
+        trace_event(TRACE_SCAN_WAKE, 0, latency);
+    }
+    g_io_state.wake_us = 0;
+
+    return any_down ? 1 : 0;
+}
+
+/*
+ * Clocks the same level in to every shift register output, which drives
+ * all of the columns at once
+ */
+static void HOT_FUNC(io_drive_all_cols)(uint8_t level)
+{
+    gpio_put(SHIFT_REG_DATA_PIN, level);
+    for (uint8_t i = 0; i < SHIFT_REG_OUTPUTS; i++) {
+        io_clock_shift_reg(SHIFT_REG_CLK_PIN);
+    }
+}
+
+/*
+ * Drops to probing once nothing has been held for IO_SCAN_IDLE_TIMEOUT_US.
+ * All columns are left active so that a probe is a single read of the
+ * row pins.
+ */
+static void HOT_FUNC(io_update_scan_rate)(repeating_timer_t *timer, uint8_t any_down)
+{
+    uint32_t now = time_us_32();
+
+    if (any_down) {
+        g_io_state.last_active_us = now;
+        return;
+    }
+
+    if (now - g_io_state.last_active_us < IO_SCAN_IDLE_TIMEOUT_US) {
+        return;
+    }
+
+    io_drive_all_cols(0);
+    g_io_state.scan_idle = 1;
+    g_io_state.scan_stats.idle_entries++;
+    timer->delay_us = KEY_PROBE_INTERVAL_US;
+}
+
+/*
+ * Idle probe. Any row pulled low means some key is down, in which case
+ * the full scan starts straight away.
+ */
+static bool HOT_FUNC(io_probe_keys)(repeating_timer_t *timer)
+{
+    g_io_state.scan_stats.probes++;
+
+    if ((gpio_get_all() & g_io_state.row_mask) == g_io_state.row_mask) {
+        return true;
+    }
+
+    io_drive_all_cols(1);
+    g_io_state.scan_idle = 0;
+    g_io_state.current_col = 0;
+    g_io_state.wake_us = time_us_32() | 1; // Never 0
+    g_io_state.last_active_us = g_io_state.wake_us;
+    g_io_state.scan_stats.wakes++;
+    timer->delay_us = KEY_POLL_INTERVAL_US / MATRIX_COLS;
+
+    return true;
+}
+
+/*
+ * Repeating timer function which reads a single column of the matrix in
+ * to the current frame and then increments the column counter. Changes
+ * are pushed to the io event queue at the end of each frame. While idle
+ * it probes the whole matrix at once instead.
+ */
+bool HOT_FUNC(io_poll_keys)(repeating_timer_t *timer)
+{
+    uint32_t now = time_us_32();
+    uint32_t period = now - g_io_state.last_poll_us;
+    struct io_scan_stats *stats = &g_io_state.scan_stats;
+
+    // delay_us is still the delay that led up to this call
+    if (g_io_state.scan_heartbeat) {
+        if (period < stats->min_poll_period_us) {
+            stats->min_poll_period_us = period;
+        }
+        if (period > stats->max_poll_period_us) {
+            stats->max_poll_period_us = period;
+        }
+        if (period > 2 * (uint32_t) timer->delay_us) {
+            stats->late_polls++;
+        }
+    }
+
+    g_io_state.last_poll_us = now;
+    g_io_state.scan_heartbeat++;
+
+    if (g_io_state.scan_idle) {
+        return io_probe_keys(timer);
+    }
+
     if (0 == g_io_state.current_col) {
         gpio_put(SHIFT_REG_DATA_PIN, 0);
     } else if (g_io_state.current_col >= MATRIX_COLS) {
@@ -167,8 +534,11 @@ bool io_poll_keys(repeating_timer_t *timer)
             io_clock_shift_reg(SHIFT_REG_CLK_PIN);
         }
 
+        uint8_t any_down = io_end_frame();
         g_io_state.current_col = 0;
 
+        io_update_scan_rate(timer, any_down);
+
         return true;
     } else {
         gpio_put(SHIFT_REG_DATA_PIN, 1);
@@ -179,27 +549,8 @@ bool io_poll_keys(repeating_timer_t *timer)
     const uint8_t col = g_io_state.current_col;
 
     for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
-        uint8_t is_pressed = !gpio_get(key_row_pins[row]);
-        uint8_t key = key_matrix[row][col];
-        uint8_t was_pressed = g_io_state.key_state[key];
-        io_event_t io_event;
-
-        // TODO debouncing: http://www.ganssle.com/debouncing-pt2.htm
-        // https://my.eng.utah.edu/~cs5780/debouncing.pdf
-        // I'm working with conductive elastomer switches on the keybed. I have not seen bouncing
-        // on the keybed keys, but I think it's possible, and will almost certainly happen
-        // with the buttons I plan to use for other functions
-        if (is_pressed && !was_pressed) {
-            // TODO without these prints the loop happens too quickly
-            io_event = io_event_create(IO_KEY_PRESSED, key);
-            g_io_state.key_state[key] = 1;
-
-            queue_try_add(&g_io_state.event_queue, &io_event);
-        } else if (!is_pressed && was_pressed) {
-            io_event = io_event_create(IO_KEY_RELEASED, key);
-            g_io_state.key_state[key] = 0;
-
-            queue_try_add(&g_io_state.event_queue, &io_event);
+        if (!gpio_get(key_row_pins[row])) {
+            g_io_state.frame_rows[row] |= 1 << col;
         }
     }
 
@@ -208,58 +559,157 @@ bool io_poll_keys(repeating_timer_t *timer)
     return true;
 }
 
+/*
+ * GPIO interrupt handler for core1. Rising edges on SYNC_IN are pulses
+ * from an external clock.
+ */
+static void HOT_FUNC(io_gpio_irq)(uint gpio, uint32_t events)
+{
+    if (SYNC_IN_PIN == gpio && (events & GPIO_IRQ_EDGE_RISE)) {
+        trace_event(TRACE_SYNC_IN, 1, 0);
+        clock_ext_pulse(CLOCK_SRC_SYNC_IN);
+    }
+}
+
+/*
+ * Reads the next pot and queues an event if it has moved. The first pass
+ * only records where they are, so that the saved settings stand until a
+ * pot is actually turned.
+ */
+static void io_poll_pot(void)
+{
+    uint8_t i = g_io_state.next_pot;
+    uint16_t current = g_io_state.analog_values[i];
+    uint16_t reading = io_analog_read(g_analog_config[i][AN_MASK_IDX], AN_READ_SAMPLES);
+
+    // TODO: There seems to be a dead spot right around 1330-1770 (it moves a little) on all of the pots....
+    if (!g_io_state.pots_primed) {
+        g_io_state.analog_values[i] = reading;
+    } else if (abs(reading - current) > g_analog_config[i][AN_THRESHOLD_IDX]) {
+        io_event_t event = io_event_create(g_analog_config[i][AN_EVENT_IDX], reading);
+
+        // If the queue is full the change is picked up on a later pass
+        if (queue_try_add(&g_io_state.event_queue, &event)) {
+            g_io_state.analog_values[i] = reading;
+        }
+    }
+
+    if (++g_io_state.next_pot >= NUM_ANALOG_INPUTS) {
+        g_io_state.next_pot = 0;
+        g_io_state.pots_primed = 1;
+    }
+}
+
+/*
+ * Reads the external transpose CV. It is quantised to semitones here, so
+ * core0 only hears about it when the note changes.
+ */
+static void io_poll_cv(void)
+{
+    g_io_state.analog_heartbeat++;
+
+    uint16_t reading = io_analog_read(g_cv_masks[CV_TRANSPOSE], CV_READ_SAMPLES);
+    int16_t semitone = io_cv_to_semitone(reading, g_io_state.cv_semitone);
+
+    if (semitone != g_io_state.cv_semitone) {
+        io_event_t event = io_event_create(IO_CV_TRANSPOSE_CHANGED, (uint16_t) semitone);
+
+        if (queue_try_add(&g_io_state.event_queue, &event)) {
+            g_io_state.cv_semitone = semitone;
+        }
+    }
+}
+
 void io_main(void)
 {
-    add_repeating_timer_us(
+    boot_mark(BOOT_MARK_CORE1);
+
+    // Lets core0 park us while it writes to flash
+    multicore_lockout_victim_init();
+
+    // Timers added from here on fire on core1 rather than on core0, which
+    // is where the default alarm pool lives
+    g_io_state.alarm_pool = alarm_pool_create_with_unused_hardware_alarm(IO_MAX_TIMERS);
+
+    alarm_pool_add_repeating_timer_us(
+        g_io_state.alarm_pool,
         KEY_POLL_INTERVAL_US / MATRIX_COLS,
         io_poll_keys,
         0,
         &g_io_state.poll_timer
     );
 
+    // The UART and its clock listener are only set up once
+    if (g_io_state.started) {
+        midi_uart_resume();
+    } else {
+        midi_uart_init();
+    }
+
+    g_io_state.started = 1;
+    clock_run(g_io_state.alarm_pool);
+    lfo_run(g_io_state.alarm_pool);
+
+    gpio_set_irq_enabled_with_callback(SYNC_IN_PIN, GPIO_IRQ_EDGE_RISE, true, io_gpio_irq);
+
     uint8_t sync_cn = 0;
-    uint8_t sync = 0;
     uint8_t new_sync_cn = 0;
-    uint8_t new_sync = 0;
     while (true) {
-        new_sync = gpio_get(SYNC_IN_PIN);
         new_sync_cn = gpio_get(SYNC_CN_PIN);
 
         if (new_sync_cn != sync_cn) {
-            printf("Sync CN: %d\n", new_sync_cn);
+            trace_event(TRACE_SYNC_CN, new_sync_cn, 0);
             sync_cn = new_sync_cn;
         }
 
-        if (sync_cn) {
-            if (new_sync != sync) {
-                printf("Sync: %d\n", new_sync);
-                sync = new_sync;
-            }
+        clock_update_source(sync_cn);
+
+        uint32_t now = time_us_32();
+
+        if (now - g_io_state.last_cv_us >= IO_CV_INTERVAL_US) {
+            g_io_state.last_cv_us = now;
+            io_poll_cv();
         }
 
+        if (now - g_io_state.last_pot_us >= IO_POT_INTERVAL_US) {
+            g_io_state.last_pot_us = now;
+            io_poll_pot();
+        }
     }
+}
 
-    // uint16_t current_value = 0;
-    // uint16_t read_result = 0;
-    // uint16_t delta = 0;
-    // uint16_t threshold = 0;
-    // while (true) {
-    //     // TODO: There seems to be a dead spot right around 1330-1770 (it moves a little) on all of the pots....
-    //     // TODO: Param 0 seems to be affected by the other inputs occasionally...
-    //     for (uint8_t i = 0; i < NUM_ANALOG_INPUTS; i++) {
-    //         current_value = g_io_state.analog_values[i];
-    //         read_result = io_analog_read(g_analog_config[i][AN_MASK_IDX], AN_READ_SAMPLES);
+void io_restart(void)
+{
+    multicore_reset_core1();
+
+    // core1 could have been stopped holding any of the spin locks, eg the
+    // ones guarding the queues or its alarm pool. With interrupts off
+    // nothing on core0 holds one, so whatever is still locked was core1's.
+    uint32_t irq_state = save_and_disable_interrupts();
+    for (uint32_t locked = sio_hw->spinlock_st; locked; locked &= locked - 1) {
+        spin_unlock_unsafe(spin_lock_instance(__builtin_ctz(locked)));
+    }
+    restore_interrupts(irq_state);
 
-    //         threshold = g_analog_config[i][AN_THRESHOLD_IDX];
+    // Its IRQ went with core1, and io_main() makes a new one
+    alarm_pool_destroy(g_io_state.alarm_pool);
+    g_io_state.alarm_pool = NULL;
 
-    //         delta = abs(current_value - read_result);
-    //         if (delta > threshold) {
-    //             g_io_state.analog_values[i] = read_result;
-    //             printf("Param %d changed to %d. Delta: %d\n", i, read_result, delta);
-    //         }
-    //     }
-    // }
+    // Don't leave core0 waiting on a half written snapshot
+    if (g_io_state.snapshot_seq & 1) {
+        g_io_state.snapshot_seq++;
+    }
 
+    clock_recover();
 
+    // Start the matrix over. Keys that were already reported stay down
+    // until a scan says otherwise.
+    memset(g_io_state.frame_rows, 0, sizeof(g_io_state.frame_rows));
+    g_io_state.current_col = 0;
+    g_io_state.scan_idle = 0;
+    g_io_state.last_active_us = time_us_32();
+    g_io_state.wake_us = 0;
+    io_drive_all_cols(1);
 
+    multicore_launch_core1(io_main);
 }
@@ -12,20 +12,72 @@
 #include "mcp4921.h"
 #include "io.h"
 #include "lkp_stack.h"
+#include "trace.h"
+#include "usb.h"
+#include "usb_midi.h"
+#include "clock.h"
+#include "voice.h"
+#include "sched.h"
+#include "settings.h"
+#include "scale.h"
+#include "tuning.h"
+#include "console.h"
+#include "ctl.h"
+#include "usb_ctl.h"
+#include "latch.h"
+#include "led.h"
+#include "sync_out.h"
+#include "looper.h"
+#include "boot.h"
+#include "health.h"
+#include "lfo.h"
 
 #define OCTAVE_SHIFT_MAX 1
 #define OCTAVE_SHIFT_MIN -1
 
-float cv_octave[12] = {
-    0.0833, 0.1667, 0.2550, 0.3333, 0.4167,
-    0.5000, 0.5833, 0.6667, 0.7500, 0.8333,
-    0.9167, 1.000
+#define ANALOG_MAX_VAL 4095
+
+// Cycled through by the SYNC_OUT PPQN key on the FUNC layer
+static const uint8_t g_sync_out_ppqns[] = {1, 2, 4, 24, 48, SYNC_OUT_PPQN_STEPS};
+
+// Step divisions on the clock division knob, in steps per quarter note
+static const uint8_t g_step_divisions[] = {1, 2, 3, 4, 6, 8};
+
+// What's left to bring up once the keyboard is playable, in order
+enum boot_stage {
+    BOOT_STAGE_SETTINGS = 0,
+    BOOT_STAGE_USB = 1,
+    BOOT_STAGE_DONE = 2
 };
 
+// How often the held keys are checked against core1's view of the matrix
+#define KEY_RECONCILE_INTERVAL_US (100 * 1000)
+
 struct keyboard_state {
     struct lkp_stack key_press_stack;
     int8_t octave_shift;
+    uint8_t transport_rewound;
+    uint8_t func_held;
+    uint16_t gate_time;
+    // From the external CV input. Not saved.
+    int16_t cv_transpose;
     struct mcp4921 dac;
+    struct voice_state voices;
+    struct scale_config scale_config;
+    struct scale_table scale_table;
+    uint8_t tuning_slot;
+    struct tuning tuning;
+    // Keybed keys that were pressed while FUNC was held. Their releases
+    // are swallowed too.
+    uint64_t func_layer_keys;
+    // Every key that is down according to the frames handled so far
+    uint64_t keys_down;
+    uint32_t frames_consumed;
+    uint64_t last_reconcile_us;
+    uint32_t key_repairs; // Keys that had to be fixed up by reconcile_keys()
+    struct latch latch;
+    uint8_t boot_stage;
+    uint8_t boot_reported;
 } g_state;
 
 static int init_cv_dac(struct mcp4921 *dac)
@@ -40,7 +92,8 @@ static int init_cv_dac(struct mcp4921 *dac)
 
     dac->refv = DAC_REFV; // This is the reference voltage that is set by out TL431.
     dac->clock_speed = DAC_CLK_SPEED; // SPI Clock speed
-    mcp4921_set_dac(dac, MCP4921_DAC_A); // Our DAC has two channels. We're only going to use channel A
+    dac->hw_cs = 1; // Lets both channels be written in a single transfer
+    mcp4921_set_dac(dac, MCP4921_DAC_A); // Our DAC has two channels. Channel A is the first voice
     mcp4921_set_buff(dac, MCP4921_VREF_BUFFERED);
     mcp4921_set_gain(dac, MCP4921_GAIN_1X);
     mcp4921_set_shdn(dac, MCP4921_SHDN_ON);
@@ -49,23 +102,51 @@ static int init_cv_dac(struct mcp4921 *dac)
 }
 
 /*
- * Brings the gate signal high if gate_state
- * is 1, or low if gate_state is 0.
+ * Recompiles the key to DAC code table after anything that affects it
+ * changes
  */
-static inline void set_gate(uint8_t gate_state)
+static void update_scale_table(void)
 {
-    gpio_put(GATE_OUT_PIN, gate_state);
+    struct scale_config config;
+
+    g_state.scale_config.octave_shift = g_state.octave_shift;
+
+    // The CV transpose goes on top of the saved one
+    config = g_state.scale_config;
+    config.transpose += g_state.cv_transpose;
+
+    scale_build_table(&config, &g_state.tuning, &g_state.dac, &g_state.scale_table);
 }
 
 /*
- * Deterines what the CV value should be for the given key
+ * Switches to the tuning in the given slot. An empty slot plays 12-TET
+ * until something is uploaded to it.
  */
-static inline float key_to_cv(struct keyboard_state *state, enum key_id id)
+static void select_tuning(uint8_t slot)
 {
-    float key_octave = floor(id / 12);
-    uint8_t note = (id % 12) - 1;
+    g_state.tuning_slot = slot;
+    tuning_load(slot, &g_state.tuning);
+    update_scale_table();
+}
+
+/*
+ * A tuning was uploaded or selected over the console or the control
+ * protocol
+ */
+static void tuning_changed(uint8_t slot, uint8_t select)
+{
+    // The looper plays through the scale table
+    sched_lock();
+
+    if (select) {
+        select_tuning(slot);
+        settings_changed();
+    } else if (slot == g_state.tuning_slot) {
+        // Pick up the new version
+        select_tuning(slot);
+    }
 
-    return key_octave + state->octave_shift + cv_octave[note];
+    sched_unlock();
 }
 
 static inline void octave_shift(uint8_t direction)
@@ -79,124 +160,613 @@ static inline void octave_shift(uint8_t direction)
             g_state.octave_shift--;
         }
     }
+
+    led_set_octave_shift(g_state.octave_shift);
+    update_scale_table();
+    looper_record_octave(g_state.octave_shift, time_us_32());
+    settings_changed();
 }
 
 /*
- * Set gate up and use the last key that is still pressed to
- * set the CV output.
+ * Returns the DAC code that produces the CV for the given key
  */
-static inline void play_last_note(struct keyboard_state *state)
+static uint16_t key_to_code(uint32_t key_id)
 {
-    uint32_t current_note = lkp_get_last_key(&state->key_press_stack);
+    return scale_lookup(&g_state.scale_table, key_id);
+}
+
+/*
+ * Maps a clock speed knob reading on to the supported tempo range
+ */
+static inline uint16_t analog_to_bpm(uint16_t value)
+{
+    return CLOCK_MIN_BPM + ((uint32_t) value * (CLOCK_MAX_BPM - CLOCK_MIN_BPM)) / ANALOG_MAX_VAL;
+}
 
-    if (!current_note) {
-        // No keys currently pressed
+/*
+ * Ends a keybed note. The voices still need updating afterwards.
+ */
+static void stop_key(uint32_t key_id)
+{
+    usb_midi_key_event(IO_KEY_RELEASED, key_id, g_state.octave_shift);
+    lkp_pop_key(&g_state.key_press_stack, key_id);
+}
+
+/*
+ * Ends the notes that the latch has let go of
+ */
+static void release_latched(uint64_t keys)
+{
+    if (!keys) {
         return;
     }
 
-    set_gate(1);
-    float cv = key_to_cv(state, current_note);
-    mcp4921_set_output(&state->dac, cv / CV_OPAMP_GAIN);
+    for (uint64_t drop = keys; drop; drop &= drop - 1) {
+        stop_key(__builtin_ctzll(drop));
+    }
+
+    voice_key_frame(&g_state.voices, &g_state.key_press_stack, 0, keys);
+    looper_record_keys(0, keys, time_us_32());
 }
 
-void handle_keybed_event(uint8_t event_type, uint32_t key_id)
+/*
+ * Puts stored settings in to effect. Runs once with the defaults at
+ * power on and again once the stored ones have been read, by which time
+ * keys might already be held.
+ */
+static void apply_settings(const struct settings *settings)
 {
-    if (IO_KEY_PRESSED == event_type) {
+    g_state.octave_shift = settings->octave_shift;
+    g_state.gate_time = settings->gate_time;
+    g_state.scale_config.scale = settings->scale;
+    g_state.scale_config.root = settings->scale_root;
+    g_state.scale_config.transpose = settings->transpose;
+    select_tuning(settings->tuning);
+
+    if (settings->voice_mode != g_state.voices.mode) {
+        voice_set_mode(&g_state.voices, settings->voice_mode);
+    }
+
+    // Channel B is free for the LFO unless voice 1 is using it
+    lfo_set_enabled(VOICE_MODE_MONO == g_state.voices.mode);
+
+    if (settings->latch_mode != g_state.latch.mode) {
+        release_latched(latch_set_mode(&g_state.latch, settings->latch_mode));
+    }
+
+    led_set_octave_shift(g_state.octave_shift);
+    led_set_latch(g_state.latch.enabled);
+    clock_set_sync_in_ppqn(settings->sync_in_ppqn);
+    sync_out_set_ppqn(settings->sync_out_ppqn);
+    sync_out_set_width_us(settings->sync_out_width_us);
+    sync_out_set_thru(settings->sync_out_thru);
+    looper_set_grid(settings->looper_grid);
+    clock_set_steps_per_quarter(settings->steps_per_quarter);
+    clock_set_swing(settings->swing);
+    clock_set_groove(settings->groove);
+    lfo_set_shape(settings->lfo_shape);
+    lfo_set_sync(settings->lfo_sync);
+    lfo_set_rate_mhz(settings->lfo_rate_mhz);
+    lfo_set_division(settings->lfo_division);
+    lfo_set_depth(settings->lfo_depth);
+}
+
+/*
+ * Gathers up the current settings so they can be stored
+ */
+static void collect_settings(struct settings *settings)
+{
+    settings->octave_shift = g_state.octave_shift;
+    settings->gate_time = g_state.gate_time;
+    settings->scale = g_state.scale_config.scale;
+    settings->scale_root = g_state.scale_config.root;
+    settings->transpose = g_state.scale_config.transpose;
+    settings->tuning = g_state.tuning_slot;
+    settings->voice_mode = g_state.voices.mode;
+    settings->latch_mode = g_state.latch.mode;
+    settings->sync_in_ppqn = clock_get_sync_in_ppqn();
+    settings->sync_out_ppqn = sync_out_get_ppqn();
+    settings->sync_out_width_us = sync_out_get_width_us();
+    settings->sync_out_thru = sync_out_get_thru();
+    settings->looper_grid = looper_get_grid();
+    settings->steps_per_quarter = clock_get_steps_per_quarter();
+    settings->swing = clock_get_swing();
+    settings->groove = clock_get_groove();
+    settings->lfo_shape = lfo_get_shape();
+    settings->lfo_sync = lfo_get_sync();
+    settings->lfo_rate_mhz = lfo_get_rate_mhz();
+    settings->lfo_division = lfo_get_division();
+    settings->lfo_depth = lfo_get_depth();
+}
+
+/*
+ * Keys played back by the looper. Runs from the scheduler interrupt, so
+ * the main loop holds sched_lock() around anything that touches the same
+ * state.
+ */
+static void looper_play_keys(uint64_t pressed, uint64_t released)
+{
+    for (uint64_t keys = released; keys; keys &= keys - 1) {
+        stop_key(__builtin_ctzll(keys));
+    }
+
+    for (uint64_t keys = pressed; keys; keys &= keys - 1) {
+        uint32_t key_id = __builtin_ctzll(keys);
+        usb_midi_key_event(IO_KEY_PRESSED, key_id, g_state.octave_shift);
         lkp_push_key(&g_state.key_press_stack, key_id);
+    }
+
+    voice_key_frame(&g_state.voices, &g_state.key_press_stack, pressed, released);
+}
+
+static void looper_play_octave(int8_t shift)
+{
+    g_state.octave_shift = shift;
+    led_set_octave_shift(shift);
+    update_scale_table();
+}
+
+/*
+ * Actions bound to keys in KEYMAP (see keymap.h). Each is called with the
+ * arg from its binding when the key is pressed.
+ */
+static void key_action_none(uint8_t arg)
+{
+}
+
+static void key_action_root(uint8_t arg)
+{
+    g_state.scale_config.root = arg;
+    update_scale_table();
+    settings_changed();
+}
+
+static void key_action_scale(uint8_t arg)
+{
+    g_state.scale_config.scale = arg;
+    update_scale_table();
+    settings_changed();
+}
+
+static void key_action_transpose(uint8_t arg)
+{
+    g_state.scale_config.transpose = arg;
+    update_scale_table();
+    settings_changed();
+}
+
+static void key_action_tuning(uint8_t arg)
+{
+    select_tuning(arg);
+    settings_changed();
+}
+
+static void key_action_swing(uint8_t arg)
+{
+    clock_set_swing(arg);
+    settings_changed();
+}
+
+static void key_action_sync_out_ppqn(uint8_t arg)
+{
+    uint8_t next = 0;
+
+    for (uint8_t i = 0; i < sizeof(g_sync_out_ppqns) - 1; i++) {
+        if (g_sync_out_ppqns[i] == sync_out_get_ppqn()) {
+            next = i + 1;
+        }
+    }
+
+    sync_out_set_ppqn(g_sync_out_ppqns[next]);
+    settings_changed();
+}
+
+static void key_action_voice_mode(uint8_t arg)
+{
+    voice_set_mode(&g_state.voices, (g_state.voices.mode + 1) % VOICE_NUM_MODES);
+    lfo_set_enabled(VOICE_MODE_MONO == g_state.voices.mode);
+    settings_changed();
+}
+
+static void key_action_latch(uint8_t arg)
+{
+    release_latched(latch_set_enabled(&g_state.latch, !g_state.latch.enabled));
+    led_set_latch(g_state.latch.enabled);
+}
+
+static void key_action_latch_mode(uint8_t arg)
+{
+    release_latched(latch_set_mode(&g_state.latch, (g_state.latch.mode + 1) % LATCH_NUM_MODES));
+    settings_changed();
+}
+
+static void key_action_record(uint8_t arg)
+{
+    looper_record_button();
+}
+
+static void key_action_looper_clear(uint8_t arg)
+{
+    looper_clear();
+}
+
+static void key_action_looper_grid(uint8_t arg)
+{
+    looper_set_grid((looper_get_grid() + 1) % LOOPER_NUM_GRIDS);
+    settings_changed();
+}
+
+static void key_action_octave_up(uint8_t arg)
+{
+    octave_shift(1);
+}
 
-        // If gate is low, this won't matter
-        // If gate is high, we want to retrigger it
-        set_gate(0);
+static void key_action_octave_down(uint8_t arg)
+{
+    octave_shift(0);
+}
+
+static void key_action_groove(uint8_t arg)
+{
+    clock_set_groove((clock_get_groove() + 1) % CLOCK_NUM_GROOVES);
+    settings_changed();
+}
+
+static void key_action_play_pause(uint8_t arg)
+{
+    if (clock_is_running()) {
+        clock_request_transport(CLOCK_STOP);
     } else {
-        uint8_t was_last_pressed = lkp_pop_key(&g_state.key_press_stack, key_id);
-        if (was_last_pressed) {
-            // If this was the last key pressed then either:
-            // a) There are no other keys pressed and we want gate low
-            // b) There are other keys pressed and we want to retrigger
-            set_gate(0);
-        } else {
-            // Don't need to update gate or CV if a key
-            // was released that wasn't the most recent key
-            return;
+        // Pick up where we left off, unless stop was pressed
+        clock_request_transport(g_state.transport_rewound ? CLOCK_START : CLOCK_CONTINUE);
+        g_state.transport_rewound = 0;
+    }
+}
+
+static void key_action_stop(uint8_t arg)
+{
+    clock_request_transport(CLOCK_STOP);
+    g_state.transport_rewound = 1;
+}
+
+typedef void (*key_action_t)(uint8_t arg);
+
+struct key_binding {
+    key_action_t action;
+    uint8_t arg;
+};
+
+#define BASE_BINDING(key, row, col, kind, base, base_arg, func, func_arg) [key] = {key_action_##base, base_arg},
+#define FUNC_BINDING(key, row, col, kind, base, base_arg, func, func_arg) [key] = {key_action_##func, func_arg},
+
+static const struct key_binding g_key_bindings[KEYMAP_NUM_LAYERS][NUM_KEYS] = {
+    [KEYMAP_LAYER_BASE] = {
+        [KEY_NONE] = {key_action_none, 0},
+        KEYMAP(BASE_BINDING)
+    },
+    [KEYMAP_LAYER_FUNC] = {
+        [KEY_NONE] = {key_action_none, 0},
+        KEYMAP(FUNC_BINDING)
+    },
+};
+
+/*
+ * Runs whatever the key is bound to on the given layer
+ */
+static inline void dispatch_key(uint8_t layer, uint32_t key_id)
+{
+    const struct key_binding *binding = &g_key_bindings[layer][key_id];
+    binding->action(binding->arg);
+}
+
+/*
+ * Updates the held key stack for the keybed keys in a frame and then the
+ * voices, once for the whole lot. Keys pressed while FUNC is held go to
+ * the function layer instead, and latched keys aren't released.
+ */
+static void handle_keybed_frame(uint64_t pressed, uint64_t released, uint32_t timestamp)
+{
+    uint64_t voice_pressed = 0;
+    uint64_t voice_released = 0;
+
+    for (uint64_t keys = released; keys; keys &= keys - 1) {
+        uint32_t key_id = __builtin_ctzll(keys);
+        uint64_t key_bit = IO_KEY_BIT(key_id);
+
+        if (g_state.func_layer_keys & key_bit) {
+            g_state.func_layer_keys &= ~key_bit;
+            continue;
+        }
+
+        if (latch_release(&g_state.latch, key_id)) {
+            // Keeps sounding
+            continue;
         }
+
+        stop_key(key_id);
+        voice_released |= key_bit;
     }
 
-    play_last_note(&g_state);
+    for (uint64_t keys = pressed; keys; keys &= keys - 1) {
+        uint32_t key_id = __builtin_ctzll(keys);
+        uint64_t key_bit = IO_KEY_BIT(key_id);
+
+        if (g_state.func_held) {
+            g_state.func_layer_keys |= key_bit;
+            dispatch_key(KEYMAP_LAYER_FUNC, key_id);
+            continue;
+        }
+
+        // A latched key is still sounding, unless this press starts a new
+        // chord that drops it
+        uint8_t sounding = latch_has(&g_state.latch, key_id);
+        uint64_t dropped = latch_press(&g_state.latch, key_id);
+
+        for (uint64_t drop = dropped; drop; drop &= drop - 1) {
+            stop_key(__builtin_ctzll(drop));
+        }
+        voice_released |= dropped;
+
+        if (sounding && !(dropped & key_bit)) {
+            continue;
+        }
+
+        usb_midi_key_event(IO_KEY_PRESSED, key_id, g_state.octave_shift);
+        lkp_push_key(&g_state.key_press_stack, key_id);
+        voice_pressed |= key_bit;
+    }
+
+    if (voice_pressed || voice_released) {
+        voice_key_frame(&g_state.voices, &g_state.key_press_stack, voice_pressed, voice_released);
+        looper_record_keys(voice_pressed, voice_released, timestamp);
+    }
 }
 
-void handle_func_key_event(uint8_t event_type, uint32_t key_id)
+static void handle_func_key_event(uint8_t event_type, uint32_t key_id)
 {
-    if (IO_KEY_RELEASED == event_type) {
+    if (KEY_FUNC == key_id) {
+        g_state.func_held = IO_KEY_PRESSED == event_type;
         return;
     }
 
-    if (KEY_OCTAVE_UP == key_id) {
-        octave_shift(1);
-    } else if (KEY_OCTAVE_DOWN == key_id) {
-        octave_shift(0);
+    if (IO_KEY_PRESSED == event_type) {
+        dispatch_key(g_state.func_held ? KEYMAP_LAYER_FUNC : KEYMAP_LAYER_BASE, key_id);
     }
 }
 
-int main(void)
+static void handle_key_frame(const struct io_key_frame *frame)
+{
+    g_state.keys_down = (g_state.keys_down & ~frame->released) | frame->pressed;
+
+    // Function keys go first so that FUNC is up to date for any keybed
+    // keys in the same frame
+    for (uint64_t keys = frame->released & ~IO_KEYBED_KEYS; keys; keys &= keys - 1) {
+        uint32_t key_id = __builtin_ctzll(keys);
+        usb_midi_key_event(IO_KEY_RELEASED, key_id, g_state.octave_shift);
+        handle_func_key_event(IO_KEY_RELEASED, key_id);
+    }
+
+    for (uint64_t keys = frame->pressed & ~IO_KEYBED_KEYS; keys; keys &= keys - 1) {
+        uint32_t key_id = __builtin_ctzll(keys);
+        usb_midi_key_event(IO_KEY_PRESSED, key_id, g_state.octave_shift);
+        handle_func_key_event(IO_KEY_PRESSED, key_id);
+    }
+
+    handle_keybed_frame(frame->pressed & IO_KEYBED_KEYS, frame->released & IO_KEYBED_KEYS, frame->timestamp);
+}
+
+static inline uint64_t held_stack_keys(void)
 {
-    stdio_init_all();
+    uint64_t keys = 0;
+    struct key_press *cursor = 0;
+
+    list_for_each_entry(cursor, &g_state.key_press_stack.stack, list) {
+        keys |= IO_KEY_BIT(cursor->key_id);
+    }
+
+    return keys;
+}
+
+/*
+ * Compares what we think is held with core1's snapshot of the matrix and
+ * makes up a frame to fix any differences, such as a release that never
+ * arrived. Only done while no frames are in flight, since the snapshot is
+ * ahead of us until they've been handled.
+ */
+static void reconcile_keys(void)
+{
+    struct io_key_snapshot snapshot;
+    io_read_key_snapshot(&snapshot);
+
+    if (snapshot.frames_posted != g_state.frames_consumed) {
+        return;
+    }
+
+    struct io_key_frame repair = {
+        .pressed = snapshot.keys & ~g_state.keys_down,
+        .released = (g_state.keys_down | (held_stack_keys() & ~(g_state.latch.keys | looper_sounding_keys())))
+            & ~snapshot.keys,
+        .timestamp = time_us_32()
+    };
+
+    if (!repair.pressed && !repair.released) {
+        return;
+    }
+
+    g_state.key_repairs += __builtin_popcountll(repair.pressed | repair.released);
+    trace_event(TRACE_KEY_REPAIR, __builtin_popcountll(repair.pressed | repair.released), g_state.key_repairs);
 
-    printf("Starting keyboard controller!\n");
+    handle_key_frame(&repair);
+}
+
+/*
+ * Brings up the next of the things that aren't needed to play. One step
+ * per pass of the main loop, so keys are still handled in between.
+ */
+static void boot_step(void)
+{
+    struct settings settings;
+
+    switch (g_state.boot_stage) {
+        case BOOT_STAGE_SETTINGS:
+            // Reading the flash is the slow part
+            if (settings_load(&settings)) {
+                settings_defaults(&settings);
+            }
+
+            sched_lock();
+            apply_settings(&settings);
+            sched_unlock();
+            boot_mark(BOOT_MARK_SETTINGS);
+            break;
+        case BOOT_STAGE_USB:
+            stdio_init_all();
+            if (!usb_init()) {
+                boot_mark(BOOT_MARK_USB);
+            }
+            break;
+    }
+
+    g_state.boot_stage++;
+}
+
+int main(void)
+{
+    trace_init();
 
     gpio_init(PWR_LED_PIN);
     gpio_set_dir(PWR_LED_PIN, GPIO_OUT);
     gpio_put(PWR_LED_PIN, 1);
 
-    gpio_init(GATE_OUT_PIN);
-    gpio_set_dir(GATE_OUT_PIN, GPIO_OUT);
-    set_gate(0);
-
     memset(&g_state, 0, sizeof(struct keyboard_state));
 
-    if (lkp_stack_init(&g_state.key_press_stack)) {
-        printf("Failed to init lkp stack");
+    // Nothing on stdio can be seen until USB is up, so failures here just
+    // stop
+    if (lkp_stack_init(&g_state.key_press_stack)
+        || init_cv_dac(&g_state.dac)
+        || sched_init()
+        || voice_init(&g_state.voices, &g_state.dac, key_to_code)
+        || io_init()
+        || usb_midi_init()
+        || clock_init()
+        || sync_out_init()
+        || lfo_init(&g_state.dac)
+        || looper_init(looper_play_keys, looper_play_octave)
+        || led_init()
+        || console_init(tuning_changed)
+        || ctl_init(&usb_ctl_io, tuning_changed)) {
         return 1;
     }
 
-    if (init_cv_dac(&g_state.dac)) {
-        printf("Failed to init CV DAC");
-        return 1;
-    }
+    // Play with the defaults until the stored settings have been read.
+    // The default tuning is 12-TET, which doesn't need the flash.
+    struct settings settings;
+    settings_defaults(&settings);
+    apply_settings(&settings);
+
+    mcp4921_set_codes(&g_state.dac, key_to_code(KEY_C1), key_to_code(KEY_C1));
+    boot_mark(BOOT_MARK_FIRST_DAC);
+
+    multicore_launch_core1(io_main);
 
-    if (io_init()) {
-        printf("Failed to init key matrix");
+    if (health_init()) {
         return 1;
     }
 
-    multicore_launch_core1(io_main);
+    trace_event(TRACE_BOOT, 0, 0);
 
     while (1) {
+        while (io_frame_queue_ready()) {
+            struct io_key_frame frame;
+
+            io_frame_queue_pop_blocking(&frame);
+            g_state.frames_consumed++;
+            trace_event(TRACE_KEY_FRAME, __builtin_popcountll(frame.pressed), __builtin_popcountll(frame.released));
+
+            // Keeps looper playback from landing part way through
+            sched_lock();
+            handle_key_frame(&frame);
+            sched_unlock();
+        }
+
         while (io_event_queue_ready()) {
             uint8_t event_type = 0;
             uint16_t event_val = 0;
 
             io_event_t io_event = io_event_queue_pop_blocking();
             io_event_unpack(io_event, &event_type, &event_val);
-            printf("io event: type: %d, id: %d\n", event_type, event_val);
-
-	    // switch (event_type) {
-            //     case IO_KEY_PRESSED:
-	    //     case IO_KEY_RELEASED:
-            //         if (io_is_keybed_key(event_val)) {
-            //             handle_keybed_event(event_type, event_val);
-            //         } else {
-            //             handle_func_key_event(event_type, event_val);
-            //         }
-
-	    //         break;
-	    //     case IO_CLK_SPEED_CHANGED:
-	    //     case IO_CLK_DIV_CHANGED:
-	    //     case IO_MODE_CHANGED:
-	    //     case IO_SUB_MODE_CHANGED:
-	    //         printf("This IO event not yet implemented\n");
-	    //         break;
-	    // }
+            trace_event(TRACE_IO_EVENT, event_type, event_val);
+
+            if (!io_is_cv_event(event_type)) {
+                led_set_analog(event_val);
+            }
+
+            switch (event_type) {
+                case IO_CLK_SPEED_CHANGED:
+                    clock_set_bpm(analog_to_bpm(event_val));
+                    break;
+                case IO_GATE_TIME_CHANGED:
+                    g_state.gate_time = event_val;
+                    settings_changed();
+                    break;
+                case IO_SUB_MODE_CHANGED:
+                    g_state.scale_config.scale = ((uint32_t) event_val * SCALE_NUM_SCALES) / (ANALOG_MAX_VAL + 1);
+                    sched_lock();
+                    update_scale_table();
+                    sched_unlock();
+                    settings_changed();
+                    break;
+                case IO_CLK_DIV_CHANGED:
+                    clock_set_steps_per_quarter(
+                        g_step_divisions[((uint32_t) event_val * sizeof(g_step_divisions)) / (ANALOG_MAX_VAL + 1)]);
+                    settings_changed();
+                    break;
+                case IO_MODE_CHANGED:
+                    // Not yet implemented
+                    break;
+                case IO_CV_TRANSPOSE_CHANGED:
+                    // Rebuilds the scale table, so it moves the keybed and
+                    // the looper alike from their next note
+                    g_state.cv_transpose = (int16_t) event_val;
+                    sched_lock();
+                    update_scale_table();
+                    sched_unlock();
+                    break;
+            }
+        }
+
+        looper_task();
+        health_task();
+
+        if (BOOT_STAGE_DONE != g_state.boot_stage) {
+            boot_step();
+        } else {
+            usb_task();
+            console_task();
+            ctl_task();
+
+            // Anything printed before the host opened the console is lost
+            if (!g_state.boot_reported && usb_console_connected()) {
+                g_state.boot_reported = 1;
+                printf("Starting keyboard controller!\n");
+                boot_print();
+            }
+        }
+
+        if (time_us_64() - g_state.last_reconcile_us >= KEY_RECONCILE_INTERVAL_US) {
+            g_state.last_reconcile_us = time_us_64();
+            sched_lock();
+            reconcile_keys();
+            sched_unlock();
         }
+
+        if (BOOT_STAGE_DONE == g_state.boot_stage && settings_save_due()) {
+            collect_settings(&settings);
+            settings_save(&settings);
+        }
+
+        // Nothing else to do, so flush some trace records out
+        trace_drain();
     }
 
 }
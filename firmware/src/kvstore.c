@@ -0,0 +1,324 @@
+#include <stdint.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+
+#include "kvstore.h"
+
+#define KV_REGION_OFFSET (PICO_FLASH_SIZE_BYTES - (KV_NUM_PAGES * KV_PAGE_SIZE))
+#define KV_PAGE_MAGIC 0x3253564b // "KVS2", single sector pages were "KVS1"
+#define KV_KEY_ERASED 0xff
+#define KV_NO_PAGE 0xff
+
+struct kv_page_header {
+    uint32_t magic;
+    uint32_t seq;
+};
+
+struct kv_record_header {
+    uint8_t key;
+    uint8_t len;
+    uint16_t crc;
+};
+
+struct kv_state {
+    uint8_t active;
+    uint32_t seq;
+    uint32_t write_offset;
+    // Offset of the latest record for each key within the active page.
+    // 0 if the key isn't stored.
+    uint16_t index[KV_MAX_KEYS];
+    uint32_t erases;
+} g_kv;
+
+static uint8_t g_kv_program_buf[FLASH_PAGE_SIZE];
+static uint8_t g_kv_record[KV_RECORD_SIZE(KV_MAX_VALUE_LEN)];
+
+static inline uint32_t kv_page_offset(uint8_t page)
+{
+    return KV_REGION_OFFSET + (page * KV_PAGE_SIZE);
+}
+
+static inline const uint8_t *kv_page_ptr(uint8_t page)
+{
+    return (const uint8_t *) (XIP_BASE + kv_page_offset(page));
+}
+
+/*
+ * CRC-16/CCITT over the key, length and value of a record
+ */
+static uint16_t kv_crc(uint8_t key, uint8_t len, const uint8_t *data)
+{
+    uint16_t crc = 0xffff;
+    uint8_t header[2] = {key, len};
+
+    for (uint16_t i = 0; i < 2 + len; i++) {
+        crc ^= (i < 2 ? header[i] : data[i - 2]) << 8;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+/*
+ * Flash can't be read while it is being written, and all of our code runs
+ * from it, so core1 is parked and interrupts are disabled for the duration
+ * of each operation. Each one is kept to a single flash page or sector so
+ * the scanner gets to run in between.
+ */
+static void kv_flash_lockout_start(uint8_t *locked_out, uint32_t *irq_state)
+{
+    *locked_out = multicore_lockout_victim_is_initialized(1);
+    if (*locked_out) {
+        multicore_lockout_start_blocking();
+    }
+
+    *irq_state = save_and_disable_interrupts();
+}
+
+static void kv_flash_lockout_end(uint8_t locked_out, uint32_t irq_state)
+{
+    restore_interrupts(irq_state);
+
+    if (locked_out) {
+        multicore_lockout_end_blocking();
+    }
+}
+
+static void kv_erase_page(uint8_t page)
+{
+    for (uint32_t sector = 0; sector < KV_SECTORS_PER_PAGE; sector++) {
+        uint8_t locked_out;
+        uint32_t irq_state;
+
+        kv_flash_lockout_start(&locked_out, &irq_state);
+        flash_range_erase(kv_page_offset(page) + (sector * FLASH_SECTOR_SIZE), FLASH_SECTOR_SIZE);
+        kv_flash_lockout_end(locked_out, irq_state);
+
+        g_kv.erases++;
+    }
+}
+
+/*
+ * Programs bytes at an arbitrary offset within a store page. Each flash
+ * page is padded with 0xff, which leaves whatever is already programmed
+ * around the new bytes untouched.
+ */
+static void kv_program(uint8_t page, uint32_t offset, const uint8_t *data, uint32_t len)
+{
+    while (len) {
+        uint32_t page_start = offset & ~(FLASH_PAGE_SIZE - 1);
+        uint32_t in_page = offset - page_start;
+        uint32_t chunk = FLASH_PAGE_SIZE - in_page;
+        if (chunk > len) {
+            chunk = len;
+        }
+
+        memset(g_kv_program_buf, 0xff, FLASH_PAGE_SIZE);
+        memcpy(&g_kv_program_buf[in_page], data, chunk);
+
+        uint8_t locked_out;
+        uint32_t irq_state;
+
+        kv_flash_lockout_start(&locked_out, &irq_state);
+        flash_range_program(kv_page_offset(page) + page_start, g_kv_program_buf, FLASH_PAGE_SIZE);
+        kv_flash_lockout_end(locked_out, irq_state);
+
+        offset += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+/*
+ * Rebuilds the index from the records in the active page
+ */
+static void kv_scan(void)
+{
+    const uint8_t *base = kv_page_ptr(g_kv.active);
+    uint32_t offset = sizeof(struct kv_page_header);
+
+    memset(g_kv.index, 0, sizeof(g_kv.index));
+
+    while (offset + sizeof(struct kv_record_header) <= KV_PAGE_SIZE) {
+        const struct kv_record_header *record = (const struct kv_record_header *) &base[offset];
+
+        if (KV_KEY_ERASED == record->key) {
+            break;
+        }
+
+        uint32_t size = KV_RECORD_SIZE(record->len);
+        if (offset + size > KV_PAGE_SIZE) {
+            // Garbage, probably a write that was cut off. Treat the page
+            // as full so the next write moves everything to a clean one.
+            offset = KV_PAGE_SIZE;
+            break;
+        }
+
+        const uint8_t *value = (const uint8_t *) (record + 1);
+        if (record->key < KV_MAX_KEYS && record->crc == kv_crc(record->key, record->len, value)) {
+            g_kv.index[record->key] = offset;
+        }
+
+        offset += size;
+    }
+
+    g_kv.write_offset = offset;
+}
+
+/*
+ * Returns the space the latest value of every key takes up, which is what
+ * a roll copies over
+ */
+static uint32_t kv_live_size(void)
+{
+    uint32_t size = 0;
+
+    if (KV_NO_PAGE == g_kv.active) {
+        return 0;
+    }
+
+    const uint8_t *base = kv_page_ptr(g_kv.active);
+
+    for (uint8_t key = 1; key < KV_MAX_KEYS; key++) {
+        if (g_kv.index[key]) {
+            size += KV_RECORD_SIZE(((const struct kv_record_header *) &base[g_kv.index[key]])->len);
+        }
+    }
+
+    return size;
+}
+
+/*
+ * Copies the latest value of every key in to the next page and makes it
+ * the active one. The page header is written last, so if this gets cut
+ * off the old page is still the newest valid one at the next boot. The
+ * caller has to check that the live values fit.
+ */
+static void kv_roll(void)
+{
+    uint8_t next = KV_NO_PAGE == g_kv.active ? 0 : (g_kv.active + 1) % KV_NUM_PAGES;
+    uint32_t offset = sizeof(struct kv_page_header);
+    uint16_t new_index[KV_MAX_KEYS] = {0};
+
+    kv_erase_page(next);
+
+    if (KV_NO_PAGE != g_kv.active) {
+        const uint8_t *base = kv_page_ptr(g_kv.active);
+
+        for (uint8_t key = 1; key < KV_MAX_KEYS; key++) {
+            if (!g_kv.index[key]) {
+                continue;
+            }
+
+            const struct kv_record_header *record = (const struct kv_record_header *) &base[g_kv.index[key]];
+            uint32_t size = KV_RECORD_SIZE(record->len);
+
+            memcpy(g_kv_record, record, size);
+            kv_program(next, offset, g_kv_record, size);
+            new_index[key] = offset;
+            offset += size;
+        }
+    }
+
+    struct kv_page_header header = {
+        .magic = KV_PAGE_MAGIC,
+        .seq = g_kv.seq + 1
+    };
+    kv_program(next, 0, (const uint8_t *) &header, sizeof(header));
+
+    g_kv.active = next;
+    g_kv.seq = header.seq;
+    g_kv.write_offset = offset;
+    memcpy(g_kv.index, new_index, sizeof(g_kv.index));
+}
+
+int kv_init(void)
+{
+    memset(&g_kv, 0, sizeof(struct kv_state));
+    g_kv.active = KV_NO_PAGE;
+
+    for (uint8_t page = 0; page < KV_NUM_PAGES; page++) {
+        const struct kv_page_header *header = (const struct kv_page_header *) kv_page_ptr(page);
+
+        if (KV_PAGE_MAGIC != header->magic) {
+            continue;
+        }
+
+        if (KV_NO_PAGE == g_kv.active || (int32_t) (header->seq - g_kv.seq) > 0) {
+            g_kv.active = page;
+            g_kv.seq = header->seq;
+        }
+    }
+
+    if (KV_NO_PAGE != g_kv.active) {
+        kv_scan();
+    }
+
+    return 0;
+}
+
+int kv_read(uint8_t key, void *buf, size_t buf_len)
+{
+    if (!key || key >= KV_MAX_KEYS || !g_kv.index[key]) {
+        return -1;
+    }
+
+    const struct kv_record_header *record =
+        (const struct kv_record_header *) &kv_page_ptr(g_kv.active)[g_kv.index[key]];
+
+    memcpy(buf, record + 1, record->len < buf_len ? record->len : buf_len);
+
+    return record->len;
+}
+
+int kv_write(uint8_t key, const void *data, size_t len)
+{
+    if (!key || key >= KV_MAX_KEYS || len > KV_MAX_VALUE_LEN) {
+        return 1;
+    }
+
+    if (g_kv.index[key]) {
+        const struct kv_record_header *record =
+            (const struct kv_record_header *) &kv_page_ptr(g_kv.active)[g_kv.index[key]];
+
+        if (record->len == len && !memcmp(record + 1, data, len)) {
+            // Save the erase cycles
+            return 0;
+        }
+    }
+
+    uint32_t size = KV_RECORD_SIZE(len);
+
+    if (KV_NO_PAGE == g_kv.active || g_kv.write_offset + size > KV_PAGE_SIZE) {
+        // The roll carries the old value of this key over too, so it has
+        // to fit alongside the new one
+        if (kv_live_size() + size > KV_PAGE_CAPACITY) {
+            return 1;
+        }
+
+        kv_roll();
+    }
+
+    struct kv_record_header *header = (struct kv_record_header *) g_kv_record;
+    memset(g_kv_record, 0xff, size);
+    header->key = key;
+    header->len = len;
+    header->crc = kv_crc(key, len, data);
+    memcpy(header + 1, data, len);
+
+    kv_program(g_kv.active, g_kv.write_offset, g_kv_record, size);
+    g_kv.index[key] = g_kv.write_offset;
+    g_kv.write_offset += size;
+
+    return 0;
+}
+
+uint32_t kv_erase_count(void)
+{
+    return g_kv.erases;
+}
@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "io.h"
+#include "latch.h"
+
+static inline void latch_add(struct latch *latch, uint32_t key_id)
+{
+    if (latch_has(latch, key_id) || latch->count >= LATCH_MAX_KEYS) {
+        return;
+    }
+
+    latch->keys |= IO_KEY_BIT(key_id);
+    latch->order[latch->count++] = key_id;
+}
+
+void latch_init(struct latch *latch, uint8_t mode)
+{
+    memset(latch, 0, sizeof(struct latch));
+    latch->mode = mode < LATCH_NUM_MODES ? mode : LATCH_MODE_ADD;
+}
+
+uint64_t latch_clear(struct latch *latch)
+{
+    uint64_t dropped = latch_released_keys(latch);
+
+    latch->keys = 0;
+    latch->count = 0;
+
+    return dropped;
+}
+
+uint64_t latch_set_enabled(struct latch *latch, uint8_t enabled)
+{
+    uint64_t dropped = latch_clear(latch);
+    latch->enabled = enabled;
+
+    if (!enabled) {
+        return dropped;
+    }
+
+    for (uint64_t keys = latch->physical; keys; keys &= keys - 1) {
+        latch_add(latch, __builtin_ctzll(keys));
+    }
+
+    return dropped;
+}
+
+uint64_t latch_set_mode(struct latch *latch, uint8_t mode)
+{
+    if (mode >= LATCH_NUM_MODES) {
+        return 0;
+    }
+
+    latch->mode = mode;
+
+    return latch_clear(latch);
+}
+
+uint64_t latch_press(struct latch *latch, uint32_t key_id)
+{
+    uint64_t dropped = 0;
+
+    if (latch->enabled) {
+        if (LATCH_MODE_REPLACE == latch->mode && !latch->physical) {
+            // New chord
+            dropped = latch_clear(latch);
+        }
+
+        latch_add(latch, key_id);
+    }
+
+    latch->physical |= IO_KEY_BIT(key_id);
+
+    return dropped;
+}
+
+uint8_t latch_release(struct latch *latch, uint32_t key_id)
+{
+    latch->physical &= ~IO_KEY_BIT(key_id);
+
+    return latch->enabled && latch_has(latch, key_id);
+}
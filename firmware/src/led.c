@@ -0,0 +1,140 @@
+#include <stdint.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "hardware/pwm.h"
+
+#include "hardware_config.h"
+#include "clock.h"
+#include "hot.h"
+#include "led.h"
+
+// LED1 and LED2 run at ~30kHz, with a 12 bit level to match the ADC
+#define LED_FAST_WRAP 4095
+#define LED_BEAT_LEVEL (LED_FAST_WRAP / 8)
+#define LED_DOWNBEAT_LEVEL LED_FAST_WRAP
+// Keeps the analog glow clear of the latch being on
+#define LED_ANALOG_MAX_LEVEL (LED_FAST_WRAP / 2)
+
+// LED3's slice counts up and down at the slowest divider, which gives a
+// period of ~270ms at the default system clock
+#define LED_SLOW_WRAP 0xffff
+#define LED_SLOW_CLKDIV_INT 255
+#define LED_SLOW_CLKDIV_FRAC 15
+#define LED_SHORT_BLINK_LEVEL (LED_SLOW_WRAP / 8)
+#define LED_LONG_BLINK_LEVEL (LED_SLOW_WRAP - LED_SHORT_BLINK_LEVEL)
+
+struct led_state {
+    // Only touched by core0
+    uint8_t latch;
+    uint16_t analog_level;
+    uint16_t led2_level;
+    uint16_t led3_level;
+
+    // Only touched by the clock listener on core1
+    uint8_t stopped;
+    uint16_t led1_level;
+} g_led;
+
+static inline void led_set_level(uint8_t pin, uint16_t *current, uint16_t level)
+{
+    if (*current == level) {
+        return;
+    }
+
+    *current = level;
+    pwm_set_chan_level(pwm_gpio_to_slice_num(pin), pwm_gpio_to_channel(pin), level);
+}
+
+static void HOT_FUNC(led_clock_listener)(uint8_t event, uint32_t tick)
+{
+    switch (event) {
+        case CLOCK_TICK:
+            break;
+        case CLOCK_STOP:
+            g_led.stopped = 1;
+            led_set_level(LED1_PIN, &g_led.led1_level, 0);
+            return;
+        case CLOCK_START:
+        case CLOCK_CONTINUE:
+            g_led.stopped = 0;
+            return;
+        default:
+            return;
+    }
+
+    // Ticks keep coming while stopped, but the count doesn't move
+    if (g_led.stopped) {
+        return;
+    }
+
+    uint32_t phase = tick % CLOCK_PPQN;
+
+    if (0 == phase) {
+        uint8_t downbeat = 0 == (tick / CLOCK_PPQN) % LED_BEATS_PER_BAR;
+        led_set_level(LED1_PIN, &g_led.led1_level, downbeat ? LED_DOWNBEAT_LEVEL : LED_BEAT_LEVEL);
+    } else if (LED_FLASH_TICKS == phase) {
+        led_set_level(LED1_PIN, &g_led.led1_level, 0);
+    }
+}
+
+static void led_update_led2(void)
+{
+    led_set_level(LED2_PIN, &g_led.led2_level, g_led.latch ? LED_FAST_WRAP : g_led.analog_level);
+}
+
+int led_init(void)
+{
+    memset(&g_led, 0, sizeof(struct led_state));
+
+    pwm_config fast = pwm_get_default_config();
+    pwm_config_set_wrap(&fast, LED_FAST_WRAP);
+    pwm_init(pwm_gpio_to_slice_num(LED1_PIN), &fast, false);
+    pwm_set_chan_level(pwm_gpio_to_slice_num(LED1_PIN), pwm_gpio_to_channel(LED1_PIN), 0);
+    pwm_set_chan_level(pwm_gpio_to_slice_num(LED2_PIN), pwm_gpio_to_channel(LED2_PIN), 0);
+
+    // LED4's channel on this slice is never routed to its pin, so the
+    // second gate is unaffected
+    pwm_config slow = pwm_get_default_config();
+    pwm_config_set_phase_correct(&slow, true);
+    pwm_config_set_clkdiv_int_frac(&slow, LED_SLOW_CLKDIV_INT, LED_SLOW_CLKDIV_FRAC);
+    pwm_config_set_wrap(&slow, LED_SLOW_WRAP);
+    pwm_init(pwm_gpio_to_slice_num(LED3_PIN), &slow, false);
+    pwm_set_chan_level(pwm_gpio_to_slice_num(LED3_PIN), pwm_gpio_to_channel(LED3_PIN), 0);
+
+    gpio_set_function(LED1_PIN, GPIO_FUNC_PWM);
+    gpio_set_function(LED2_PIN, GPIO_FUNC_PWM);
+    gpio_set_function(LED3_PIN, GPIO_FUNC_PWM);
+
+    pwm_set_enabled(pwm_gpio_to_slice_num(LED1_PIN), true);
+    pwm_set_enabled(pwm_gpio_to_slice_num(LED3_PIN), true);
+
+    return clock_add_listener(led_clock_listener);
+}
+
+void led_set_latch(uint8_t enabled)
+{
+    g_led.latch = enabled;
+    led_update_led2();
+}
+
+void led_set_analog(uint16_t value)
+{
+    // Squared, since brightness looks roughly linear that way
+    uint32_t squared = ((uint32_t) value * value) / LED_FAST_WRAP;
+    g_led.analog_level = (squared * LED_ANALOG_MAX_LEVEL) / LED_FAST_WRAP;
+    led_update_led2();
+}
+
+void led_set_octave_shift(int8_t shift)
+{
+    uint16_t level = 0;
+
+    if (shift < 0) {
+        level = LED_SHORT_BLINK_LEVEL;
+    } else if (shift > 0) {
+        level = LED_LONG_BLINK_LEVEL;
+    }
+
+    led_set_level(LED3_PIN, &g_led.led3_level, level);
+}
@@ -0,0 +1,322 @@
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "pico/stdlib.h"
+
+#include "clock.h"
+#include "hot.h"
+#include "lfo.h"
+
+// Half scale, which is also the most the output can swing either way
+#define LFO_CENTER_CODE ((MCP4921_MAX_VAL + 1) / 2)
+
+// Not a valid code, so the next update always writes
+#define LFO_NO_CODE UINT16_MAX
+
+#define LFO_UPDATES_PER_SEC (1000 * 1000 / LFO_UPDATE_INTERVAL_US)
+
+// Bits of the phase below the table index
+#define LFO_FRAC_BITS (32 - LFO_TABLE_BITS)
+
+// Clock ticks per cycle for each lfo_division
+static const uint16_t g_lfo_division_ticks[LFO_NUM_DIVISIONS] = {
+    [LFO_DIV_4_BARS] = CLOCK_PPQN * 16,
+    [LFO_DIV_2_BARS] = CLOCK_PPQN * 8,
+    [LFO_DIV_1_BAR] = CLOCK_PPQN * 4,
+    [LFO_DIV_HALF] = CLOCK_PPQN * 2,
+    [LFO_DIV_QUARTER] = CLOCK_PPQN,
+    [LFO_DIV_QUARTER_TRIPLET] = CLOCK_PPQN * 2 / 3,
+    [LFO_DIV_EIGHTH] = CLOCK_PPQN / 2,
+    [LFO_DIV_EIGHTH_TRIPLET] = CLOCK_PPQN / 3,
+    [LFO_DIV_SIXTEENTH] = CLOCK_PPQN / 4,
+};
+
+struct lfo_state {
+    struct mcp4921 *dac;
+    repeating_timer_t timer;
+
+    // One extra entry so interpolation never has to wrap
+    int16_t sine[LFO_TABLE_LEN + 1];
+
+    // Written by core0, read by core1
+    volatile uint8_t enabled;
+    volatile uint8_t shape;
+    volatile uint8_t sync;
+    volatile uint8_t division;
+    volatile uint8_t depth;
+    volatile uint16_t rate_mhz;
+    volatile uint32_t phase_inc; // Per update when free running
+    volatile uint16_t amplitude; // In codes either side of the centre
+
+    // Only touched on core1
+    uint32_t phase;
+    int16_t held; // Sample and hold level
+    uint32_t random;
+    uint16_t code; // Last written
+    uint8_t clock_running;
+    uint32_t tick;
+    uint32_t tick_us;
+
+    // Written by core1
+    volatile uint32_t updates;
+    volatile uint32_t dropped;
+    volatile uint32_t max_update_us;
+} g_lfo;
+
+static inline uint32_t HOT_FUNC(lfo_next_random)(void)
+{
+    // xorshift32
+    g_lfo.random ^= g_lfo.random << 13;
+    g_lfo.random ^= g_lfo.random >> 17;
+    g_lfo.random ^= g_lfo.random << 5;
+
+    return g_lfo.random;
+}
+
+/*
+ * Works out the phase from where the clock is, so that it lines up with
+ * the beat however the tempo moves. Between ticks it is interpolated with
+ * the tick period.
+ */
+static inline uint32_t HOT_FUNC(lfo_synced_phase)(uint32_t now)
+{
+    uint32_t ticks_per_cycle = g_lfo_division_ticks[g_lfo.division];
+    uint32_t tick_inc = (UINT32_MAX / ticks_per_cycle) + 1;
+    uint32_t period_us = clock_get_tick_period_us();
+
+    if (!period_us) {
+        return g_lfo.phase;
+    }
+
+    uint32_t elapsed_us = now - g_lfo.tick_us;
+
+    if (g_lfo.clock_running) {
+        // Wait for the next tick rather than running ahead of it
+        if (elapsed_us > period_us) {
+            elapsed_us = period_us;
+        }
+    } else {
+        // Nothing is ticking, so keep going at the last tempo
+        while (elapsed_us >= period_us) {
+            g_lfo.tick++;
+            g_lfo.tick_us += period_us;
+            elapsed_us -= period_us;
+        }
+    }
+
+    // Fraction of a tick, 8 bits is plenty and stays clear of 32 bit overflow
+    uint32_t frac = (elapsed_us << 8) / period_us;
+
+    return (g_lfo.tick % ticks_per_cycle) * tick_inc + (uint32_t) (((uint64_t) tick_inc * frac) >> 8);
+}
+
+/*
+ * Returns the level for the current phase, -32768 to 32767
+ */
+static inline int32_t HOT_FUNC(lfo_level)(uint8_t shape, uint32_t phase)
+{
+    switch (shape) {
+        case LFO_SHAPE_SINE: {
+            uint32_t index = phase >> LFO_FRAC_BITS;
+            int32_t frac = (phase >> (LFO_FRAC_BITS - 16)) & 0xffff;
+            int32_t a = g_lfo.sine[index];
+            int32_t b = g_lfo.sine[index + 1];
+
+            return a + (((b - a) * frac) >> 16);
+        }
+        case LFO_SHAPE_TRIANGLE: {
+            int32_t ramp = phase >> 15;
+            return ramp < 65536 ? ramp - 32768 : 98303 - ramp;
+        }
+        case LFO_SHAPE_SAW:
+            return (int32_t) (phase >> 16) - 32768;
+        case LFO_SHAPE_SQUARE:
+            return phase < 0x80000000 ? 32767 : -32768;
+        case LFO_SHAPE_SAMPLE_HOLD:
+            return g_lfo.held;
+    }
+
+    return 0;
+}
+
+static bool HOT_FUNC(lfo_update)(repeating_timer_t *rt)
+{
+    uint8_t shape = g_lfo.shape;
+
+    if (!g_lfo.enabled || LFO_SHAPE_OFF == shape) {
+        // Voice 1 could have moved the output in the meantime
+        g_lfo.code = LFO_NO_CODE;
+        return true;
+    }
+
+    uint32_t start_us = time_us_32();
+    uint32_t phase = g_lfo.sync ? lfo_synced_phase(start_us) : g_lfo.phase + g_lfo.phase_inc;
+
+    // Wrapped, so this is a new cycle. A small step back is just the
+    // synced phase settling after a tempo change.
+    if (phase < g_lfo.phase && g_lfo.phase - phase >= 0x80000000) {
+        g_lfo.held = (int16_t) (lfo_next_random() >> 16);
+    }
+    g_lfo.phase = phase;
+
+    int32_t level = lfo_level(shape, phase);
+    uint16_t code = LFO_CENTER_CODE + ((level * g_lfo.amplitude) >> 15);
+
+    if (code != g_lfo.code) {
+        if (mcp4921_queue_code(g_lfo.dac, MCP4921_DAC_B, code)) {
+            // Try again next time
+            g_lfo.dropped++;
+        } else {
+            g_lfo.code = code;
+        }
+    }
+
+    g_lfo.updates++;
+
+    uint32_t update_us = time_us_32() - start_us;
+    if (update_us > g_lfo.max_update_us) {
+        g_lfo.max_update_us = update_us;
+    }
+
+    return true;
+}
+
+static void HOT_FUNC(lfo_clock_listener)(uint8_t event, uint32_t tick)
+{
+    switch (event) {
+        case CLOCK_START:
+        case CLOCK_CONTINUE:
+            g_lfo.clock_running = 1;
+            break;
+        case CLOCK_STOP:
+            g_lfo.clock_running = 0;
+            return;
+        case CLOCK_TICK:
+            // Ticks keep coming while stopped, but don't move
+            if (!g_lfo.clock_running) {
+                return;
+            }
+            break;
+        default:
+            return;
+    }
+
+    g_lfo.tick = tick;
+    g_lfo.tick_us = time_us_32();
+}
+
+int lfo_init(struct mcp4921 *dac)
+{
+    memset(&g_lfo, 0, sizeof(struct lfo_state));
+
+    if (!dac->hw_cs) {
+        return 1;
+    }
+
+    g_lfo.dac = dac;
+    g_lfo.random = 0x2545f491;
+    g_lfo.code = LFO_NO_CODE;
+
+    for (uint32_t i = 0; i <= LFO_TABLE_LEN; i++) {
+        g_lfo.sine[i] = (int16_t) lroundf(32767.0f * sinf((2.0f * (float) M_PI * i) / LFO_TABLE_LEN));
+    }
+
+    lfo_set_rate_mhz(LFO_DEFAULT_RATE_MHZ);
+    lfo_set_depth(LFO_DEFAULT_DEPTH);
+
+    return clock_add_listener(lfo_clock_listener);
+}
+
+void lfo_run(alarm_pool_t *pool)
+{
+    g_lfo.clock_running = clock_is_running();
+    g_lfo.tick_us = time_us_32();
+
+    // Negative so the period runs from one update's start to the next rather
+    // than from the end of lfo_update(), phase_inc assumes exactly
+    // LFO_UPDATES_PER_SEC updates
+    alarm_pool_add_repeating_timer_us(pool, -LFO_UPDATE_INTERVAL_US, lfo_update, 0, &g_lfo.timer);
+}
+
+void lfo_set_enabled(uint8_t enabled)
+{
+    g_lfo.enabled = enabled;
+}
+
+int lfo_set_shape(uint8_t shape)
+{
+    if (shape >= LFO_NUM_SHAPES) {
+        return 1;
+    }
+
+    g_lfo.shape = shape;
+    return 0;
+}
+
+uint8_t lfo_get_shape(void)
+{
+    return g_lfo.shape;
+}
+
+int lfo_set_rate_mhz(uint16_t rate_mhz)
+{
+    if (rate_mhz < LFO_MIN_RATE_MHZ || rate_mhz > LFO_MAX_RATE_MHZ) {
+        return 1;
+    }
+
+    g_lfo.rate_mhz = rate_mhz;
+    g_lfo.phase_inc = ((uint64_t) rate_mhz << 32) / (1000 * LFO_UPDATES_PER_SEC);
+    return 0;
+}
+
+uint16_t lfo_get_rate_mhz(void)
+{
+    return g_lfo.rate_mhz;
+}
+
+void lfo_set_sync(uint8_t sync)
+{
+    g_lfo.sync = sync != 0;
+}
+
+uint8_t lfo_get_sync(void)
+{
+    return g_lfo.sync;
+}
+
+int lfo_set_division(uint8_t division)
+{
+    if (division >= LFO_NUM_DIVISIONS) {
+        return 1;
+    }
+
+    g_lfo.division = division;
+    return 0;
+}
+
+uint8_t lfo_get_division(void)
+{
+    return g_lfo.division;
+}
+
+void lfo_set_depth(uint8_t depth)
+{
+    if (depth > LFO_MAX_DEPTH) {
+        depth = LFO_MAX_DEPTH;
+    }
+
+    g_lfo.depth = depth;
+    g_lfo.amplitude = (LFO_CENTER_CODE * depth) / LFO_MAX_DEPTH;
+}
+
+uint8_t lfo_get_depth(void)
+{
+    return g_lfo.depth;
+}
+
+void lfo_get_stats(struct lfo_stats *stats)
+{
+    stats->updates = g_lfo.updates;
+    stats->dropped = g_lfo.dropped;
+    stats->max_update_us = g_lfo.max_update_us;
+}
@@ -8,7 +8,7 @@ void lkp_push_key(struct lkp_stack *stack, uint32_t key_id)
 {
     struct key_press *new_key_press = 0;
     // Find the first available key press
-    for (uint8_t i = 0; i <= MAX_KEY_PRESSES; i++) {
+    for (uint8_t i = 0; i < MAX_KEY_PRESSES; i++) {
         if (0 == stack->key_press_pool[i].key_id) {
             new_key_press = &stack->key_press_pool[i];
             break;
@@ -35,7 +35,7 @@ uint8_t lkp_pop_key(struct lkp_stack *stack, uint32_t key_id)
         }
     }
 
-    if (!cursor) {
+    if (&cursor->list == &stack->stack) {
         // Didn't find the key in the stack. This should mean that we ran out of
         // key_presses when it was pressed. Have to ignore it.
         return 0;
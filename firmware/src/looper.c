@@ -0,0 +1,600 @@
+#include <stdint.h>
+#include <string.h>
+#include "pico/stdlib.h"
+
+#include "clock.h"
+#include "hot.h"
+#include "io.h"
+#include "sched.h"
+#include "looper.h"
+
+#define LOOPER_MAX_LENGTH (LOOPER_MAX_BARS * LOOPER_BAR_TICKS * LOOPER_SUBTICKS)
+
+// Passed to the scheduler callback when it is only there to look again
+#define LOOPER_WAKE_ONLY ((void *) 1)
+
+static const uint8_t g_looper_grid_ticks[LOOPER_NUM_GRIDS] = {
+    0,
+    CLOCK_PPQN,
+    CLOCK_PPQN / 2,
+    CLOCK_PPQN / 4,
+    CLOCK_PPQN / 8
+};
+
+struct looper_state {
+    uint8_t status;
+    uint8_t grid;
+    looper_keys_callback_t on_keys;
+    looper_octave_callback_t on_octave;
+
+    // The recorded loop, in position order once recording has finished
+    struct looper_event events[LOOPER_MAX_EVENTS];
+    uint16_t num_events;
+    // Overdubs since the loop last came round
+    struct looper_event staging[LOOPER_STAGING_EVENTS];
+    uint16_t num_staged;
+    uint32_t dropped;
+
+    uint32_t origin_tick; // Bar line that recording started from
+    uint32_t length_ticks;
+    uint32_t length; // In subticks
+    uint64_t recording_keys; // Recorded presses that haven't been released yet
+    uint32_t last_pos; // For spotting the loop coming round
+    uint8_t running;
+    uint32_t last_tick;
+
+    // Quantised copies of the loop. The scheduler plays from the active
+    // one while the other is rebuilt.
+    struct looper_event play[2][LOOPER_MAX_EVENTS];
+    uint16_t play_count[2];
+
+    // Used by the scheduler callback. Only changed by the main loop while
+    // holding sched_lock().
+    uint8_t active;
+    uint16_t cursor;
+    uint32_t pass_start_tick; // Tick the current time round the loop started on
+    sched_handle_t pending;
+    uint64_t sounding;
+} g_looper;
+
+static inline uint8_t looper_before(const struct looper_event *a, const struct looper_event *b)
+{
+    return a->pos < b->pos || (a->pos == b->pos && a->type < b->type);
+}
+
+/*
+ * Insertion sort. Events are nearly always close to being in order
+ * already, so this is close to linear.
+ */
+static void looper_sort(struct looper_event *events, uint16_t count)
+{
+    for (uint16_t i = 1; i < count; i++) {
+        struct looper_event event = events[i];
+        uint16_t j = i;
+
+        while (j && looper_before(&event, &events[j - 1])) {
+            events[j] = events[j - 1];
+            j--;
+        }
+
+        events[j] = event;
+    }
+}
+
+/*
+ * Subticks from the clock's last tick to time_us. Kept within a tick
+ * either way, since the next tick may be late.
+ */
+static inline int32_t looper_subticks_since(const struct clock_position *position, uint32_t time_us)
+{
+    int32_t since = time_us - position->tick_us;
+    int32_t period = position->tick_period_us;
+
+    if (!period) {
+        return 0;
+    }
+
+    if (since >= period) {
+        return LOOPER_SUBTICKS - 1;
+    } else if (since <= -period) {
+        return 1 - LOOPER_SUBTICKS;
+    }
+
+    return ((int64_t) since * LOOPER_SUBTICKS) / period;
+}
+
+/*
+ * Position within the loop at time_us. While the first pass is being
+ * recorded the loop has no length yet, so this counts from its start.
+ */
+static uint32_t looper_pos(const struct clock_position *position, uint32_t time_us)
+{
+    int32_t sub = looper_subticks_since(position, time_us);
+
+    if (!g_looper.length) {
+        int32_t pos = (int32_t) (position->tick - g_looper.origin_tick) * LOOPER_SUBTICKS + sub;
+        return pos > 0 ? pos : 0;
+    }
+
+    uint32_t phase = (position->tick + g_looper.length_ticks - (g_looper.origin_tick % g_looper.length_ticks))
+        % g_looper.length_ticks;
+
+    return ((phase * LOOPER_SUBTICKS) + g_looper.length + sub) % g_looper.length;
+}
+
+static void looper_sched_callback(void *arg);
+
+/*
+ * Plays every event at the cursor's position and moves on to the next
+ */
+static void HOT_FUNC(looper_play_cursor)(void)
+{
+    const struct looper_event *play = g_looper.play[g_looper.active];
+    uint16_t count = g_looper.play_count[g_looper.active];
+    uint32_t pos = play[g_looper.cursor].pos;
+    uint64_t pressed = 0;
+    uint64_t released = 0;
+
+    while (g_looper.cursor < count && play[g_looper.cursor].pos == pos) {
+        const struct looper_event *event = &play[g_looper.cursor++];
+
+        switch (event->type) {
+            case LOOPER_EVENT_RELEASE:
+                released |= IO_KEY_BIT(event->key_id);
+                break;
+            case LOOPER_EVENT_PRESS:
+                pressed |= IO_KEY_BIT(event->key_id);
+                break;
+            case LOOPER_EVENT_OCTAVE:
+                g_looper.on_octave(event->octave_shift);
+                break;
+        }
+    }
+
+    if (g_looper.cursor >= count) {
+        g_looper.cursor = 0;
+        g_looper.pass_start_tick += g_looper.length_ticks;
+    }
+
+    released &= g_looper.sounding;
+    pressed &= ~(g_looper.sounding & ~released);
+    g_looper.sounding = (g_looper.sounding & ~released) | pressed;
+
+    if (pressed || released) {
+        g_looper.on_keys(pressed, released);
+    }
+}
+
+/*
+ * Schedules the event under the cursor. Events that are already due are
+ * played here rather than handed to the scheduler, so that pending never
+ * ends up holding the handle of an action that has already run.
+ */
+static void HOT_FUNC(looper_schedule_next)(void)
+{
+    while (g_looper.play_count[g_looper.active]) {
+        struct clock_position position;
+        clock_read_position(&position);
+
+        if (!position.running) {
+            return;
+        }
+
+        const struct looper_event *event = &g_looper.play[g_looper.active][g_looper.cursor];
+        int32_t delta = (int32_t) (g_looper.pass_start_tick - position.tick) * LOOPER_SUBTICKS + event->pos;
+        void *arg = 0;
+
+        if (delta > LOOPER_HORIZON_TICKS * LOOPER_SUBTICKS) {
+            delta = LOOPER_HORIZON_TICKS * LOOPER_SUBTICKS;
+            arg = LOOPER_WAKE_ONLY;
+        }
+
+        uint32_t due_us = position.tick_us + (int32_t) (((int64_t) delta * position.tick_period_us) / LOOPER_SUBTICKS);
+        uint64_t now = time_us_64();
+        int32_t wait_us = (int32_t) (due_us - (uint32_t) now);
+
+        if (wait_us > 0 || LOOPER_WAKE_ONLY == arg) {
+            g_looper.pending = sched_at(now + wait_us, looper_sched_callback, arg);
+            return;
+        }
+
+        // Each pass moves the cursor on, and a whole loop's worth takes it
+        // in to the future, so this ends
+        looper_play_cursor();
+    }
+}
+
+static void HOT_FUNC(looper_sched_callback)(void *arg)
+{
+    g_looper.pending = SCHED_INVALID_HANDLE;
+
+    if (LOOPER_WAKE_ONLY != arg) {
+        looper_play_cursor();
+    }
+
+    looper_schedule_next();
+}
+
+/*
+ * Lets go of everything playback is holding. Must hold sched_lock().
+ */
+static void looper_stop_playback(void)
+{
+    sched_cancel(g_looper.pending);
+    g_looper.pending = SCHED_INVALID_HANDLE;
+
+    if (g_looper.sounding) {
+        g_looper.on_keys(0, g_looper.sounding);
+        g_looper.sounding = 0;
+    }
+}
+
+/*
+ * Picks playback up from wherever the clock is now. Must hold
+ * sched_lock().
+ */
+static void looper_resync(void)
+{
+    sched_cancel(g_looper.pending);
+    g_looper.pending = SCHED_INVALID_HANDLE;
+
+    uint16_t count = g_looper.play_count[g_looper.active];
+    if (!count || !g_looper.length) {
+        return;
+    }
+
+    struct clock_position position;
+    clock_read_position(&position);
+
+    uint32_t pos = looper_pos(&position, time_us_32());
+    const struct looper_event *play = g_looper.play[g_looper.active];
+
+    g_looper.pass_start_tick = position.tick - (pos / LOOPER_SUBTICKS);
+    g_looper.cursor = 0;
+
+    while (g_looper.cursor < count && play[g_looper.cursor].pos < pos) {
+        g_looper.cursor++;
+    }
+
+    if (g_looper.cursor >= count) {
+        g_looper.cursor = 0;
+        g_looper.pass_start_tick += g_looper.length_ticks;
+    }
+
+    looper_schedule_next();
+}
+
+/*
+ * Makes a quantised copy of the loop and switches playback over to it
+ */
+static void looper_rebuild(void)
+{
+    uint8_t next = !g_looper.active;
+    struct looper_event *play = g_looper.play[next];
+    uint32_t grid = g_looper_grid_ticks[g_looper.grid] * LOOPER_SUBTICKS;
+    int32_t offsets[MAX_KEYBED_KEY + 1];
+
+    memcpy(play, g_looper.events, g_looper.num_events * sizeof(struct looper_event));
+
+    if (grid) {
+        memset(offsets, 0, sizeof(offsets));
+
+        // A release before the first press of its key in the loop belongs
+        // to the last press, from the time before
+        for (uint16_t i = 0; i < g_looper.num_events; i++) {
+            if (LOOPER_EVENT_PRESS == play[i].type) {
+                uint32_t pos = play[i].pos;
+                offsets[play[i].key_id] = (int32_t) (((pos + grid / 2) / grid) * grid) - (int32_t) pos;
+            }
+        }
+
+        for (uint16_t i = 0; i < g_looper.num_events; i++) {
+            struct looper_event *event = &play[i];
+            int32_t offset;
+
+            if (LOOPER_EVENT_RELEASE == event->type) {
+                offset = offsets[event->key_id];
+            } else {
+                offset = (int32_t) (((event->pos + grid / 2) / grid) * grid) - (int32_t) event->pos;
+                if (LOOPER_EVENT_PRESS == event->type) {
+                    offsets[event->key_id] = offset;
+                }
+            }
+
+            event->pos = (event->pos + g_looper.length + offset) % g_looper.length;
+        }
+
+        looper_sort(play, g_looper.num_events);
+    }
+
+    sched_lock();
+    g_looper.active = next;
+    g_looper.play_count[next] = g_looper.num_events;
+    looper_resync();
+    sched_unlock();
+}
+
+/*
+ * Appends an event to whatever is being recorded. Returns 0 on success.
+ */
+static int looper_add(uint8_t type, uint8_t key_id, int8_t octave_shift, uint32_t timestamp_us)
+{
+    struct clock_position position;
+    clock_read_position(&position);
+
+    struct looper_event *event;
+
+    if (LOOPER_RECORDING == g_looper.status) {
+        if (g_looper.num_events >= LOOPER_MAX_EVENTS) {
+            g_looper.dropped++;
+            return 1;
+        }
+
+        event = &g_looper.events[g_looper.num_events++];
+    } else if (LOOPER_OVERDUBBING == g_looper.status) {
+        if (g_looper.num_staged >= LOOPER_STAGING_EVENTS) {
+            g_looper.dropped++;
+            return 1;
+        }
+
+        event = &g_looper.staging[g_looper.num_staged++];
+    } else {
+        return 1;
+    }
+
+    event->pos = looper_pos(&position, timestamp_us);
+    event->type = type;
+    event->key_id = key_id;
+    event->octave_shift = octave_shift;
+
+    return 0;
+}
+
+/*
+ * Ends the recorded notes that are still held, so they don't hang
+ */
+static void looper_close_notes(uint32_t timestamp_us)
+{
+    for (uint64_t keys = g_looper.recording_keys; keys; keys &= keys - 1) {
+        looper_add(LOOPER_EVENT_RELEASE, __builtin_ctzll(keys), 0, timestamp_us);
+    }
+
+    g_looper.recording_keys = 0;
+}
+
+/*
+ * Merges the overdubs in to the loop
+ */
+static void looper_merge_staging(void)
+{
+    if (!g_looper.num_staged) {
+        return;
+    }
+
+    looper_sort(g_looper.staging, g_looper.num_staged);
+
+    uint16_t staged = g_looper.num_staged;
+    if (g_looper.num_events + staged > LOOPER_MAX_EVENTS) {
+        g_looper.dropped += g_looper.num_events + staged - LOOPER_MAX_EVENTS;
+        staged = LOOPER_MAX_EVENTS - g_looper.num_events;
+    }
+
+    // From the back, so it can be done in place
+    int32_t i = g_looper.num_events - 1;
+    int32_t j = staged - 1;
+    int32_t k = g_looper.num_events + staged - 1;
+
+    while (j >= 0) {
+        if (i >= 0 && looper_before(&g_looper.staging[j], &g_looper.events[i])) {
+            g_looper.events[k--] = g_looper.events[i--];
+        } else {
+            g_looper.events[k--] = g_looper.staging[j--];
+        }
+    }
+
+    g_looper.num_events += staged;
+    g_looper.num_staged = 0;
+
+    looper_rebuild();
+}
+
+static void looper_finish_recording(uint32_t end_pos, uint32_t timestamp_us)
+{
+    looper_close_notes(timestamp_us);
+
+    uint32_t bars = (end_pos + (LOOPER_BAR_TICKS * LOOPER_SUBTICKS) - 1) / (LOOPER_BAR_TICKS * LOOPER_SUBTICKS);
+    if (!bars) {
+        bars = 1;
+    } else if (bars > LOOPER_MAX_BARS) {
+        bars = LOOPER_MAX_BARS;
+    }
+
+    g_looper.length_ticks = bars * LOOPER_BAR_TICKS;
+    g_looper.length = g_looper.length_ticks * LOOPER_SUBTICKS;
+
+    // Anything that landed past the end, eg a release closing off a note
+    // when the maximum length was hit, goes to the last position
+    for (uint16_t i = 0; i < g_looper.num_events; i++) {
+        if (g_looper.events[i].pos >= g_looper.length) {
+            g_looper.events[i].pos = g_looper.length - 1;
+        }
+    }
+
+    looper_sort(g_looper.events, g_looper.num_events);
+
+    g_looper.status = LOOPER_PLAYING;
+    g_looper.last_pos = end_pos % g_looper.length;
+    looper_rebuild();
+}
+
+int looper_init(looper_keys_callback_t on_keys, looper_octave_callback_t on_octave)
+{
+    memset(&g_looper, 0, sizeof(struct looper_state));
+    g_looper.on_keys = on_keys;
+    g_looper.on_octave = on_octave;
+
+    return 0;
+}
+
+int looper_record_button(void)
+{
+    struct clock_position position;
+    clock_read_position(&position);
+
+    uint32_t now = time_us_32();
+
+    switch (g_looper.status) {
+        case LOOPER_EMPTY:
+            if (!position.running) {
+                return 1;
+            }
+
+            g_looper.origin_tick = position.tick - (position.tick % LOOPER_BAR_TICKS);
+            g_looper.length = 0;
+            g_looper.num_events = 0;
+            g_looper.recording_keys = 0;
+            g_looper.status = LOOPER_RECORDING;
+            break;
+        case LOOPER_RECORDING:
+            looper_finish_recording(looper_pos(&position, now), now);
+            break;
+        case LOOPER_PLAYING:
+            g_looper.num_staged = 0;
+            g_looper.recording_keys = 0;
+            g_looper.last_pos = looper_pos(&position, now);
+            g_looper.status = LOOPER_OVERDUBBING;
+            break;
+        case LOOPER_OVERDUBBING:
+            looper_close_notes(now);
+            g_looper.status = LOOPER_PLAYING;
+            looper_merge_staging();
+            break;
+    }
+
+    return 0;
+}
+
+void looper_clear(void)
+{
+    sched_lock();
+    looper_stop_playback();
+    g_looper.play_count[0] = 0;
+    g_looper.play_count[1] = 0;
+    sched_unlock();
+
+    g_looper.status = LOOPER_EMPTY;
+    g_looper.num_events = 0;
+    g_looper.num_staged = 0;
+    g_looper.length = 0;
+    g_looper.recording_keys = 0;
+}
+
+void looper_set_grid(uint8_t grid)
+{
+    if (grid >= LOOPER_NUM_GRIDS || grid == g_looper.grid) {
+        return;
+    }
+
+    g_looper.grid = grid;
+
+    if (g_looper.length) {
+        looper_rebuild();
+    }
+}
+
+uint8_t looper_get_grid(void)
+{
+    return g_looper.grid;
+}
+
+uint8_t looper_get_status(void)
+{
+    return g_looper.status;
+}
+
+void looper_record_keys(uint64_t pressed, uint64_t released, uint32_t timestamp_us)
+{
+    if (LOOPER_RECORDING != g_looper.status && LOOPER_OVERDUBBING != g_looper.status) {
+        return;
+    }
+
+    // Releases are only kept for presses that were recorded
+    for (uint64_t keys = released & g_looper.recording_keys; keys; keys &= keys - 1) {
+        uint32_t key_id = __builtin_ctzll(keys);
+
+        looper_add(LOOPER_EVENT_RELEASE, key_id, 0, timestamp_us);
+        g_looper.recording_keys &= ~IO_KEY_BIT(key_id);
+    }
+
+    for (uint64_t keys = pressed; keys; keys &= keys - 1) {
+        uint32_t key_id = __builtin_ctzll(keys);
+
+        if (!looper_add(LOOPER_EVENT_PRESS, key_id, 0, timestamp_us)) {
+            g_looper.recording_keys |= IO_KEY_BIT(key_id);
+        }
+    }
+}
+
+void looper_record_octave(int8_t octave_shift, uint32_t timestamp_us)
+{
+    looper_add(LOOPER_EVENT_OCTAVE, 0, octave_shift, timestamp_us);
+}
+
+uint64_t looper_sounding_keys(void)
+{
+    return g_looper.sounding;
+}
+
+void looper_task(void)
+{
+    struct clock_position position;
+    clock_read_position(&position);
+
+    uint32_t now = time_us_32();
+
+    if (position.running != g_looper.running || position.tick < g_looper.last_tick) {
+        // Started, stopped or rewound
+        g_looper.running = position.running;
+
+        if (LOOPER_RECORDING == g_looper.status) {
+            looper_finish_recording(g_looper.last_pos, now);
+        }
+
+        sched_lock();
+        if (position.running) {
+            looper_resync();
+        } else {
+            looper_stop_playback();
+        }
+        sched_unlock();
+    }
+
+    g_looper.last_tick = position.tick;
+
+    if (!position.running || LOOPER_EMPTY == g_looper.status) {
+        return;
+    }
+
+    uint32_t pos = looper_pos(&position, now);
+
+    if (LOOPER_RECORDING == g_looper.status) {
+        g_looper.last_pos = pos;
+
+        if (pos >= LOOPER_MAX_LENGTH) {
+            looper_finish_recording(pos, now);
+        }
+        return;
+    }
+
+    if (pos < g_looper.last_pos) {
+        // The loop came round
+        looper_merge_staging();
+    }
+
+    g_looper.last_pos = pos;
+}
+
+uint32_t looper_dropped(void)
+{
+    return g_looper.dropped;
+}
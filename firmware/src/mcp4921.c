@@ -1,6 +1,7 @@
 #include <math.h>
 #include <stdio.h>
 #include "mcp4921.h"
+#include "hot.h"
 
 static inline void cs_select(struct mcp4921 *mcp)
 {
@@ -23,6 +24,11 @@ int mcp4921_init(struct mcp4921* mcp)
     gpio_set_function(mcp->clk_pin, GPIO_FUNC_SPI);
     gpio_set_function(mcp->mosi_pin, GPIO_FUNC_SPI);
 
+    if (mcp->hw_cs) {
+        gpio_set_function(mcp->cs_pin, GPIO_FUNC_SPI);
+        return 0;
+    }
+
     gpio_init(mcp->cs_pin);
     gpio_set_dir(mcp->cs_pin, GPIO_OUT);
     gpio_put(mcp->cs_pin, 1);
@@ -30,19 +36,90 @@ int mcp4921_init(struct mcp4921* mcp)
     return 0;
 }
 
-int mcp4921_set_output(struct mcp4921 *dac, float volts)
+/*
+ * Builds the word for a channel, ignoring whichever channel is
+ * selected in cmd_flags
+ */
+static inline uint16_t mcp4921_word(struct mcp4921 *dac, uint8_t channel, uint16_t code)
+{
+    uint8_t flags = (dac->cmd_flags & 0b0111) | (channel << 3);
+
+    if (code > MCP4921_MAX_VAL) {
+        code = MCP4921_MAX_VAL;
+    }
+
+    return (flags << 12) | code;
+}
+
+static inline void mcp4921_write(struct mcp4921 *dac, const uint16_t *words, size_t len)
+{
+    if (dac->hw_cs) {
+        spi_write16_blocking(dac->spi_inst, words, len);
+        return;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        cs_select(dac);
+        spi_write16_blocking(dac->spi_inst, &words[i], 1);
+        cs_deselect(dac);
+    }
+}
+
+uint16_t mcp4921_volts_to_code(struct mcp4921 *dac, float volts)
 {
     unsigned int gain = mcp4921_get_gain(dac) == MCP4921_GAIN_1X ? 1 : 2;
     float dac_value = floor((MCP4921_MAX_VAL * volts) / (dac->refv * gain));
 
-    uint16_t dac_out = (dac->cmd_flags << 12) | (uint16_t) dac_value;
-    cs_select(dac);
-    int bytes_written = spi_write16_blocking(
-        dac->spi_inst,
-        &dac_out,
-        1
-    );
-    cs_deselect(dac);
+    if (dac_value < 0) {
+        return 0;
+    }
+
+    if (dac_value > MCP4921_MAX_VAL) {
+        return MCP4921_MAX_VAL;
+    }
+
+    return (uint16_t) dac_value;
+}
+
+int HOT_FUNC(mcp4921_set_code)(struct mcp4921 *dac, uint8_t channel, uint16_t code)
+{
+    uint16_t word = mcp4921_word(dac, channel, code);
+    mcp4921_write(dac, &word, 1);
+
+    return 0;
+}
+
+int HOT_FUNC(mcp4921_set_codes)(struct mcp4921 *dac, uint16_t code_a, uint16_t code_b)
+{
+    uint16_t words[2] = {
+        mcp4921_word(dac, MCP4921_DAC_A, code_a),
+        mcp4921_word(dac, MCP4921_DAC_B, code_b)
+    };
+    mcp4921_write(dac, words, 2);
+
+    return 0;
+}
+
+int HOT_FUNC(mcp4921_queue_code)(struct mcp4921 *dac, uint8_t channel, uint16_t code)
+{
+    if (!dac->hw_cs || !spi_is_writable(dac->spi_inst)) {
+        return 1;
+    }
+
+    // Nothing reads back what was clocked in, so keep it from overrunning
+    while (spi_is_readable(dac->spi_inst)) {
+        (void) spi_get_hw(dac->spi_inst)->dr;
+    }
+
+    spi_get_hw(dac->spi_inst)->dr = mcp4921_word(dac, channel, code);
+
+    return 0;
+}
+
+int HOT_FUNC(mcp4921_set_output)(struct mcp4921 *dac, float volts)
+{
+    uint16_t dac_out = (dac->cmd_flags << 12) | mcp4921_volts_to_code(dac, volts);
+    mcp4921_write(dac, &dac_out, 1);
 
     return 0;
 }
@@ -0,0 +1,46 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "midi.h"
+
+int midi_batch_add(struct midi_batch *batch, uint8_t cable, uint8_t status, uint8_t data1, uint8_t data2)
+{
+    if (batch->count >= MIDI_BATCH_SIZE) {
+        batch->dropped++;
+        return -1;
+    }
+
+    uint8_t *packet = batch->packets[batch->count++];
+
+    // For channel voice messages the code index number is just the
+    // upper nibble of the status byte
+    packet[0] = ((cable & 0x0f) << 4) | (status >> 4);
+    packet[1] = status;
+    packet[2] = data1 & MIDI_MAX_DATA;
+    packet[3] = data2 & MIDI_MAX_DATA;
+
+    return 0;
+}
+
+uint32_t midi_batch_flush(struct midi_batch *batch, midi_packet_writer_t writer)
+{
+    if (!batch->count) {
+        return 0;
+    }
+
+    uint32_t written = writer((const uint8_t (*)[MIDI_PACKET_LEN]) batch->packets, batch->count);
+    if (written >= batch->count) {
+        batch->count = 0;
+        return written;
+    }
+
+    // Keep whatever didn't fit at the front of the batch
+    memmove(
+        batch->packets,
+        batch->packets[written],
+        (batch->count - written) * MIDI_PACKET_LEN
+    );
+    batch->count -= written;
+
+    return written;
+}
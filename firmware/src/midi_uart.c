@@ -0,0 +1,148 @@
+#include <stdint.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/uart.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+#include "hardware_config.h"
+#include "clock.h"
+#include "hot.h"
+#include "midi_uart.h"
+
+// Framing, parity, break and overrun flags in the data register
+#define MIDI_UART_DR_ERROR_BITS 0xf00
+
+struct midi_uart_state {
+    uint8_t tx_buf[MIDI_UART_TX_BUF_SIZE];
+    uint32_t tx_head;
+    uint32_t tx_tail;
+    struct midi_uart_stats stats;
+} g_midi_uart;
+
+/*
+ * Moves as much of the software buffer in to the UART as will fit, and
+ * only leaves the TX interrupt enabled if there is more to send.
+ * Called with interrupts disabled or from the UART interrupt.
+ */
+static inline void midi_uart_fill_tx(void)
+{
+    uart_hw_t *hw = uart_get_hw(MIDI_UART);
+
+    while (g_midi_uart.tx_tail != g_midi_uart.tx_head && uart_is_writable(MIDI_UART)) {
+        hw->dr = g_midi_uart.tx_buf[g_midi_uart.tx_tail++ & (MIDI_UART_TX_BUF_SIZE - 1)];
+    }
+
+    uart_set_irq_enables(MIDI_UART, true, g_midi_uart.tx_tail != g_midi_uart.tx_head);
+}
+
+/*
+ * Only system real time messages matter to us, and they can show up in
+ * the middle of any other message, so there is no need to track running
+ * status. Everything else is skipped.
+ */
+static inline void midi_uart_parse(uint8_t byte)
+{
+    switch (byte) {
+        case MIDI_CLOCK:
+            g_midi_uart.stats.rx_clocks++;
+            clock_ext_pulse(CLOCK_SRC_MIDI);
+            break;
+        case MIDI_START:
+            clock_ext_transport(CLOCK_SRC_MIDI, CLOCK_START);
+            break;
+        case MIDI_CONTINUE:
+            clock_ext_transport(CLOCK_SRC_MIDI, CLOCK_CONTINUE);
+            break;
+        case MIDI_STOP:
+            clock_ext_transport(CLOCK_SRC_MIDI, CLOCK_STOP);
+            break;
+        default:
+            break;
+    }
+}
+
+static void HOT_FUNC(midi_uart_irq_handler)(void)
+{
+    uart_hw_t *hw = uart_get_hw(MIDI_UART);
+
+    // Take everything that's there, in case the interrupt was held off
+    // for more than a byte
+    while (uart_is_readable(MIDI_UART)) {
+        uint32_t dr = hw->dr;
+        g_midi_uart.stats.rx_bytes++;
+
+        if (dr & MIDI_UART_DR_ERROR_BITS) {
+            g_midi_uart.stats.rx_errors++;
+            continue;
+        }
+
+        midi_uart_parse(dr & 0xff);
+    }
+
+    midi_uart_fill_tx();
+}
+
+static void HOT_FUNC(midi_uart_clock_listener)(uint8_t event, uint32_t tick)
+{
+    switch (event) {
+        case CLOCK_TICK:
+            midi_uart_send(MIDI_CLOCK);
+            break;
+        case CLOCK_START:
+            midi_uart_send(MIDI_START);
+            break;
+        case CLOCK_CONTINUE:
+            midi_uart_send(MIDI_CONTINUE);
+            break;
+        case CLOCK_STOP:
+            midi_uart_send(MIDI_STOP);
+            break;
+    }
+}
+
+int midi_uart_init(void)
+{
+    memset(&g_midi_uart, 0, sizeof(struct midi_uart_state));
+
+    uart_init(MIDI_UART, MIDI_UART_BAUD);
+    uart_set_format(MIDI_UART, 8, 1, UART_PARITY_NONE);
+    uart_set_hw_flow(MIDI_UART, false, false);
+    // The lowest RX FIFO trigger level is 4 bytes, so with the FIFOs on a
+    // lone clock byte waits for the receive timeout (32 bit periods, about
+    // 1ms) before it's seen. Without them every byte interrupts straight
+    // away, and at 31250 baud there are 320us to take each one.
+    uart_set_fifo_enabled(MIDI_UART, false);
+    gpio_set_function(MIDI_TX_PIN, GPIO_FUNC_UART);
+    gpio_set_function(MIDI_RX_PIN, GPIO_FUNC_UART);
+
+    irq_set_exclusive_handler(MIDI_UART_IRQ, midi_uart_irq_handler);
+    irq_set_enabled(MIDI_UART_IRQ, true);
+    uart_set_irq_enables(MIDI_UART, true, false);
+
+    return clock_add_listener(midi_uart_clock_listener);
+}
+
+void midi_uart_resume(void)
+{
+    irq_set_enabled(MIDI_UART_IRQ, true);
+}
+
+void HOT_FUNC(midi_uart_send)(uint8_t byte)
+{
+    uint32_t irq_state = save_and_disable_interrupts();
+
+    if (g_midi_uart.tx_head - g_midi_uart.tx_tail >= MIDI_UART_TX_BUF_SIZE) {
+        g_midi_uart.stats.tx_dropped++;
+    } else {
+        g_midi_uart.tx_buf[g_midi_uart.tx_head++ & (MIDI_UART_TX_BUF_SIZE - 1)] = byte;
+        midi_uart_fill_tx();
+    }
+
+    restore_interrupts(irq_state);
+}
+
+const struct midi_uart_stats *midi_uart_get_stats(void)
+{
+    return &g_midi_uart.stats;
+}
@@ -0,0 +1,71 @@
+#include <stdint.h>
+#include "pico/stdlib.h"
+
+#include "hardware_config.h"
+#include "io.h"
+#include "mcp4921.h"
+#include "scale.h"
+#include "tuning.h"
+
+// Bit n is set if the note n semitones above the root is in the scale
+static const uint16_t g_scale_masks[SCALE_NUM_SCALES] = {
+    [SCALE_CHROMATIC] = 0xfff,
+    [SCALE_MAJOR] = 0xab5,
+    [SCALE_DORIAN] = 0x6ad,
+    [SCALE_PHRYGIAN] = 0x5ab,
+    [SCALE_LYDIAN] = 0xad5,
+    [SCALE_MIXOLYDIAN] = 0x6b5,
+    [SCALE_MINOR] = 0x5ad,
+    [SCALE_LOCRIAN] = 0x56b,
+    [SCALE_HARMONIC_MINOR] = 0x9ad,
+    [SCALE_PENTATONIC_MAJOR] = 0x295,
+    [SCALE_PENTATONIC_MINOR] = 0x4a9,
+};
+
+static inline uint8_t scale_has_degree(uint16_t mask, int16_t degree)
+{
+    return (mask >> (((degree % 12) + 12) % 12)) & 1;
+}
+
+int16_t scale_quantise(const struct scale_config *config, int16_t semitone)
+{
+    uint16_t mask = g_scale_masks[config->scale < SCALE_NUM_SCALES ? config->scale : SCALE_CHROMATIC];
+    int16_t degree = semitone - config->root;
+
+    for (int16_t offset = 0; offset < 12; offset++) {
+        if (scale_has_degree(mask, degree - offset)) {
+            return semitone - offset;
+        }
+
+        if (scale_has_degree(mask, degree + offset)) {
+            return semitone + offset;
+        }
+    }
+
+    return semitone;
+}
+
+void scale_build_table(const struct scale_config *config, const struct tuning *tuning,
+                       struct mcp4921 *dac, struct scale_table *table)
+{
+    uint16_t code = 0;
+
+    table->codes[KEY_NONE] = 0;
+
+    for (uint8_t key = KEY_C1; key < SCALE_TABLE_SIZE; key++) {
+        int16_t step = key - KEY_C1;
+
+        // Scales are only defined over twelve notes
+        if (12 == tuning->num_degrees) {
+            step = scale_quantise(config, step);
+        }
+
+        float cv;
+        if (!tuning_note_volts(tuning, TUNING_KEY_C1_NOTE + step + config->transpose, &cv)) {
+            code = mcp4921_volts_to_code(dac, (cv + config->octave_shift) / CV_OPAMP_GAIN);
+        }
+
+        // Unmapped keys play the same note as the key below them
+        table->codes[key] = code;
+    }
+}
@@ -0,0 +1,300 @@
+#include <stdint.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/timer.h"
+#include "hardware/sync.h"
+#include "hardware/irq.h"
+
+#include "hot.h"
+#include "sched.h"
+
+#define SCHED_NO_POS 0xff
+
+struct sched_action {
+    uint64_t due_us;
+    sched_callback_t callback;
+    void *arg;
+    uint16_t generation; // Bumped every time the slot is reused
+    uint8_t heap_pos; // SCHED_NO_POS when the slot is free
+};
+
+struct sched_state {
+    struct sched_action actions[SCHED_MAX_ACTIONS];
+    // Min-heap of indices in to actions, ordered by due time
+    uint8_t heap[SCHED_MAX_ACTIONS];
+    uint8_t heap_len;
+    // Stack of free indices in to actions
+    uint8_t free_list[SCHED_MAX_ACTIONS];
+    uint8_t free_len;
+    uint alarm_num;
+    uint8_t lock_depth;
+    uint8_t running; // In sched_run_due()
+    struct sched_stats stats;
+} g_sched;
+
+static inline uint8_t sched_before(uint8_t a, uint8_t b)
+{
+    return g_sched.actions[a].due_us < g_sched.actions[b].due_us;
+}
+
+static inline void sched_heap_set(uint8_t pos, uint8_t idx)
+{
+    g_sched.heap[pos] = idx;
+    g_sched.actions[idx].heap_pos = pos;
+}
+
+static void HOT_FUNC(sched_sift_up)(uint8_t pos)
+{
+    uint8_t idx = g_sched.heap[pos];
+
+    while (pos) {
+        uint8_t parent = (pos - 1) / 2;
+        if (!sched_before(idx, g_sched.heap[parent])) {
+            break;
+        }
+
+        sched_heap_set(pos, g_sched.heap[parent]);
+        pos = parent;
+    }
+
+    sched_heap_set(pos, idx);
+}
+
+static void HOT_FUNC(sched_sift_down)(uint8_t pos)
+{
+    uint8_t idx = g_sched.heap[pos];
+
+    while (true) {
+        uint8_t child = 2 * pos + 1;
+        if (child >= g_sched.heap_len) {
+            break;
+        }
+
+        if (child + 1 < g_sched.heap_len && sched_before(g_sched.heap[child + 1], g_sched.heap[child])) {
+            child++;
+        }
+
+        if (!sched_before(g_sched.heap[child], idx)) {
+            break;
+        }
+
+        sched_heap_set(pos, g_sched.heap[child]);
+        pos = child;
+    }
+
+    sched_heap_set(pos, idx);
+}
+
+/*
+ * Takes an action out of the heap and returns its slot to the pool
+ */
+static void HOT_FUNC(sched_remove)(uint8_t idx)
+{
+    uint8_t pos = g_sched.actions[idx].heap_pos;
+    uint8_t last = g_sched.heap[--g_sched.heap_len];
+
+    g_sched.actions[idx].heap_pos = SCHED_NO_POS;
+    g_sched.actions[idx].generation++;
+    g_sched.free_list[g_sched.free_len++] = idx;
+
+    if (last == idx) {
+        return;
+    }
+
+    // Fill the hole with the last element and restore the heap property
+    // in whichever direction it's broken
+    sched_heap_set(pos, last);
+    if (pos && sched_before(last, g_sched.heap[(pos - 1) / 2])) {
+        sched_sift_up(pos);
+    } else {
+        sched_sift_down(pos);
+    }
+}
+
+static inline void sched_record_lateness(uint64_t due_us, uint64_t now_us)
+{
+    uint32_t late = now_us > due_us ? now_us - due_us : 0;
+    uint8_t bucket = 0;
+
+    if (late) {
+        bucket = 32 - __builtin_clz(late);
+        if (bucket >= SCHED_LATENESS_BUCKETS) {
+            bucket = SCHED_LATENESS_BUCKETS - 1;
+        }
+    }
+
+    g_sched.stats.lateness[bucket]++;
+    if (late > g_sched.stats.max_lateness_us) {
+        g_sched.stats.max_lateness_us = late;
+    }
+}
+
+/*
+ * Runs everything that is due, in timestamp order, and points the
+ * hardware alarm at the earliest action left. Must be called with
+ * interrupts disabled and returns with them restored to irq_state. Each
+ * action is taken out of the heap with them disabled, but its callback
+ * runs with them restored, so a slow callback only holds up the actions
+ * behind it rather than the rest of core0. Actions that the callbacks
+ * schedule are picked up by the same loop.
+ *
+ * The SDK drops the interrupt for a target that has already passed
+ * rather than raising it, so a miss goes round again here, the same as
+ * alarm_pool does. Nothing is run while the main loop holds sched_lock(),
+ * sched_unlock() comes back here instead, or while a call further up the
+ * stack is already in this loop, which sets the alarm once it's done.
+ */
+static void HOT_FUNC(sched_run)(uint32_t irq_state)
+{
+    if (g_sched.running) {
+        restore_interrupts(irq_state);
+        return;
+    }
+
+    g_sched.running = 1;
+
+    while (g_sched.heap_len) {
+        uint8_t idx = g_sched.heap[0];
+        struct sched_action *action = &g_sched.actions[idx];
+        uint64_t now = time_us_64();
+
+        if (g_sched.lock_depth || action->due_us > now + SCHED_MIN_DELAY_US) {
+            if (!hardware_alarm_set_target(g_sched.alarm_num, from_us_since_boot(action->due_us)) || g_sched.lock_depth) {
+                break;
+            }
+
+            continue;
+        }
+
+        sched_callback_t callback = action->callback;
+        void *arg = action->arg;
+        sched_record_lateness(action->due_us, now);
+        sched_remove(idx);
+        g_sched.stats.fired++;
+
+        restore_interrupts(irq_state);
+        callback(arg);
+        irq_state = save_and_disable_interrupts();
+    }
+
+    if (!g_sched.heap_len) {
+        hardware_alarm_cancel(g_sched.alarm_num);
+    }
+
+    g_sched.running = 0;
+    restore_interrupts(irq_state);
+}
+
+static void HOT_FUNC(sched_alarm_callback)(uint alarm_num)
+{
+    sched_run(save_and_disable_interrupts());
+}
+
+int sched_init(void)
+{
+    memset(&g_sched, 0, sizeof(struct sched_state));
+
+    for (uint8_t i = 0; i < SCHED_MAX_ACTIONS; i++) {
+        g_sched.actions[i].heap_pos = SCHED_NO_POS;
+        g_sched.actions[i].generation = 1;
+        g_sched.free_list[i] = SCHED_MAX_ACTIONS - 1 - i;
+    }
+    g_sched.free_len = SCHED_MAX_ACTIONS;
+
+    int alarm_num = hardware_alarm_claim_unused(false);
+    if (alarm_num < 0) {
+        return 1;
+    }
+
+    g_sched.alarm_num = alarm_num;
+    hardware_alarm_set_callback(g_sched.alarm_num, sched_alarm_callback);
+
+    return 0;
+}
+
+sched_handle_t HOT_FUNC(sched_at)(uint64_t time_us, sched_callback_t callback, void *arg)
+{
+    uint32_t irq_state = save_and_disable_interrupts();
+
+    if (!g_sched.free_len) {
+        g_sched.stats.dropped++;
+        restore_interrupts(irq_state);
+        return SCHED_INVALID_HANDLE;
+    }
+
+    uint8_t idx = g_sched.free_list[--g_sched.free_len];
+    struct sched_action *action = &g_sched.actions[idx];
+    action->due_us = time_us;
+    action->callback = callback;
+    action->arg = arg;
+
+    uint8_t pos = g_sched.heap_len++;
+    sched_heap_set(pos, idx);
+    sched_sift_up(pos);
+
+    // Taken before it can run, after which the handle is stale
+    sched_handle_t handle = ((uint32_t) action->generation << 8) | (idx + 1);
+
+    if (0 == action->heap_pos) {
+        // New earliest action, which runs now if it's already due
+        sched_run(irq_state);
+    } else {
+        restore_interrupts(irq_state);
+    }
+
+    return handle;
+}
+
+uint8_t HOT_FUNC(sched_cancel)(sched_handle_t handle)
+{
+    uint8_t idx = (handle & 0xff) - 1;
+    uint16_t generation = handle >> 8;
+
+    if (SCHED_INVALID_HANDLE == handle || idx >= SCHED_MAX_ACTIONS) {
+        return 0;
+    }
+
+    uint32_t irq_state = save_and_disable_interrupts();
+    struct sched_action *action = &g_sched.actions[idx];
+
+    if (action->generation != generation || SCHED_NO_POS == action->heap_pos) {
+        restore_interrupts(irq_state);
+        return 0;
+    }
+
+    uint8_t was_first = 0 == action->heap_pos;
+    sched_remove(idx);
+
+    if (was_first) {
+        sched_run(irq_state);
+    } else {
+        restore_interrupts(irq_state);
+    }
+
+    return 1;
+}
+
+void sched_get_stats(struct sched_stats *stats)
+{
+    uint32_t irq_state = save_and_disable_interrupts();
+    memcpy(stats, &g_sched.stats, sizeof(struct sched_stats));
+    restore_interrupts(irq_state);
+}
+
+void sched_lock(void)
+{
+    if (!g_sched.lock_depth++) {
+        irq_set_enabled(TIMER_IRQ_0 + g_sched.alarm_num, false);
+    }
+}
+
+void sched_unlock(void)
+{
+    if (!--g_sched.lock_depth) {
+        irq_set_enabled(TIMER_IRQ_0 + g_sched.alarm_num, true);
+
+        // Anything that came due in the meantime runs now. Targets that
+        // were missed while locked don't leave an interrupt pending.
+        sched_run(save_and_disable_interrupts());
+    }
+}
@@ -0,0 +1,88 @@
+#include <stdint.h>
+#include <string.h>
+#include "pico/stdlib.h"
+
+#include "clock.h"
+#include "kvstore.h"
+#include "latch.h"
+#include "lfo.h"
+#include "looper.h"
+#include "scale.h"
+#include "settings.h"
+#include "sync_out.h"
+#include "tuning.h"
+#include "voice.h"
+
+// Every value that can be stored at once, plus the biggest one being
+// rewritten, has to fit in a single page of the store
+#define SETTINGS_KV_WORST_CASE \
+    (KV_RECORD_SIZE(sizeof(struct settings)) \
+    + (TUNING_NUM_SLOTS - 1) * KV_RECORD_SIZE(sizeof(struct tuning)) \
+    + KV_PATTERN_SLOTS * KV_RECORD_SIZE(KV_PATTERN_MAX_LEN) \
+    + KV_RECORD_SIZE(KV_MAX_VALUE_LEN))
+
+_Static_assert(SETTINGS_KV_WORST_CASE <= KV_PAGE_CAPACITY, "stored values don't fit in a kvstore page");
+
+struct settings_state {
+    uint8_t dirty;
+    uint64_t changed_us;
+} g_settings;
+
+void settings_defaults(struct settings *settings)
+{
+    memset(settings, 0, sizeof(struct settings));
+    settings->octave_shift = 0;
+    settings->voice_mode = VOICE_MODE_MONO;
+    settings->sync_in_ppqn = CLOCK_SYNC_IN_DEFAULT_PPQN;
+    settings->gate_time = 0;
+    settings->scale = SCALE_CHROMATIC;
+    settings->scale_root = 0;
+    settings->transpose = 0;
+    settings->tuning = TUNING_12TET;
+    settings->latch_mode = LATCH_MODE_REPLACE;
+    settings->sync_out_ppqn = SYNC_OUT_DEFAULT_PPQN;
+    settings->sync_out_width_us = SYNC_OUT_DEFAULT_WIDTH_US;
+    settings->sync_out_thru = 0;
+    settings->looper_grid = LOOPER_GRID_OFF;
+    settings->steps_per_quarter = CLOCK_DEFAULT_STEPS_PER_QUARTER;
+    settings->swing = CLOCK_MIN_SWING;
+    settings->groove = CLOCK_GROOVE_STRAIGHT;
+    settings->lfo_shape = LFO_SHAPE_OFF;
+    settings->lfo_sync = 0;
+    settings->lfo_rate_mhz = LFO_DEFAULT_RATE_MHZ;
+    settings->lfo_division = LFO_DIV_1_BAR;
+    settings->lfo_depth = LFO_DEFAULT_DEPTH;
+}
+
+int settings_load(struct settings *settings)
+{
+    memset(&g_settings, 0, sizeof(struct settings_state));
+    settings_defaults(settings);
+
+    if (kv_init()) {
+        return 1;
+    }
+
+    // Missing or short records just leave the defaults in place
+    kv_read(KV_KEY_SETTINGS, settings, sizeof(struct settings));
+
+    return 0;
+}
+
+void settings_changed(void)
+{
+    g_settings.dirty = 1;
+    g_settings.changed_us = time_us_64();
+}
+
+uint8_t settings_save_due(void)
+{
+    return g_settings.dirty && time_us_64() - g_settings.changed_us >= SETTINGS_SAVE_DELAY_US;
+}
+
+int settings_save(const struct settings *settings)
+{
+    g_settings.dirty = 0;
+
+    return kv_write(KV_KEY_SETTINGS, settings, sizeof(struct settings));
+}
@@ -0,0 +1,255 @@
+#include <stdint.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "hardware/pio.h"
+#include "hardware/clocks.h"
+
+#include "hardware_config.h"
+#include "clock.h"
+#include "hot.h"
+#include "sync_out.h"
+#include "sync_out.pio.h"
+
+#define SYNC_OUT_PIO pio0
+
+// Cycles sync_out_clock spends on each count outside of its loops
+#define SYNC_OUT_CYCLE_OVERHEAD 2
+
+// Two words per pulse, and up to two pulses per tick
+#define SYNC_OUT_WORDS_PER_TICK 4
+
+// The TX FIFO is joined with the RX FIFO, which nothing uses
+#define SYNC_OUT_FIFO_DEPTH 8
+
+struct sync_out_state {
+    uint sm;
+    uint clock_offset;
+    uint thru_offset;
+    uint32_t cycles_per_us;
+
+    // Written by core0, read by core1
+    volatile uint8_t ppqn;
+    volatile uint16_t width_us;
+    volatile uint8_t thru;
+
+    // Only touched by the clock listener on core1
+    uint8_t stopped;
+    uint32_t dropped;
+} g_sync_out;
+
+static inline uint32_t sync_out_cycles(uint32_t us)
+{
+    uint32_t cycles = us * g_sync_out.cycles_per_us;
+    return cycles > SYNC_OUT_CYCLE_OVERHEAD ? cycles - SYNC_OUT_CYCLE_OVERHEAD : 0;
+}
+
+static inline void HOT_FUNC(sync_out_push_pulse)(uint32_t delay_us, uint32_t width_us)
+{
+    pio_sm_put(SYNC_OUT_PIO, g_sync_out.sm, sync_out_cycles(delay_us));
+    pio_sm_put(SYNC_OUT_PIO, g_sync_out.sm, sync_out_cycles(width_us));
+}
+
+/*
+ * One pulse per step. Swing can bring a step in as little as half a step
+ * after the last one, so the width is cut to a quarter of a straight step.
+ */
+static inline void HOT_FUNC(sync_out_step)(void)
+{
+    uint32_t step_us = (clock_get_tick_period_us() * CLOCK_PPQN) / clock_get_steps_per_quarter();
+    uint32_t width_us = g_sync_out.width_us;
+
+    if (width_us > step_us / 4) {
+        width_us = step_us / 4;
+    }
+
+    if (pio_sm_get_tx_fifo_level(SYNC_OUT_PIO, g_sync_out.sm) > SYNC_OUT_FIFO_DEPTH - SYNC_OUT_WORDS_PER_TICK) {
+        g_sync_out.dropped++;
+        return;
+    }
+
+    sync_out_push_pulse(0, width_us);
+}
+
+static void HOT_FUNC(sync_out_clock_listener)(uint8_t event, uint32_t tick)
+{
+    switch (event) {
+        case CLOCK_TICK:
+            break;
+        case CLOCK_STEP:
+            if (SYNC_OUT_PPQN_STEPS == g_sync_out.ppqn && !g_sync_out.stopped && !g_sync_out.thru) {
+                sync_out_step();
+            }
+            return;
+        case CLOCK_STOP:
+            g_sync_out.stopped = 1;
+            return;
+        case CLOCK_START:
+        case CLOCK_CONTINUE:
+            g_sync_out.stopped = 0;
+            return;
+        default:
+            return;
+    }
+
+    if (g_sync_out.stopped || g_sync_out.thru) {
+        return;
+    }
+
+    uint8_t ppqn = g_sync_out.ppqn;
+    if (SYNC_OUT_PPQN_STEPS == ppqn) {
+        return;
+    }
+
+    uint32_t tick_period_us = clock_get_tick_period_us();
+    uint32_t period_us = (tick_period_us * CLOCK_PPQN) / ppqn;
+    uint32_t width_us = g_sync_out.width_us;
+
+    if (width_us > period_us / 2) {
+        width_us = period_us / 2;
+    }
+
+    if (ppqn <= CLOCK_PPQN && tick % (CLOCK_PPQN / ppqn)) {
+        return;
+    }
+
+    if (pio_sm_get_tx_fifo_level(SYNC_OUT_PIO, g_sync_out.sm) > SYNC_OUT_FIFO_DEPTH - SYNC_OUT_WORDS_PER_TICK) {
+        g_sync_out.dropped++;
+        return;
+    }
+
+    sync_out_push_pulse(0, width_us);
+
+    if (ppqn > CLOCK_PPQN) {
+        // The delay counts from the end of the first pulse
+        sync_out_push_pulse(period_us - width_us, width_us);
+    }
+}
+
+/*
+ * Restarts the state machine with the program for the current mode
+ */
+static void sync_out_start(void)
+{
+    uint sm = g_sync_out.sm;
+    uint offset;
+    pio_sm_config config;
+
+    pio_sm_set_enabled(SYNC_OUT_PIO, sm, false);
+
+    if (g_sync_out.thru) {
+        offset = g_sync_out.thru_offset;
+        config = sync_out_thru_program_get_default_config(offset);
+        sm_config_set_in_pins(&config, SYNC_IN_PIN);
+    } else {
+        offset = g_sync_out.clock_offset;
+        config = sync_out_clock_program_get_default_config(offset);
+        sm_config_set_out_shift(&config, false, false, 32);
+        sm_config_set_fifo_join(&config, PIO_FIFO_JOIN_TX);
+    }
+
+    sm_config_set_set_pins(&config, SYNC_OUT_PIN, 1);
+    pio_sm_init(SYNC_OUT_PIO, sm, offset, &config);
+
+    // Start out low
+    pio_sm_set_pins_with_mask(SYNC_OUT_PIO, sm, 0, 1u << SYNC_OUT_PIN);
+    pio_sm_set_enabled(SYNC_OUT_PIO, sm, true);
+}
+
+int sync_out_init(void)
+{
+    memset(&g_sync_out, 0, sizeof(struct sync_out_state));
+    g_sync_out.ppqn = SYNC_OUT_DEFAULT_PPQN;
+    g_sync_out.width_us = SYNC_OUT_DEFAULT_WIDTH_US;
+    g_sync_out.cycles_per_us = clock_get_hz(clk_sys) / 1000000;
+
+    int sm = pio_claim_unused_sm(SYNC_OUT_PIO, false);
+    if (sm < 0) {
+        return 1;
+    }
+
+    if (!pio_can_add_program(SYNC_OUT_PIO, &sync_out_clock_program)) {
+        return 1;
+    }
+    g_sync_out.clock_offset = pio_add_program(SYNC_OUT_PIO, &sync_out_clock_program);
+
+    if (!pio_can_add_program(SYNC_OUT_PIO, &sync_out_thru_program)) {
+        return 1;
+    }
+    g_sync_out.thru_offset = pio_add_program(SYNC_OUT_PIO, &sync_out_thru_program);
+
+    g_sync_out.sm = sm;
+
+    pio_gpio_init(SYNC_OUT_PIO, SYNC_OUT_PIN);
+    gpio_pull_down(SYNC_OUT_PIN);
+    pio_sm_set_consecutive_pindirs(SYNC_OUT_PIO, sm, SYNC_OUT_PIN, 1, true);
+
+    sync_out_start();
+
+    return clock_add_listener(sync_out_clock_listener);
+}
+
+int sync_out_set_ppqn(uint8_t ppqn)
+{
+    switch (ppqn) {
+        case SYNC_OUT_PPQN_STEPS:
+        case 1:
+        case 2:
+        case 4:
+        case 24:
+        case 48:
+            g_sync_out.ppqn = ppqn;
+            return 0;
+    }
+
+    return 1;
+}
+
+uint8_t sync_out_get_ppqn(void)
+{
+    return g_sync_out.ppqn;
+}
+
+void sync_out_set_width_us(uint16_t width_us)
+{
+    if (width_us < SYNC_OUT_MIN_WIDTH_US) {
+        width_us = SYNC_OUT_MIN_WIDTH_US;
+    } else if (width_us > SYNC_OUT_MAX_WIDTH_US) {
+        width_us = SYNC_OUT_MAX_WIDTH_US;
+    }
+
+    g_sync_out.width_us = width_us;
+}
+
+uint16_t sync_out_get_width_us(void)
+{
+    return g_sync_out.width_us;
+}
+
+void sync_out_set_thru(uint8_t thru)
+{
+    thru = thru ? 1 : 0;
+    if (thru == g_sync_out.thru) {
+        return;
+    }
+
+    // core1 checks this before queueing a pulse. Anything it queued for
+    // the old program is dropped by the restart.
+    g_sync_out.thru = thru;
+    sync_out_start();
+}
+
+uint8_t sync_out_get_thru(void)
+{
+    return g_sync_out.thru;
+}
+
+uint32_t sync_out_thru_delay_ns(void)
+{
+    return (SYNC_OUT_THRU_DELAY_CYCLES * 1000) / g_sync_out.cycles_per_us;
+}
+
+uint32_t sync_out_dropped(void)
+{
+    return g_sync_out.dropped;
+}
@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+#include "trace.h"
+
+struct trace_ring g_trace[2];
+
+// Overflow counts that have already been reported by trace_drain()
+static uint32_t g_reported_overflows[2];
+
+void trace_init(void)
+{
+    memset(g_trace, 0, sizeof(g_trace));
+    memset(g_reported_overflows, 0, sizeof(g_reported_overflows));
+}
+
+/*
+ * Emits a single record as a hex line. The format is:
+ *
+ *     @<core>:<timestamp>:<id>:<a>:<b>
+ *
+ * which is what util/trace_decode.py expects.
+ */
+static inline void trace_emit(uint8_t core, const struct trace_record *record)
+{
+    printf("@%u:%08lx:%04x:%04x:%08lx\n",
+        core,
+        (unsigned long) record->timestamp,
+        record->id,
+        record->a,
+        (unsigned long) record->b);
+}
+
+uint32_t trace_drain(void)
+{
+    uint32_t emitted = 0;
+
+    for (uint8_t core = 0; core < 2; core++) {
+        struct trace_ring *ring = &g_trace[core];
+        uint32_t tail = ring->tail;
+        uint32_t head = ring->head;
+
+        // Pairs with the barrier in trace_event()
+        __dmb();
+
+        for (uint8_t i = 0; i < TRACE_DRAIN_BATCH && tail != head; i++) {
+            // Copy the record out before releasing the slot back to the producer
+            struct trace_record record = ring->records[tail & (TRACE_RING_SIZE - 1)];
+            __dmb();
+            ring->tail = ++tail;
+
+            trace_emit(core, &record);
+            emitted++;
+        }
+
+        uint32_t overflows = ring->overflows;
+        if (overflows != g_reported_overflows[core]) {
+            printf("@%u:overflow:%08lx\n", core, (unsigned long) overflows);
+            g_reported_overflows[core] = overflows;
+        }
+    }
+
+    return emitted;
+}
@@ -0,0 +1,301 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "pico/stdlib.h"
+
+#include "kvstore.h"
+#include "settings.h"
+#include "tuning.h"
+
+// .kbm lines before the mapping entries start
+enum tuning_kbm_line {
+    TUNING_KBM_MAP_SIZE = 0,
+    TUNING_KBM_FIRST_NOTE = 1,
+    TUNING_KBM_LAST_NOTE = 2,
+    TUNING_KBM_MIDDLE_NOTE = 3,
+    TUNING_KBM_REF_NOTE = 4,
+    TUNING_KBM_REF_FREQ = 5,
+    TUNING_KBM_OCTAVE_DEGREE = 6,
+    TUNING_KBM_MAP_START = 7
+};
+
+static inline int16_t floor_div(int16_t a, int16_t b)
+{
+    return a >= 0 ? a / b : -((b - 1 - a) / b);
+}
+
+/*
+ * Cents for any degree, including ones outside of the first period
+ */
+static float tuning_degree_cents(const struct tuning *tuning, int16_t degree)
+{
+    int16_t periods = floor_div(degree, tuning->num_degrees);
+    int16_t within = degree - (periods * tuning->num_degrees);
+    float cents = periods * tuning->cents[tuning->num_degrees - 1];
+
+    if (within) {
+        cents += tuning->cents[within - 1];
+    }
+
+    return cents;
+}
+
+void tuning_set_12tet(struct tuning *tuning)
+{
+    memset(tuning, 0, sizeof(struct tuning));
+
+    tuning->num_degrees = 12;
+    tuning->first_note = 0;
+    tuning->last_note = 127;
+    tuning->middle_note = 60;
+
+    for (uint8_t i = 0; i < 12; i++) {
+        tuning->cents[i] = (i + 1) * 100.0f;
+    }
+}
+
+void tuning_parser_begin(struct tuning_parser *parser)
+{
+    memset(parser, 0, sizeof(struct tuning_parser));
+    tuning_set_12tet(&parser->tuning);
+    parser->tuning.num_degrees = 0;
+    parser->section = TUNING_SECTION_SCL;
+}
+
+void tuning_parser_begin_kbm(struct tuning_parser *parser)
+{
+    parser->section = TUNING_SECTION_KBM;
+    parser->line = 0;
+    memset(parser->tuning.map, TUNING_UNMAPPED, sizeof(parser->tuning.map));
+}
+
+/*
+ * A pitch is in cents if it has a decimal point, otherwise it is a ratio
+ * (or a whole number, taken as n/1)
+ */
+static int tuning_parse_pitch(const char *line, float *cents)
+{
+    const char *end = line;
+    while (*end && !isspace((unsigned char) *end)) {
+        if ('.' == *end) {
+            *cents = strtof(line, NULL);
+            return 0;
+        }
+        end++;
+    }
+
+    char *rest;
+    long num = strtol(line, &rest, 10);
+    long den = 1;
+
+    if (rest == line) {
+        return 1;
+    }
+
+    if ('/' == *rest) {
+        den = strtol(rest + 1, NULL, 10);
+    }
+
+    if (num <= 0 || den <= 0) {
+        return 1;
+    }
+
+    *cents = 1200.0f * log2f((float) num / den);
+
+    return 0;
+}
+
+static int tuning_parse_scl_line(struct tuning_parser *parser, const char *line)
+{
+    struct tuning *tuning = &parser->tuning;
+
+    if (0 == parser->line) {
+        // Description, which may be blank
+        return 0;
+    }
+
+    if (!*line) {
+        return 0;
+    }
+
+    if (1 == parser->line) {
+        long count = strtol(line, NULL, 10);
+        if (count <= 0 || count > TUNING_MAX_DEGREES) {
+            return 1;
+        }
+
+        tuning->num_degrees = count;
+        return 0;
+    }
+
+    if (parser->pitches >= tuning->num_degrees) {
+        return 1;
+    }
+
+    return tuning_parse_pitch(line, &tuning->cents[parser->pitches++]);
+}
+
+static int tuning_parse_kbm_line(struct tuning_parser *parser, const char *line)
+{
+    struct tuning *tuning = &parser->tuning;
+
+    if (!*line) {
+        return 0;
+    }
+
+    uint8_t field = parser->line;
+    long value = strtol(line, NULL, 10);
+
+    switch (field) {
+        case TUNING_KBM_MAP_SIZE:
+            if (value < 0 || value > TUNING_MAX_MAP) {
+                return 1;
+            }
+            tuning->map_size = value;
+            return 0;
+        case TUNING_KBM_FIRST_NOTE:
+        case TUNING_KBM_LAST_NOTE:
+        case TUNING_KBM_MIDDLE_NOTE:
+            if (value < 0 || value > 127) {
+                return 1;
+            }
+
+            if (TUNING_KBM_FIRST_NOTE == field) {
+                tuning->first_note = value;
+            } else if (TUNING_KBM_LAST_NOTE == field) {
+                tuning->last_note = value;
+            } else {
+                tuning->middle_note = value;
+            }
+            return 0;
+        case TUNING_KBM_REF_NOTE:
+        case TUNING_KBM_REF_FREQ:
+            // Not used, see tuning.h
+            return 0;
+        case TUNING_KBM_OCTAVE_DEGREE:
+            if (value < 0 || value > 127) {
+                return 1;
+            }
+            tuning->octave_degree = value;
+            return 0;
+    }
+
+    uint8_t entry = field - TUNING_KBM_MAP_START;
+    if (entry >= tuning->map_size) {
+        return 1;
+    }
+
+    if ('x' == *line || 'X' == *line) {
+        tuning->map[entry] = TUNING_UNMAPPED;
+    } else if (value < 0 || value > INT8_MAX) {
+        return 1;
+    } else {
+        tuning->map[entry] = value;
+    }
+
+    return 0;
+}
+
+int tuning_parse_line(struct tuning_parser *parser, const char *line)
+{
+    if (parser->error) {
+        return 1;
+    }
+
+    while (isspace((unsigned char) *line)) {
+        line++;
+    }
+
+    if ('!' == *line) {
+        // Comment
+        return 0;
+    }
+
+    // Blank lines only count in the .scl description
+    uint8_t counts = *line || (TUNING_SECTION_SCL == parser->section && 0 == parser->line);
+
+    if (TUNING_SECTION_SCL == parser->section) {
+        parser->error = tuning_parse_scl_line(parser, line);
+    } else {
+        parser->error = tuning_parse_kbm_line(parser, line);
+    }
+
+    if (counts && parser->line < UINT8_MAX) {
+        parser->line++;
+    }
+
+    return parser->error;
+}
+
+int tuning_parser_end(struct tuning_parser *parser)
+{
+    struct tuning *tuning = &parser->tuning;
+
+    if (parser->error || !tuning->num_degrees) {
+        return 1;
+    }
+
+    if (parser->pitches != tuning->num_degrees) {
+        return 1;
+    }
+
+    if (TUNING_SECTION_KBM == parser->section && parser->line < TUNING_KBM_MAP_START) {
+        return 1;
+    }
+
+    return 0;
+}
+
+int tuning_load(uint8_t slot, struct tuning *tuning)
+{
+    if (TUNING_12TET == slot || slot >= TUNING_NUM_SLOTS) {
+        tuning_set_12tet(tuning);
+        return TUNING_12TET != slot;
+    }
+
+    if (kv_read(KV_KEY_TUNING_BASE + slot - 1, tuning, sizeof(struct tuning)) != sizeof(struct tuning)) {
+        tuning_set_12tet(tuning);
+        return 1;
+    }
+
+    return 0;
+}
+
+int tuning_save(uint8_t slot, const struct tuning *tuning)
+{
+    if (TUNING_12TET == slot || slot >= TUNING_NUM_SLOTS) {
+        return 1;
+    }
+
+    return kv_write(KV_KEY_TUNING_BASE + slot - 1, tuning, sizeof(struct tuning));
+}
+
+int tuning_note_volts(const struct tuning *tuning, int16_t note, float *volts)
+{
+    if (note < tuning->first_note || note > tuning->last_note) {
+        return 1;
+    }
+
+    int16_t offset = note - tuning->middle_note;
+    float cents;
+
+    if (!tuning->map_size) {
+        cents = tuning_degree_cents(tuning, offset);
+    } else {
+        int16_t repeats = floor_div(offset, tuning->map_size);
+        int8_t degree = tuning->map[offset - (repeats * tuning->map_size)];
+
+        if (TUNING_UNMAPPED == degree) {
+            return 1;
+        }
+
+        uint8_t octave_degree = tuning->octave_degree ? tuning->octave_degree : tuning->num_degrees;
+        cents = repeats * tuning_degree_cents(tuning, octave_degree) + tuning_degree_cents(tuning, degree);
+    }
+
+    *volts = ((tuning->middle_note - TUNING_KEY_C1_NOTE) / 12.0f) + (cents / 1200.0f);
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <stdint.h>
+#include "pico/stdlib.h"
+#include "pico/stdio/driver.h"
+#include "tusb.h"
+
+#include "usb.h"
+#include "usb_midi.h"
+#include "sched.h"
+
+/*
+ * stdio output. Never blocks; anything that doesn't fit in the CDC
+ * buffer, or is written while nobody has the port open, is dropped.
+ */
+static void usb_console_out_chars(const char *buf, int len)
+{
+    if (!tud_cdc_n_connected(USB_CDC_CONSOLE)) {
+        return;
+    }
+
+    tud_cdc_n_write(USB_CDC_CONSOLE, buf, len);
+}
+
+static void usb_console_out_flush(void)
+{
+    tud_cdc_n_write_flush(USB_CDC_CONSOLE);
+}
+
+static int usb_console_in_chars(char *buf, int len)
+{
+    if (!tud_cdc_n_available(USB_CDC_CONSOLE)) {
+        return PICO_ERROR_NO_DATA;
+    }
+
+    return tud_cdc_n_read(USB_CDC_CONSOLE, buf, len);
+}
+
+static stdio_driver_t g_usb_console_driver = {
+    .out_chars = usb_console_out_chars,
+    .out_flush = usb_console_out_flush,
+    .in_chars = usb_console_in_chars,
+#if PICO_STDIO_ENABLE_CRLF_SUPPORT
+    .crlf_enabled = PICO_STDIO_DEFAULT_CRLF
+#endif
+};
+
+int usb_init(void)
+{
+    if (!tusb_init()) {
+        return 1;
+    }
+
+    stdio_set_driver_enabled(&g_usb_console_driver, true);
+
+    return 0;
+}
+
+int usb_console_connected(void)
+{
+    return tud_cdc_n_connected(USB_CDC_CONSOLE);
+}
+
+void usb_task(void)
+{
+    tud_task();
+
+    // The looper adds to the MIDI batch from the scheduler interrupt
+    sched_lock();
+    usb_midi_flush_frame();
+    sched_unlock();
+}
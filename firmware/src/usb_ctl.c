@@ -0,0 +1,38 @@
+#include <stdint.h>
+#include "pico/stdlib.h"
+#include "tusb.h"
+
+#include "ctl.h"
+#include "usb.h"
+#include "usb_ctl.h"
+
+static uint32_t usb_ctl_read(uint8_t *buf, uint32_t len)
+{
+    if (!tud_cdc_n_available(USB_CDC_CONTROL)) {
+        return 0;
+    }
+
+    return tud_cdc_n_read(USB_CDC_CONTROL, buf, len);
+}
+
+static int usb_ctl_write(const uint8_t *frame, uint32_t len)
+{
+    // Nobody is listening, so there's nothing to drop
+    if (!tud_cdc_n_connected(USB_CDC_CONTROL)) {
+        return 0;
+    }
+
+    if (tud_cdc_n_write_available(USB_CDC_CONTROL) < len) {
+        return 1;
+    }
+
+    tud_cdc_n_write(USB_CDC_CONTROL, frame, len);
+    tud_cdc_n_write_flush(USB_CDC_CONTROL);
+
+    return 0;
+}
+
+const struct ctl_io usb_ctl_io = {
+    .read = usb_ctl_read,
+    .write = usb_ctl_write,
+};
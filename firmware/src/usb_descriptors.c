@@ -0,0 +1,123 @@
+#include <stdint.h>
+#include <string.h>
+#include "tusb.h"
+
+/*
+ * USB descriptors for the keyboard. TinyUSB calls the tud_descriptor_*
+ * callbacks below when the host asks for them.
+ */
+
+#define USB_VID 0x2E8A // Raspberry Pi
+#define USB_PID 0x10C0
+#define USB_BCD 0x0200
+
+enum {
+    ITF_NUM_CDC_CONSOLE = 0,
+    ITF_NUM_CDC_CONSOLE_DATA,
+    ITF_NUM_CDC_CONTROL,
+    ITF_NUM_CDC_CONTROL_DATA,
+    ITF_NUM_MIDI,
+    ITF_NUM_MIDI_STREAMING,
+    ITF_NUM_TOTAL
+};
+
+#define EPNUM_CDC_CONSOLE_NOTIF 0x81
+#define EPNUM_CDC_CONSOLE_OUT 0x02
+#define EPNUM_CDC_CONSOLE_IN 0x82
+#define EPNUM_MIDI_OUT 0x03
+#define EPNUM_MIDI_IN 0x83
+#define EPNUM_CDC_CONTROL_NOTIF 0x84
+#define EPNUM_CDC_CONTROL_OUT 0x05
+#define EPNUM_CDC_CONTROL_IN 0x85
+
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + 2 * TUD_CDC_DESC_LEN + TUD_MIDI_DESC_LEN)
+
+enum {
+    STRID_LANGID = 0,
+    STRID_MANUFACTURER,
+    STRID_PRODUCT,
+    STRID_SERIAL,
+    STRID_CDC_CONSOLE,
+    STRID_MIDI,
+    STRID_CDC_CONTROL,
+};
+
+static const tusb_desc_device_t desc_device = {
+    .bLength = sizeof(tusb_desc_device_t),
+    .bDescriptorType = TUSB_DESC_DEVICE,
+    .bcdUSB = USB_BCD,
+    // Composite device using interface association descriptors
+    .bDeviceClass = TUSB_CLASS_MISC,
+    .bDeviceSubClass = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol = MISC_PROTOCOL_IAD,
+    .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
+    .idVendor = USB_VID,
+    .idProduct = USB_PID,
+    .bcdDevice = 0x0100,
+    .iManufacturer = STRID_MANUFACTURER,
+    .iProduct = STRID_PRODUCT,
+    .iSerialNumber = STRID_SERIAL,
+    .bNumConfigurations = 0x01
+};
+
+static const uint8_t desc_configuration[] = {
+    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, 100),
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_CONSOLE, STRID_CDC_CONSOLE, EPNUM_CDC_CONSOLE_NOTIF, 8,
+        EPNUM_CDC_CONSOLE_OUT, EPNUM_CDC_CONSOLE_IN, 64),
+    TUD_MIDI_DESCRIPTOR(ITF_NUM_MIDI, STRID_MIDI, EPNUM_MIDI_OUT, EPNUM_MIDI_IN, 64),
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_CONTROL, STRID_CDC_CONTROL, EPNUM_CDC_CONTROL_NOTIF, 8,
+        EPNUM_CDC_CONTROL_OUT, EPNUM_CDC_CONTROL_IN, 64),
+};
+
+static const char *string_desc_arr[] = {
+    [STRID_MANUFACTURER] = "mtihlenfield",
+    [STRID_PRODUCT] = "CV/Gate Keyboard",
+    [STRID_SERIAL] = "000001",
+    [STRID_CDC_CONSOLE] = "Keyboard Console",
+    [STRID_MIDI] = "Keyboard MIDI",
+    [STRID_CDC_CONTROL] = "Keyboard Control",
+};
+
+static uint16_t desc_str[32];
+
+const uint8_t *tud_descriptor_device_cb(void)
+{
+    return (const uint8_t *) &desc_device;
+}
+
+const uint8_t *tud_descriptor_configuration_cb(uint8_t index)
+{
+    (void) index;
+    return desc_configuration;
+}
+
+const uint16_t *tud_descriptor_string_cb(uint8_t index, uint16_t langid)
+{
+    (void) langid;
+    uint8_t len;
+
+    if (STRID_LANGID == index) {
+        desc_str[1] = 0x0409; // English
+        len = 1;
+    } else {
+        if (index >= sizeof(string_desc_arr) / sizeof(string_desc_arr[0]) || !string_desc_arr[index]) {
+            return NULL;
+        }
+
+        const char *str = string_desc_arr[index];
+        len = strlen(str);
+        if (len > 31) {
+            len = 31;
+        }
+
+        // Convert ASCII to UTF-16
+        for (uint8_t i = 0; i < len; i++) {
+            desc_str[1 + i] = str[i];
+        }
+    }
+
+    // First half word is the length in bytes (including the header) and the type
+    desc_str[0] = (TUSB_DESC_STRING << 8) | (2 * len + 2);
+
+    return desc_str;
+}
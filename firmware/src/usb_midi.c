@@ -0,0 +1,111 @@
+#include <stdint.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "tusb.h"
+
+#include "io.h"
+#include "midi.h"
+#include "usb_midi.h"
+
+#define USB_MIDI_NO_NOTE 0xff
+
+struct usb_midi_state {
+    struct midi_batch batch;
+    uint32_t last_frame_ms;
+    // Note that was sent for each held keybed key, so that the note off
+    // still matches if the octave shift changes while the key is held.
+    // USB_MIDI_NO_NOTE if nothing was sent.
+    uint8_t key_notes[MAX_KEYBED_KEY + 1];
+} g_usb_midi;
+
+/*
+ * tud_midi_packet_write() starts a transfer every time it's called, so
+ * the first packet of a chord would go out on its own. The whole batch is
+ * handed to the stream writer instead, which fills the FIFO and then
+ * flushes once.
+ */
+static uint32_t usb_midi_write_packets(const uint8_t packets[][MIDI_PACKET_LEN], uint32_t count)
+{
+    uint8_t bytes[MIDI_BATCH_SIZE * (MIDI_PACKET_LEN - 1)];
+    uint32_t len = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t size = midi_packet_size(packets[i]);
+        memcpy(bytes + len, packets[i] + 1, size);
+        len += size;
+    }
+
+    uint32_t sent = tud_midi_stream_write(0, bytes, len);
+
+    // The stream writer only stops between messages when the FIFO fills
+    uint32_t written = 0;
+    while (written < count && sent >= midi_packet_size(packets[written])) {
+        sent -= midi_packet_size(packets[written++]);
+    }
+
+    return written;
+}
+
+int usb_midi_init(void)
+{
+    memset(&g_usb_midi, 0, sizeof(struct usb_midi_state));
+    memset(g_usb_midi.key_notes, USB_MIDI_NO_NOTE, sizeof(g_usb_midi.key_notes));
+    midi_batch_init(&g_usb_midi.batch);
+
+    return 0;
+}
+
+void usb_midi_flush_frame(void)
+{
+    uint32_t now_ms = time_us_32() / 1000;
+    if (now_ms == g_usb_midi.last_frame_ms) {
+        return;
+    }
+
+    g_usb_midi.last_frame_ms = now_ms;
+
+    if (!tud_midi_mounted()) {
+        // Nobody is listening. Don't let stale messages pile up and get
+        // sent when the host finally shows up.
+        g_usb_midi.batch.count = 0;
+        return;
+    }
+
+    midi_batch_flush(&g_usb_midi.batch, usb_midi_write_packets);
+}
+
+void usb_midi_key_event(uint8_t event_type, uint8_t key_id, int8_t octave_shift)
+{
+    if (!io_is_keybed_key(key_id)) {
+        uint8_t value = IO_KEY_PRESSED == event_type ? MIDI_MAX_DATA : 0;
+        midi_control_change(
+            &g_usb_midi.batch,
+            USB_MIDI_CHANNEL,
+            USB_MIDI_FUNC_KEY_CC_BASE + (key_id - KEY_OCTAVE_UP),
+            value
+        );
+        return;
+    }
+
+    if (IO_KEY_PRESSED == event_type) {
+        int16_t note = USB_MIDI_BASE_NOTE + (key_id - KEY_C1) + (12 * octave_shift);
+        if (note < 0 || note > MIDI_MAX_DATA) {
+            return;
+        }
+
+        g_usb_midi.key_notes[key_id] = note;
+        midi_note_on(&g_usb_midi.batch, USB_MIDI_CHANNEL, note, USB_MIDI_VELOCITY);
+    } else {
+        if (USB_MIDI_NO_NOTE == g_usb_midi.key_notes[key_id]) {
+            return;
+        }
+
+        midi_note_off(&g_usb_midi.batch, USB_MIDI_CHANNEL, g_usb_midi.key_notes[key_id]);
+        g_usb_midi.key_notes[key_id] = USB_MIDI_NO_NOTE;
+    }
+}
+
+uint32_t usb_midi_dropped(void)
+{
+    return g_usb_midi.batch.dropped;
+}
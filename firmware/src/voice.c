@@ -0,0 +1,242 @@
+#include <stdint.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+
+#include "hardware_config.h"
+#include "hot.h"
+#include "io.h"
+#include "list.h"
+#include "lkp_stack.h"
+#include "mcp4921.h"
+#include "sched.h"
+#include "voice.h"
+
+/*
+ * Finds the held keys each voice should be playing in the modes where that
+ * only depends on what is held. Voices with nothing to play get KEY_NONE.
+ */
+static void voice_pick_from_held(struct voice_state *state, struct lkp_stack *held, uint32_t *targets)
+{
+    targets[0] = KEY_NONE;
+    targets[1] = KEY_NONE;
+
+    if (list_empty(&held->stack)) {
+        return;
+    }
+
+    uint32_t last = lkp_get_last_key(held);
+
+    switch (state->mode) {
+        case VOICE_MODE_MONO:
+            targets[0] = last;
+            break;
+        case VOICE_MODE_SPLIT: {
+            struct key_press *cursor = 0;
+            targets[0] = last;
+            targets[1] = last;
+            list_for_each_entry(cursor, &held->stack, list) {
+                if (cursor->key_id < targets[0]) {
+                    targets[0] = cursor->key_id;
+                }
+
+                if (cursor->key_id > targets[1]) {
+                    targets[1] = cursor->key_id;
+                }
+            }
+            break;
+        }
+        case VOICE_MODE_LAST_TWO: {
+            struct list_head *prev = held->tail->prev;
+            targets[0] = last;
+            targets[1] = prev == &held->stack ? last : list_entry(prev, struct key_press, list)->key_id;
+            break;
+        }
+    }
+}
+
+/*
+ * Round robin allocation depends on the order of events rather than just
+ * what is held, so it updates targets one event at a time, starting from
+ * the voices' current keys.
+ */
+static void voice_pick_round_robin(struct voice_state *state, struct lkp_stack *held,
+    uint8_t event_type, uint32_t key_id, uint32_t *targets)
+{
+    if (IO_KEY_PRESSED == event_type) {
+        uint8_t voice = state->next_voice;
+
+        // Prefer a free voice, otherwise steal the next one in line
+        for (uint8_t i = 0; i < NUM_VOICES; i++) {
+            uint8_t candidate = (state->next_voice + i) % NUM_VOICES;
+            if (KEY_NONE == targets[candidate]) {
+                voice = candidate;
+                break;
+            }
+        }
+
+        targets[voice] = key_id;
+        state->next_voice = (voice + 1) % NUM_VOICES;
+        return;
+    }
+
+    for (uint8_t i = 0; i < NUM_VOICES; i++) {
+        if (key_id != targets[i]) {
+            continue;
+        }
+
+        // Hand the voice to the most recent held key that isn't already
+        // sounding, if there is one
+        targets[i] = KEY_NONE;
+        struct key_press *cursor = 0;
+        list_for_each_entry_reverse(cursor, &held->stack, list) {
+            uint8_t sounding = 0;
+            for (uint8_t j = 0; j < NUM_VOICES; j++) {
+                sounding |= targets[j] == cursor->key_id;
+            }
+
+            if (!sounding) {
+                targets[i] = cursor->key_id;
+                break;
+            }
+        }
+    }
+}
+
+static void HOT_FUNC(voice_gate_on_callback)(void *arg)
+{
+    struct voice *voice = arg;
+
+    voice->gate_on = SCHED_INVALID_HANDLE;
+    gpio_put(voice->gate_pin, 1);
+}
+
+static inline void voice_gate_off(struct voice *voice)
+{
+    sched_cancel(voice->gate_on);
+    voice->gate_on = SCHED_INVALID_HANDLE;
+    voice->gate = 0;
+    gpio_put(voice->gate_pin, 0);
+}
+
+/*
+ * Brings the gate up. If it was already up it is held low for
+ * VOICE_RETRIGGER_US first so that whatever is listening sees a new note.
+ */
+static inline void voice_gate_on(struct voice *voice, uint8_t retrigger)
+{
+    voice->gate = 1;
+
+    if (retrigger) {
+        voice->gate_on = sched_in(VOICE_RETRIGGER_US, voice_gate_on_callback, voice);
+        if (SCHED_INVALID_HANDLE != voice->gate_on) {
+            return;
+        }
+    }
+
+    gpio_put(voice->gate_pin, 1);
+}
+
+/*
+ * Moves the voices on to their new keys. Voices that change key get their
+ * gate retriggered, and voices with no key get their gate dropped.
+ */
+static void voice_apply(struct voice_state *state, uint32_t *targets, uint64_t pressed)
+{
+    uint8_t changed[NUM_VOICES] = {0};
+    uint8_t retrigger[NUM_VOICES] = {0};
+    uint8_t num_voices = VOICE_MODE_MONO == state->mode ? 1 : NUM_VOICES;
+
+    for (uint8_t i = 0; i < num_voices; i++) {
+        struct voice *voice = &state->voices[i];
+
+        // A new press always retriggers the voice it lands on, even if
+        // that voice was already on the same key
+        if (targets[i] == voice->key_id && (KEY_NONE == targets[i] || !(pressed & IO_KEY_BIT(targets[i])))) {
+            continue;
+        }
+
+        retrigger[i] = voice->gate;
+        voice_gate_off(voice);
+        voice->key_id = targets[i];
+
+        if (KEY_NONE == voice->key_id) {
+            continue;
+        }
+
+        voice->code = state->key_to_code(voice->key_id);
+        changed[i] = 1;
+    }
+
+    if (changed[0] && changed[1]) {
+        mcp4921_set_codes(state->dac, state->voices[0].code, state->voices[1].code);
+    } else {
+        for (uint8_t i = 0; i < num_voices; i++) {
+            if (changed[i]) {
+                mcp4921_set_code(state->dac, i, state->voices[i].code);
+            }
+        }
+    }
+
+    for (uint8_t i = 0; i < num_voices; i++) {
+        if (changed[i]) {
+            voice_gate_on(&state->voices[i], retrigger[i]);
+        }
+    }
+}
+
+int voice_init(struct voice_state *state, struct mcp4921 *dac, voice_key_to_code_t key_to_code)
+{
+    memset(state, 0, sizeof(struct voice_state));
+
+    state->dac = dac;
+    state->key_to_code = key_to_code;
+    state->voices[0].gate_pin = GATE_OUT_PIN;
+    state->voices[1].gate_pin = GATE2_OUT_PIN;
+
+    for (uint8_t i = 0; i < NUM_VOICES; i++) {
+        gpio_init(state->voices[i].gate_pin);
+        gpio_set_dir(state->voices[i].gate_pin, GPIO_OUT);
+        gpio_put(state->voices[i].gate_pin, 0);
+    }
+
+    return 0;
+}
+
+void voice_set_mode(struct voice_state *state, uint8_t mode)
+{
+    if (mode >= VOICE_NUM_MODES) {
+        return;
+    }
+
+    for (uint8_t i = 0; i < NUM_VOICES; i++) {
+        voice_gate_off(&state->voices[i]);
+        state->voices[i].key_id = KEY_NONE;
+    }
+
+    state->mode = mode;
+    state->next_voice = 0;
+}
+
+void voice_key_frame(struct voice_state *state, struct lkp_stack *held, uint64_t pressed, uint64_t released)
+{
+    uint32_t targets[NUM_VOICES];
+
+    if (VOICE_MODE_ROUND_ROBIN == state->mode) {
+        for (uint8_t i = 0; i < NUM_VOICES; i++) {
+            targets[i] = state->voices[i].key_id;
+        }
+
+        for (uint64_t keys = released; keys; keys &= keys - 1) {
+            voice_pick_round_robin(state, held, IO_KEY_RELEASED, __builtin_ctzll(keys), targets);
+        }
+
+        for (uint64_t keys = pressed; keys; keys &= keys - 1) {
+            voice_pick_round_robin(state, held, IO_KEY_PRESSED, __builtin_ctzll(keys), targets);
+        }
+    } else {
+        voice_pick_from_held(state, held, targets);
+    }
+
+    voice_apply(state, targets, pressed);
+}
@@ -0,0 +1,18 @@
+#include <stdint.h>
+#include "pico/stdlib.h"
+#include "hardware/structs/xip_ctrl.h"
+
+#include "xip_stats.h"
+
+void xip_stats_reset(void)
+{
+    // Any write clears them
+    xip_ctrl_hw->ctr_hit = 0;
+    xip_ctrl_hw->ctr_acc = 0;
+}
+
+void xip_stats_read(struct xip_stats *stats)
+{
+    stats->hits = xip_ctrl_hw->ctr_hit;
+    stats->accesses = xip_ctrl_hw->ctr_acc;
+}
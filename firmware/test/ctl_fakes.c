@@ -0,0 +1,309 @@
+/*
+ * Stand ins for everything ctl.c talks to, so that it can be run on the
+ * host. Params just hold on to what they are given, with the same range
+ * checks as the real setters where those can fail. The KV store is a
+ * table in memory.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "pico/stdlib.h"
+
+#include "clock.h"
+#include "health.h"
+#include "io.h"
+#include "kvstore.h"
+#include "lfo.h"
+#include "looper.h"
+#include "sched.h"
+#include "settings.h"
+#include "sync_out.h"
+#include "tuning.h"
+#include "xip_stats.h"
+
+#include "ctl_fakes.h"
+
+uint64_t test_time_us;
+
+struct fake_state g_fake;
+
+void fake_reset(void)
+{
+    memset(&g_fake, 0, sizeof(struct fake_state));
+
+    g_fake.tick_period_us = 20833; // 120bpm
+    g_fake.steps_per_quarter = 4;
+    g_fake.sync_in_ppqn = 24;
+    g_fake.sync_out_ppqn = 24;
+    g_fake.sync_out_width_us = 5000;
+    g_fake.lfo_rate_mhz = LFO_DEFAULT_RATE_MHZ;
+    g_fake.lfo_depth = LFO_DEFAULT_DEPTH;
+
+    for (uint8_t i = 0; i < TUNING_NUM_SLOTS; i++) {
+        g_fake.tunings[i].num_degrees = 12 + i;
+    }
+}
+
+void clock_set_bpm(uint16_t bpm)
+{
+    g_fake.tick_period_us = 60000000 / ((uint32_t) bpm * CLOCK_PPQN);
+}
+
+uint32_t clock_get_tick_period_us(void)
+{
+    return g_fake.tick_period_us;
+}
+
+int clock_set_sync_in_ppqn(uint8_t ppqn)
+{
+    if (!ppqn || CLOCK_PPQN % ppqn) {
+        return 1;
+    }
+
+    g_fake.sync_in_ppqn = ppqn;
+    return 0;
+}
+
+uint8_t clock_get_sync_in_ppqn(void)
+{
+    return g_fake.sync_in_ppqn;
+}
+
+int clock_set_steps_per_quarter(uint8_t steps)
+{
+    if (!steps || CLOCK_PPQN % steps) {
+        return 1;
+    }
+
+    g_fake.steps_per_quarter = steps;
+    return 0;
+}
+
+uint8_t clock_get_steps_per_quarter(void)
+{
+    return g_fake.steps_per_quarter;
+}
+
+void clock_set_swing(uint8_t swing)
+{
+    g_fake.swing = swing;
+}
+
+uint8_t clock_get_swing(void)
+{
+    return g_fake.swing;
+}
+
+int clock_set_groove(uint8_t groove)
+{
+    if (groove >= CLOCK_NUM_GROOVES) {
+        return 1;
+    }
+
+    g_fake.groove = groove;
+    return 0;
+}
+
+uint8_t clock_get_groove(void)
+{
+    return g_fake.groove;
+}
+
+int sync_out_set_ppqn(uint8_t ppqn)
+{
+    if (SYNC_OUT_PPQN_STEPS != ppqn && 48 != ppqn && (!ppqn || CLOCK_PPQN % ppqn)) {
+        return 1;
+    }
+
+    g_fake.sync_out_ppqn = ppqn;
+    return 0;
+}
+
+uint8_t sync_out_get_ppqn(void)
+{
+    return g_fake.sync_out_ppqn;
+}
+
+void sync_out_set_width_us(uint16_t width_us)
+{
+    g_fake.sync_out_width_us = width_us;
+}
+
+uint16_t sync_out_get_width_us(void)
+{
+    return g_fake.sync_out_width_us;
+}
+
+void sync_out_set_thru(uint8_t thru)
+{
+    g_fake.sync_out_thru = thru;
+}
+
+uint8_t sync_out_get_thru(void)
+{
+    return g_fake.sync_out_thru;
+}
+
+uint32_t sync_out_dropped(void)
+{
+    return 0;
+}
+
+void looper_set_grid(uint8_t grid)
+{
+    g_fake.looper_grid = grid;
+}
+
+uint8_t looper_get_grid(void)
+{
+    return g_fake.looper_grid;
+}
+
+uint32_t looper_dropped(void)
+{
+    return 0;
+}
+
+int lfo_set_shape(uint8_t shape)
+{
+    if (shape >= LFO_NUM_SHAPES) {
+        return 1;
+    }
+
+    g_fake.lfo_shape = shape;
+    return 0;
+}
+
+uint8_t lfo_get_shape(void)
+{
+    return g_fake.lfo_shape;
+}
+
+int lfo_set_rate_mhz(uint16_t rate_mhz)
+{
+    if (rate_mhz < LFO_MIN_RATE_MHZ || rate_mhz > LFO_MAX_RATE_MHZ) {
+        return 1;
+    }
+
+    g_fake.lfo_rate_mhz = rate_mhz;
+    return 0;
+}
+
+uint16_t lfo_get_rate_mhz(void)
+{
+    return g_fake.lfo_rate_mhz;
+}
+
+void lfo_set_sync(uint8_t sync)
+{
+    g_fake.lfo_sync = sync;
+}
+
+uint8_t lfo_get_sync(void)
+{
+    return g_fake.lfo_sync;
+}
+
+int lfo_set_division(uint8_t division)
+{
+    if (division >= LFO_NUM_DIVISIONS) {
+        return 1;
+    }
+
+    g_fake.lfo_division = division;
+    return 0;
+}
+
+uint8_t lfo_get_division(void)
+{
+    return g_fake.lfo_division;
+}
+
+void lfo_set_depth(uint8_t depth)
+{
+    g_fake.lfo_depth = depth;
+}
+
+uint8_t lfo_get_depth(void)
+{
+    return g_fake.lfo_depth;
+}
+
+int tuning_load(uint8_t slot, struct tuning *tuning)
+{
+    if (slot >= TUNING_NUM_SLOTS || !g_fake.tunings[slot].num_degrees) {
+        return 1;
+    }
+
+    memcpy(tuning, &g_fake.tunings[slot], sizeof(struct tuning));
+    return 0;
+}
+
+int tuning_save(uint8_t slot, const struct tuning *tuning)
+{
+    if (g_fake.tuning_save_fails) {
+        return 1;
+    }
+
+    memcpy(&g_fake.tunings[slot], tuning, sizeof(struct tuning));
+    return 0;
+}
+
+int kv_read(uint8_t key, void *buf, size_t buf_len)
+{
+    if (!g_fake.kv_len[key]) {
+        return -1;
+    }
+
+    size_t len = g_fake.kv_len[key] < buf_len ? g_fake.kv_len[key] : buf_len;
+    memcpy(buf, g_fake.kv[key], len);
+
+    return len;
+}
+
+int kv_write(uint8_t key, const void *data, size_t len)
+{
+    if (len > KV_MAX_VALUE_LEN) {
+        return 1;
+    }
+
+    memcpy(g_fake.kv[key], data, len);
+    g_fake.kv_len[key] = len;
+
+    return 0;
+}
+
+uint32_t kv_erase_count(void)
+{
+    return FAKE_KV_ERASE_COUNT;
+}
+
+void sched_get_stats(struct sched_stats *stats)
+{
+    memset(stats, 0, sizeof(struct sched_stats));
+    stats->fired = FAKE_SCHED_FIRED;
+
+    for (uint8_t i = 0; i < SCHED_LATENESS_BUCKETS; i++) {
+        stats->lateness[i] = i;
+    }
+}
+
+void io_get_scan_stats(struct io_scan_stats *stats)
+{
+    memset(stats, 0, sizeof(struct io_scan_stats));
+}
+
+void xip_stats_read(struct xip_stats *stats)
+{
+    memset(stats, 0, sizeof(struct xip_stats));
+}
+
+void health_get_stats(struct health_stats *stats)
+{
+    memset(stats, 0, sizeof(struct health_stats));
+}
+
+void settings_changed(void)
+{
+    g_fake.settings_changed++;
+}
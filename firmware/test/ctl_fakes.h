@@ -0,0 +1,50 @@
+#ifndef __CTL_FAKES_H__
+#define __CTL_FAKES_H__
+/*
+ * State behind the fakes in ctl_fakes.c, which the tests set up and
+ * check directly
+ */
+
+#include <stdint.h>
+
+#include "kvstore.h"
+#include "tuning.h"
+
+// Distinctive values for spotting counters in the stats response
+#define FAKE_SCHED_FIRED 0x11223344
+#define FAKE_KV_ERASE_COUNT 0x55667788
+
+struct fake_state {
+    uint32_t tick_period_us;
+    uint8_t steps_per_quarter;
+    uint8_t swing;
+    uint8_t groove;
+    uint8_t sync_in_ppqn;
+    uint8_t sync_out_ppqn;
+    uint16_t sync_out_width_us;
+    uint8_t sync_out_thru;
+    uint8_t looper_grid;
+    uint8_t lfo_shape;
+    uint8_t lfo_sync;
+    uint16_t lfo_rate_mhz;
+    uint8_t lfo_division;
+    uint8_t lfo_depth;
+
+    // Slots with num_degrees of 0 read as empty
+    struct tuning tunings[TUNING_NUM_SLOTS];
+    uint8_t tuning_save_fails;
+
+    uint8_t kv[256][KV_MAX_VALUE_LEN];
+    uint8_t kv_len[256]; // 0 if not written
+
+    uint32_t settings_changed;
+};
+
+extern struct fake_state g_fake;
+
+/*
+ * Puts everything back to its defaults, with every tuning slot filled
+ */
+void fake_reset(void);
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef __TEST_HARDWARE_FLASH_H__
+#define __TEST_HARDWARE_FLASH_H__
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+
+#endif
@@ -0,0 +1,4 @@
+#ifndef __TEST_HARDWARE_GPIO_H__
+#define __TEST_HARDWARE_GPIO_H__
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef __TEST_HARDWARE_SPI_H__
+#define __TEST_HARDWARE_SPI_H__
+
+typedef struct spi_inst spi_inst_t;
+
+#endif
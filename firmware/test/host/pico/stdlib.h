@@ -0,0 +1,26 @@
+#ifndef __TEST_PICO_STDLIB_H__
+#define __TEST_PICO_STDLIB_H__
+/*
+ * Just enough of the SDK for the module headers to build on the host.
+ * Time is whatever the test says it is (see test_time_us).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct alarm_pool alarm_pool_t;
+typedef struct repeating_timer repeating_timer_t;
+
+extern uint64_t test_time_us;
+
+static inline uint64_t time_us_64(void)
+{
+    return test_time_us;
+}
+
+static inline uint32_t time_us_32(void)
+{
+    return (uint32_t) test_time_us;
+}
+
+#endif
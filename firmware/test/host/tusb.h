@@ -0,0 +1,15 @@
+#ifndef __TEST_TUSB_H__
+#define __TEST_TUSB_H__
+/*
+ * The parts of the TinyUSB device API that the MIDI code uses, which the
+ * tests provide
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+bool tud_midi_mounted(void);
+
+uint32_t tud_midi_stream_write(uint8_t cable_num, const uint8_t *buffer, uint32_t bufsize);
+
+#endif
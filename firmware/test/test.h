@@ -0,0 +1,46 @@
+#ifndef __TEST_H__
+#define __TEST_H__
+/*
+ * Bare bones checks for the host tests. A failed check is reported and
+ * counted, and the test carries on so that one run shows everything that
+ * is broken. Each test program returns test_result() from main, which is
+ * non zero if anything failed.
+ */
+
+#include <stdio.h>
+
+extern int test_failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        long long _a = (long long) (a); \
+        long long _b = (long long) (b); \
+        if (_a != _b) { \
+            printf("%s:%d: CHECK_EQ(%s, %s) failed, %lld != %lld\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+            test_failures++; \
+        } \
+    } while (0)
+
+// Defines test_failures, in the one file with main()
+#define TEST_MAIN_STATE int test_failures
+
+static inline int test_result(const char *name)
+{
+    if (test_failures) {
+        printf("%s: %d failed\n", name, test_failures);
+        return 1;
+    }
+
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+#endif
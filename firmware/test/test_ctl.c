@@ -0,0 +1,693 @@
+/*
+ * Runs the control protocol over a pty, with the device end on the
+ * master side through a struct ctl_io and the test playing the host on
+ * the slave side, the same way util/kbctl.py talks to the real thing.
+ */
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "ctl.h"
+#include "frame.h"
+#include "kvstore.h"
+#include "lfo.h"
+#include "looper.h"
+#include "sched.h"
+#include "sync_out.h"
+#include "tuning.h"
+
+#include "ctl_fakes.h"
+#include "test.h"
+
+#define TEST_FRAME_LEN FRAME_ENCODED_LEN(CTL_MAX_PAYLOAD)
+
+// Counters in a CTL_CMD_STATS response, before the lateness histogram
+#define TEST_STATS_COUNTERS 25
+#define TEST_STATS_LEN (3 + 1 + (TEST_STATS_COUNTERS + SCHED_LATENESS_BUCKETS) * 4)
+
+// Indexes of the counters the tests look at
+#define TEST_STATS_SCHED_FIRED 0
+#define TEST_STATS_KV_ERASES 14
+#define TEST_STATS_BAD_FRAMES 15
+#define TEST_STATS_TX_DROPPED 16
+
+TEST_MAIN_STATE;
+
+struct test_state {
+    int master;
+    int slave;
+    uint8_t write_full; // Makes the device side report no room
+
+    // What has come back from the device so far
+    uint8_t rx[TEST_FRAME_LEN * 4];
+    size_t rx_len;
+
+    uint8_t last_slot;
+    uint8_t last_select;
+    uint32_t tuning_callbacks;
+} g_test;
+
+static uint32_t test_io_read(uint8_t *buf, uint32_t len)
+{
+    ssize_t n = read(g_test.master, buf, len);
+    return n > 0 ? n : 0;
+}
+
+static int test_io_write(const uint8_t *frame, uint32_t len)
+{
+    if (g_test.write_full) {
+        return 1;
+    }
+
+    ssize_t n = write(g_test.master, frame, len);
+    return n != (ssize_t) len;
+}
+
+static const struct ctl_io test_io = {
+    .read = test_io_read,
+    .write = test_io_write,
+};
+
+static void test_tuning_changed(uint8_t slot, uint8_t select)
+{
+    g_test.last_slot = slot;
+    g_test.last_select = select;
+    g_test.tuning_callbacks++;
+}
+
+static int test_open_pty(void)
+{
+    g_test.master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (g_test.master < 0 || grantpt(g_test.master) || unlockpt(g_test.master)) {
+        return 1;
+    }
+
+    g_test.slave = open(ptsname(g_test.master), O_RDWR | O_NOCTTY);
+    if (g_test.slave < 0) {
+        return 1;
+    }
+
+    // Bytes have to go through untouched both ways
+    struct termios tio;
+    tcgetattr(g_test.slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(g_test.slave, TCSANOW, &tio);
+
+    fcntl(g_test.master, F_SETFL, fcntl(g_test.master, F_GETFL) | O_NONBLOCK);
+    fcntl(g_test.slave, F_SETFL, fcntl(g_test.slave, F_GETFL) | O_NONBLOCK);
+
+    return 0;
+}
+
+static void test_send_raw(const uint8_t *data, size_t len)
+{
+    while (len) {
+        ssize_t n = write(g_test.slave, data, len);
+
+        if (n < 0 && EAGAIN != errno) {
+            perror("write");
+            exit(1);
+        }
+
+        if (n > 0) {
+            data += n;
+            len -= n;
+        }
+    }
+}
+
+static void test_send(const uint8_t *payload, size_t len)
+{
+    uint8_t frame[TEST_FRAME_LEN];
+    test_send_raw(frame, frame_encode(payload, len, frame));
+}
+
+/*
+ * Gives the device enough goes to read everything that's been sent
+ */
+static void test_pump(void)
+{
+    for (uint8_t i = 0; i < 8; i++) {
+        ctl_task();
+    }
+}
+
+/*
+ * Pulls the next response out of what the device has sent. Returns its
+ * length, or -1 if there isn't one.
+ */
+static int test_recv(uint8_t *payload)
+{
+    ssize_t n = read(g_test.slave, g_test.rx + g_test.rx_len, sizeof(g_test.rx) - g_test.rx_len);
+    if (n > 0) {
+        g_test.rx_len += n;
+    }
+
+    uint8_t *end = memchr(g_test.rx, FRAME_DELIMITER, g_test.rx_len);
+    if (!end) {
+        return -1;
+    }
+
+    size_t frame_len = end - g_test.rx;
+    int len = frame_decode(g_test.rx, frame_len);
+    if (len > 0) {
+        memcpy(payload, g_test.rx, len);
+    }
+
+    g_test.rx_len -= frame_len + 1;
+    memmove(g_test.rx, end + 1, g_test.rx_len);
+
+    return len;
+}
+
+/*
+ * Sends a request and returns the length of the response, which must be
+ * for the same command and seq
+ */
+static int test_request(const uint8_t *request, size_t len, uint8_t *response)
+{
+    test_send(request, len);
+    test_pump();
+
+    int response_len = test_recv(response);
+
+    CHECK(response_len >= 3);
+    if (response_len >= 3) {
+        CHECK_EQ(response[0], request[0] | CTL_RESPONSE);
+        CHECK_EQ(response[1], request[1]);
+    }
+
+    CHECK_EQ(test_recv(response + CTL_MAX_PAYLOAD), -1);
+
+    return response_len;
+}
+
+static uint32_t test_get_u32(const uint8_t *buf)
+{
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t) buf[3] << 24);
+}
+
+static uint32_t test_stats_counter(const uint8_t *response, uint8_t index)
+{
+    return test_get_u32(response + 4 + index * 4);
+}
+
+static void test_reset(void)
+{
+    fake_reset();
+    ctl_init(&test_io, test_tuning_changed);
+
+    g_test.write_full = 0;
+    g_test.rx_len = 0;
+    g_test.tuning_callbacks = 0;
+
+    // Anything left over from the last test
+    uint8_t discard[256];
+    while (read(g_test.slave, discard, sizeof(discard)) > 0) {
+    }
+}
+
+static void test_frame_round_trip(void)
+{
+    uint8_t payload[CTL_MAX_PAYLOAD];
+    uint8_t frame[TEST_FRAME_LEN];
+
+    srand(1);
+
+    for (uint16_t len = 0; len <= CTL_MAX_PAYLOAD; len++) {
+        for (uint16_t i = 0; i < len; i++) {
+            // Plenty of zeros, since those are what COBS has to deal with
+            payload[i] = rand() % 4 ? rand() : 0;
+        }
+
+        size_t frame_len = frame_encode(payload, len, frame);
+
+        CHECK(frame_len <= (size_t) FRAME_ENCODED_LEN(len));
+        CHECK_EQ(frame[frame_len - 1], FRAME_DELIMITER);
+        CHECK(!memchr(frame, FRAME_DELIMITER, frame_len - 1));
+
+        int decoded_len = frame_decode(frame, frame_len - 1);
+
+        CHECK_EQ(decoded_len, len);
+        CHECK(!memcmp(frame, payload, len));
+    }
+
+    // All zeros and no zeros at all, around the 254 byte COBS block length
+    for (uint16_t len = 250; len <= CTL_MAX_PAYLOAD; len++) {
+        for (uint8_t fill = 0; fill < 2; fill++) {
+            memset(payload, fill ? 0xff : 0, len);
+
+            size_t frame_len = frame_encode(payload, len, frame);
+            CHECK(frame_len <= (size_t) FRAME_ENCODED_LEN(len));
+            CHECK_EQ(frame_decode(frame, frame_len - 1), len);
+            CHECK(!memcmp(frame, payload, len));
+        }
+    }
+}
+
+static void test_ping(void)
+{
+    uint8_t response[CTL_MAX_PAYLOAD * 2];
+
+    test_reset();
+
+    // Trailing bytes are ignored, and make sure the frames have zeros to
+    // encode and differing lengths
+    for (uint16_t args = 0; args < CTL_MAX_PAYLOAD - 2; args += 23) {
+        uint8_t request[CTL_MAX_PAYLOAD] = {CTL_CMD_PING, args};
+
+        for (uint16_t i = 0; i < args; i++) {
+            request[2 + i] = i % 3 ? i : 0;
+        }
+
+        CHECK_EQ(test_request(request, 2 + args, response), 6);
+        CHECK_EQ(response[2], CTL_OK);
+        CHECK_EQ(response[3], CTL_VERSION);
+        CHECK_EQ(response[4] | (response[5] << 8), CTL_MAX_PAYLOAD);
+    }
+
+    CHECK_EQ(ctl_bad_frames(), 0);
+}
+
+static void test_bad_crc(void)
+{
+    uint8_t request[] = {CTL_CMD_PING, 7};
+    uint8_t response[CTL_MAX_PAYLOAD * 2];
+    uint8_t frame[TEST_FRAME_LEN];
+
+    test_reset();
+
+    // Flip each byte in turn (avoiding the delimiter), none of which
+    // should get through
+    size_t frame_len = frame_encode(request, sizeof(request), frame);
+
+    for (size_t i = 0; i < frame_len - 1; i++) {
+        uint8_t bad[TEST_FRAME_LEN];
+        memcpy(bad, frame, frame_len);
+        bad[i] = 0x40 == bad[i] ? 0x41 : bad[i] ^ 0x40;
+
+        test_send_raw(bad, frame_len);
+    }
+
+    test_pump();
+    CHECK_EQ(test_recv(response), -1);
+    CHECK_EQ(ctl_bad_frames(), frame_len - 1);
+
+    // Too short to have a header
+    uint8_t short_request[] = {CTL_CMD_PING};
+    test_send(short_request, sizeof(short_request));
+    test_pump();
+    CHECK_EQ(test_recv(response), -1);
+    CHECK_EQ(ctl_bad_frames(), frame_len);
+
+    // Back to normal afterwards
+    CHECK_EQ(test_request(request, sizeof(request), response), 6);
+    CHECK_EQ(response[2], CTL_OK);
+}
+
+static void test_oversize(void)
+{
+    uint8_t request[] = {CTL_CMD_PING, 9};
+    uint8_t response[CTL_MAX_PAYLOAD * 2];
+    uint8_t junk[TEST_FRAME_LEN * 3];
+
+    test_reset();
+
+    // Empty frames are just delimiters back to back, and are ignored
+    uint8_t delimiters[4] = {0};
+    test_send_raw(delimiters, sizeof(delimiters));
+    test_pump();
+    CHECK_EQ(ctl_bad_frames(), 0);
+
+    for (uint8_t i = 0; i < 3; i++) {
+        // More than the receive buffer holds, with no delimiter in it
+        size_t junk_len = TEST_FRAME_LEN + 1 + i * TEST_FRAME_LEN / 2;
+        memset(junk, 0x5a, junk_len);
+        junk[junk_len - 1] = FRAME_DELIMITER;
+
+        test_send_raw(junk, junk_len);
+        test_pump();
+
+        CHECK_EQ(test_recv(response), -1);
+        CHECK_EQ(ctl_bad_frames(), i + 1);
+
+        // Nothing of it is left to spoil the next frame
+        CHECK_EQ(test_request(request, sizeof(request), response), 6);
+        CHECK_EQ(response[2], CTL_OK);
+    }
+
+    // Exactly fills the receive buffer with the delimiter, so is fine
+    uint8_t frame[TEST_FRAME_LEN];
+    uint8_t big[CTL_MAX_PAYLOAD] = {CTL_CMD_PING, 10};
+    memset(big + 2, 0xff, sizeof(big) - 2);
+
+    size_t frame_len = frame_encode(big, sizeof(big), frame);
+    CHECK_EQ(frame_len, TEST_FRAME_LEN);
+
+    test_send_raw(frame, frame_len);
+    test_pump();
+    CHECK_EQ(test_recv(response), 6);
+    CHECK_EQ(ctl_bad_frames(), 3);
+}
+
+static void test_params(void)
+{
+    uint8_t response[CTL_MAX_PAYLOAD * 2];
+
+    // A value that each param takes, and one that it doesn't
+    static const int32_t good[CTL_NUM_PARAMS] = {
+        140, 2, 60, 1, 4, 12, 1000, 1, 3, LFO_SHAPE_TRIANGLE, 1, 2500, LFO_DIV_EIGHTH, 80,
+    };
+    static const int32_t bad[CTL_NUM_PARAMS] = {
+        CLOCK_MAX_BPM + 1, 5, CLOCK_MAX_SWING + 1, 256, 7, 5, SYNC_OUT_MAX_WIDTH_US + 1, -1, LOOPER_NUM_GRIDS,
+        LFO_NUM_SHAPES, -1, LFO_MAX_RATE_MHZ + 1, LFO_NUM_DIVISIONS, LFO_MAX_DEPTH + 1,
+    };
+
+    test_reset();
+
+    for (uint8_t id = 0; id < CTL_NUM_PARAMS; id++) {
+        uint8_t get[] = {CTL_CMD_PARAM_GET, id, id};
+
+        CHECK_EQ(test_request(get, sizeof(get), response), 8);
+        CHECK_EQ(response[2], CTL_OK);
+        CHECK_EQ(response[3], id);
+
+        uint8_t set[] = {
+            CTL_CMD_PARAM_SET, id, id,
+            good[id] & 0xff, (good[id] >> 8) & 0xff, (good[id] >> 16) & 0xff, (good[id] >> 24) & 0xff,
+        };
+        uint32_t changed = g_fake.settings_changed;
+
+        CHECK_EQ(test_request(set, sizeof(set), response), 8);
+        CHECK_EQ(response[2], CTL_OK);
+        CHECK_EQ(response[3], id);
+        CHECK_EQ((int32_t) test_get_u32(response + 4), good[id]);
+        CHECK_EQ(g_fake.settings_changed, changed + 1);
+
+        // Reads back the same
+        CHECK_EQ(test_request(get, sizeof(get), response), 8);
+        CHECK_EQ((int32_t) test_get_u32(response + 4), good[id]);
+
+        uint8_t bad_set[] = {
+            CTL_CMD_PARAM_SET, id, id,
+            bad[id] & 0xff, (bad[id] >> 8) & 0xff, (bad[id] >> 16) & 0xff, (bad[id] >> 24) & 0xff,
+        };
+
+        // Sync out thru and LFO sync take anything as a flag
+        if (CTL_PARAM_SYNC_OUT_THRU == id || CTL_PARAM_LFO_SYNC == id) {
+            continue;
+        }
+
+        CHECK_EQ(test_request(bad_set, sizeof(bad_set), response), 3);
+        CHECK_EQ(response[2], CTL_ERR_BAD_ARGS);
+        CHECK_EQ(g_fake.settings_changed, changed + 1);
+
+        CHECK_EQ(test_request(get, sizeof(get), response), 8);
+        CHECK_EQ((int32_t) test_get_u32(response + 4), good[id]);
+    }
+
+    CHECK_EQ(g_fake.steps_per_quarter, 2);
+    CHECK_EQ(g_fake.lfo_rate_mhz, 2500);
+
+    uint8_t unknown[] = {CTL_CMD_PARAM_GET, 1, CTL_NUM_PARAMS};
+    CHECK_EQ(test_request(unknown, sizeof(unknown), response), 3);
+    CHECK_EQ(response[2], CTL_ERR_BAD_ARGS);
+
+    uint8_t no_id[] = {CTL_CMD_PARAM_GET, 2};
+    CHECK_EQ(test_request(no_id, sizeof(no_id), response), 3);
+    CHECK_EQ(response[2], CTL_ERR_BAD_ARGS);
+
+    uint8_t short_set[] = {CTL_CMD_PARAM_SET, 3, CTL_PARAM_SWING, 50, 0, 0};
+    CHECK_EQ(test_request(short_set, sizeof(short_set), response), 3);
+    CHECK_EQ(response[2], CTL_ERR_BAD_ARGS);
+}
+
+static void test_tunings(void)
+{
+    uint8_t response[CTL_MAX_PAYLOAD * 2];
+    uint8_t request[3 + sizeof(struct tuning)] = {0};
+    struct tuning tuning;
+
+    test_reset();
+
+    uint8_t read[] = {CTL_CMD_TUNING_READ, 1, 3};
+    CHECK_EQ(test_request(read, sizeof(read), response), 4 + sizeof(struct tuning));
+    CHECK_EQ(response[2], CTL_OK);
+    CHECK_EQ(response[3], 3);
+    CHECK(!memcmp(response + 4, &g_fake.tunings[3], sizeof(struct tuning)));
+
+    g_fake.tunings[5].num_degrees = 0;
+    read[2] = 5;
+    CHECK_EQ(test_request(read, sizeof(read), response), 3);
+    CHECK_EQ(response[2], CTL_ERR_EMPTY);
+
+    read[2] = TUNING_NUM_SLOTS;
+    CHECK_EQ(test_request(read, sizeof(read), response), 3);
+    CHECK_EQ(response[2], CTL_ERR_BAD_ARGS);
+
+    memset(&tuning, 0, sizeof(struct tuning));
+    tuning.num_degrees = 19;
+    tuning.middle_note = 60;
+    for (uint8_t i = 0; i < tuning.num_degrees; i++) {
+        tuning.cents[i] = 1200.0f * (i + 1) / tuning.num_degrees;
+    }
+
+    request[0] = CTL_CMD_TUNING_WRITE;
+    request[1] = 2;
+    request[2] = 5;
+    memcpy(request + 3, &tuning, sizeof(struct tuning));
+
+    CHECK_EQ(test_request(request, sizeof(request), response), 4);
+    CHECK_EQ(response[2], CTL_OK);
+    CHECK_EQ(response[3], 5);
+    CHECK(!memcmp(&g_fake.tunings[5], &tuning, sizeof(struct tuning)));
+    CHECK_EQ(g_test.tuning_callbacks, 1);
+    CHECK_EQ(g_test.last_slot, 5);
+    CHECK_EQ(g_test.last_select, 0);
+
+    // 12-TET is built in
+    request[2] = TUNING_12TET;
+    CHECK_EQ(test_request(request, sizeof(request), response), 3);
+    CHECK_EQ(response[2], CTL_ERR_BAD_ARGS);
+
+    // Short a byte
+    request[2] = 6;
+    CHECK_EQ(test_request(request, sizeof(request) - 1, response), 3);
+    CHECK_EQ(response[2], CTL_ERR_BAD_ARGS);
+
+    // Each of the checks on the contents
+    struct tuning broken;
+    for (uint8_t i = 0; i < 3; i++) {
+        memcpy(&broken, &tuning, sizeof(struct tuning));
+
+        if (0 == i) {
+            broken.num_degrees = 0;
+        } else if (1 == i) {
+            broken.map_size = TUNING_MAX_MAP + 1;
+        } else {
+            broken.octave_degree = broken.num_degrees + 1;
+        }
+
+        memcpy(request + 3, &broken, sizeof(struct tuning));
+        CHECK_EQ(test_request(request, sizeof(request), response), 3);
+        CHECK_EQ(response[2], CTL_ERR_BAD_ARGS);
+    }
+
+    memcpy(request + 3, &tuning, sizeof(struct tuning));
+    g_fake.tuning_save_fails = 1;
+    CHECK_EQ(test_request(request, sizeof(request), response), 3);
+    CHECK_EQ(response[2], CTL_ERR_FAILED);
+    CHECK_EQ(g_test.tuning_callbacks, 1);
+
+    uint8_t select[] = {CTL_CMD_TUNING_SELECT, 4, 7};
+    CHECK_EQ(test_request(select, sizeof(select), response), 4);
+    CHECK_EQ(response[2], CTL_OK);
+    CHECK_EQ(response[3], 7);
+    CHECK_EQ(g_test.tuning_callbacks, 2);
+    CHECK_EQ(g_test.last_slot, 7);
+    CHECK_EQ(g_test.last_select, 1);
+}
+
+static void test_patterns(void)
+{
+    uint8_t response[CTL_MAX_PAYLOAD * 2];
+    uint8_t request[3 + KV_PATTERN_MAX_LEN + 1] = {CTL_CMD_PATTERN_WRITE, 1, 0};
+
+    test_reset();
+
+    for (uint16_t i = 0; i < KV_PATTERN_MAX_LEN + 1; i++) {
+        request[3 + i] = i * 7;
+    }
+
+    for (uint8_t slot = 0; slot < CTL_PATTERN_SLOTS; slot++) {
+        uint16_t len = 1 + slot * (KV_PATTERN_MAX_LEN - 1) / (CTL_PATTERN_SLOTS - 1);
+        request[2] = slot;
+
+        CHECK_EQ(test_request(request, 3 + len, response), 4);
+        CHECK_EQ(response[2], CTL_OK);
+        CHECK_EQ(response[3], slot);
+        CHECK_EQ(g_fake.kv_len[KV_KEY_PATTERN_BASE + slot], len);
+    }
+
+    for (uint8_t slot = 0; slot < CTL_PATTERN_SLOTS; slot++) {
+        uint16_t len = 1 + slot * (KV_PATTERN_MAX_LEN - 1) / (CTL_PATTERN_SLOTS - 1);
+        uint8_t read[] = {CTL_CMD_PATTERN_READ, 2, slot};
+
+        CHECK_EQ(test_request(read, sizeof(read), response), 4 + len);
+        CHECK_EQ(response[2], CTL_OK);
+        CHECK_EQ(response[3], slot);
+        CHECK(!memcmp(response + 4, request + 3, len));
+    }
+
+    // The last slot is full length
+    CHECK_EQ(g_fake.kv_len[KV_KEY_PATTERN_BASE + CTL_PATTERN_SLOTS - 1], KV_PATTERN_MAX_LEN);
+
+    request[2] = 0;
+    CHECK_EQ(test_request(request, sizeof(request), response), 3);
+    CHECK_EQ(response[2], CTL_ERR_BAD_ARGS);
+
+    CHECK_EQ(test_request(request, 3, response), 3);
+    CHECK_EQ(response[2], CTL_ERR_BAD_ARGS);
+
+    request[2] = CTL_PATTERN_SLOTS;
+    CHECK_EQ(test_request(request, 4, response), 3);
+    CHECK_EQ(response[2], CTL_ERR_BAD_ARGS);
+    CHECK_EQ(g_fake.kv_len[KV_KEY_PATTERN_BASE + CTL_PATTERN_SLOTS], 0);
+
+    test_reset();
+
+    uint8_t read[] = {CTL_CMD_PATTERN_READ, 3, 0};
+    CHECK_EQ(test_request(read, sizeof(read), response), 3);
+    CHECK_EQ(response[2], CTL_ERR_EMPTY);
+}
+
+static void test_stats(void)
+{
+    uint8_t response[CTL_MAX_PAYLOAD * 2];
+    uint8_t request[] = {CTL_CMD_STATS, 5};
+
+    test_reset();
+
+    CHECK_EQ(test_request(request, sizeof(request), response), TEST_STATS_LEN);
+    CHECK_EQ(response[2], CTL_OK);
+    CHECK_EQ(response[3], CTL_STATS_VERSION);
+    CHECK_EQ(test_stats_counter(response, TEST_STATS_SCHED_FIRED), FAKE_SCHED_FIRED);
+    CHECK_EQ(test_stats_counter(response, TEST_STATS_KV_ERASES), FAKE_KV_ERASE_COUNT);
+    CHECK_EQ(test_stats_counter(response, TEST_STATS_BAD_FRAMES), 0);
+    CHECK_EQ(test_stats_counter(response, TEST_STATS_TX_DROPPED), 0);
+
+    for (uint8_t i = 0; i < SCHED_LATENESS_BUCKETS; i++) {
+        CHECK_EQ(test_stats_counter(response, TEST_STATS_COUNTERS + i), i);
+    }
+
+    // A response that doesn't fit is dropped and counted
+    uint8_t ping[] = {CTL_CMD_PING, 6};
+    g_test.write_full = 1;
+    test_send(ping, sizeof(ping));
+    test_pump();
+    g_test.write_full = 0;
+
+    uint8_t bad[] = {1, 2, 3};
+    test_send_raw(bad, sizeof(bad));
+    test_send_raw((const uint8_t[]) {FRAME_DELIMITER}, 1);
+
+    CHECK_EQ(test_request(request, sizeof(request), response), TEST_STATS_LEN);
+    CHECK_EQ(test_stats_counter(response, TEST_STATS_BAD_FRAMES), 1);
+    CHECK_EQ(test_stats_counter(response, TEST_STATS_TX_DROPPED), 1);
+}
+
+static void test_stream(void)
+{
+    uint8_t response[CTL_MAX_PAYLOAD * 2];
+
+    test_reset();
+    test_time_us = 1000000;
+
+    uint8_t start[] = {CTL_CMD_STREAM, 8, 100, 0};
+    CHECK_EQ(test_request(start, sizeof(start), response), 3);
+    CHECK_EQ(response[2], CTL_OK);
+
+    for (uint8_t i = 0; i < 3; i++) {
+        test_time_us += 99 * 1000;
+        test_pump();
+        CHECK_EQ(test_recv(response), -1);
+
+        test_time_us += 1000;
+        test_pump();
+        CHECK_EQ(test_recv(response), TEST_STATS_LEN);
+        CHECK_EQ(response[0], CTL_CMD_STATS | CTL_RESPONSE);
+        CHECK_EQ(response[1], 0);
+        CHECK_EQ(response[2], CTL_OK);
+        CHECK_EQ(test_recv(response), -1);
+    }
+
+    // Clamped to the fastest allowed
+    uint8_t fast[] = {CTL_CMD_STREAM, 9, 1, 0};
+    CHECK_EQ(test_request(fast, sizeof(fast), response), 3);
+
+    test_time_us += (CTL_MIN_STREAM_INTERVAL_MS - 1) * 1000;
+    test_pump();
+    CHECK_EQ(test_recv(response), -1);
+
+    test_time_us += 1000;
+    test_pump();
+    CHECK_EQ(test_recv(response), TEST_STATS_LEN);
+
+    uint8_t stop[] = {CTL_CMD_STREAM, 10, 0, 0};
+    CHECK_EQ(test_request(stop, sizeof(stop), response), 3);
+
+    test_time_us += 1000 * 1000;
+    test_pump();
+    CHECK_EQ(test_recv(response), -1);
+
+    uint8_t short_args[] = {CTL_CMD_STREAM, 11, 100};
+    CHECK_EQ(test_request(short_args, sizeof(short_args), response), 3);
+    CHECK_EQ(response[2], CTL_ERR_BAD_ARGS);
+}
+
+static void test_unknown_cmd(void)
+{
+    uint8_t response[CTL_MAX_PAYLOAD * 2];
+
+    test_reset();
+
+    uint8_t unused[] = {0x00, 0x0b, 0x42, 0x7f, CTL_CMD_PING | CTL_RESPONSE};
+
+    for (uint8_t i = 0; i < sizeof(unused); i++) {
+        uint8_t request[] = {unused[i], i, 1, 2};
+
+        CHECK_EQ(test_request(request, sizeof(request), response), 3);
+        CHECK_EQ(response[2], CTL_ERR_UNKNOWN_CMD);
+    }
+}
+
+int main(void)
+{
+    if (test_open_pty()) {
+        perror("pty");
+        return 1;
+    }
+
+    test_frame_round_trip();
+    test_ping();
+    test_bad_crc();
+    test_oversize();
+    test_params();
+    test_tunings();
+    test_patterns();
+    test_stats();
+    test_stream();
+    test_unknown_cmd();
+
+    return test_result("test_ctl");
+}
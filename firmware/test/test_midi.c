@@ -0,0 +1,166 @@
+/*
+ * USB-MIDI packet encoding and the per-frame batch, with a writer that
+ * takes as many packets as the test allows each time
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "midi.h"
+
+#include "test.h"
+
+TEST_MAIN_STATE;
+
+struct test_state {
+    // What the writer has taken, across every flush
+    uint8_t written[MIDI_BATCH_SIZE * 4][MIDI_PACKET_LEN];
+    uint32_t written_count;
+    uint32_t room; // Packets the writer will take per call
+    uint32_t calls;
+} g_test;
+
+static uint32_t test_writer(const uint8_t packets[][MIDI_PACKET_LEN], uint32_t count)
+{
+    uint32_t taken = count < g_test.room ? count : g_test.room;
+
+    memcpy(g_test.written[g_test.written_count], packets, taken * MIDI_PACKET_LEN);
+    g_test.written_count += taken;
+    g_test.calls++;
+
+    return taken;
+}
+
+static void test_reset(struct midi_batch *batch, uint32_t room)
+{
+    midi_batch_init(batch);
+    memset(&g_test, 0, sizeof(g_test));
+    g_test.room = room;
+}
+
+static void test_check_packet(const uint8_t *packet, uint8_t cin, uint8_t status, uint8_t data1, uint8_t data2)
+{
+    CHECK_EQ(packet[0], cin);
+    CHECK_EQ(packet[1], status);
+    CHECK_EQ(packet[2], data1);
+    CHECK_EQ(packet[3], data2);
+}
+
+static void test_cin(void)
+{
+    struct midi_batch batch;
+
+    test_reset(&batch, MIDI_BATCH_SIZE);
+
+    CHECK_EQ(midi_note_on(&batch, 0, 60, 100), 0);
+    CHECK_EQ(midi_note_off(&batch, 15, 61), 0);
+    CHECK_EQ(midi_control_change(&batch, 3, 102, 127), 0);
+    // Channels past 15 wrap and data is masked to 7 bits
+    CHECK_EQ(midi_note_on(&batch, 17, 0xff, 0x80), 0);
+    // Cable number goes in the upper nibble of the first byte
+    CHECK_EQ(midi_batch_add(&batch, 2, 0xE5, 0x10, 0x40), 0);
+
+    CHECK_EQ(batch.count, 5);
+    test_check_packet(batch.packets[0], 0x09, 0x90, 60, 100);
+    test_check_packet(batch.packets[1], 0x08, 0x8F, 61, 0);
+    test_check_packet(batch.packets[2], 0x0B, 0xB3, 102, 127);
+    test_check_packet(batch.packets[3], 0x09, 0x91, 0x7f, 0);
+    test_check_packet(batch.packets[4], 0x2E, 0xE5, 0x10, 0x40);
+}
+
+static void test_full(void)
+{
+    struct midi_batch batch;
+
+    test_reset(&batch, MIDI_BATCH_SIZE);
+
+    for (uint8_t i = 0; i < MIDI_BATCH_SIZE; i++) {
+        CHECK_EQ(midi_note_on(&batch, 0, i, 1), 0);
+    }
+
+    CHECK_EQ(batch.count, MIDI_BATCH_SIZE);
+    CHECK_EQ(batch.dropped, 0);
+
+    // Anything more is dropped and counted, and what's there is untouched
+    CHECK_EQ(midi_note_on(&batch, 0, 100, 1), -1);
+    CHECK_EQ(midi_note_off(&batch, 0, 100), -1);
+    CHECK_EQ(batch.count, MIDI_BATCH_SIZE);
+    CHECK_EQ(batch.dropped, 2);
+    test_check_packet(batch.packets[MIDI_BATCH_SIZE - 1], 0x09, 0x90, MIDI_BATCH_SIZE - 1, 1);
+
+    CHECK_EQ(midi_batch_flush(&batch, test_writer), MIDI_BATCH_SIZE);
+    CHECK_EQ(batch.count, 0);
+
+    // Room again after a flush, with the drops still counted
+    CHECK_EQ(midi_note_on(&batch, 0, 100, 1), 0);
+    CHECK_EQ(batch.dropped, 2);
+}
+
+static void test_flush(void)
+{
+    struct midi_batch batch;
+
+    test_reset(&batch, MIDI_BATCH_SIZE);
+
+    // Nothing queued doesn't bother the writer
+    CHECK_EQ(midi_batch_flush(&batch, test_writer), 0);
+    CHECK_EQ(g_test.calls, 0);
+
+    for (uint8_t i = 0; i < 10; i++) {
+        midi_note_on(&batch, 0, i, 1);
+    }
+
+    // The whole batch goes in one call
+    CHECK_EQ(midi_batch_flush(&batch, test_writer), 10);
+    CHECK_EQ(g_test.calls, 1);
+    CHECK_EQ(batch.count, 0);
+    CHECK_EQ(g_test.written_count, 10);
+
+    for (uint8_t i = 0; i < 10; i++) {
+        test_check_packet(g_test.written[i], 0x09, 0x90, i, 1);
+    }
+}
+
+static void test_partial_flush(void)
+{
+    struct midi_batch batch;
+
+    test_reset(&batch, 3);
+
+    for (uint8_t i = 0; i < 10; i++) {
+        midi_note_on(&batch, 0, i, 1);
+    }
+
+    // What the writer doesn't take stays queued in order
+    CHECK_EQ(midi_batch_flush(&batch, test_writer), 3);
+    CHECK_EQ(batch.count, 7);
+    test_check_packet(batch.packets[0], 0x09, 0x90, 3, 1);
+
+    // New packets go after the leftovers
+    midi_note_off(&batch, 0, 3);
+
+    g_test.room = 0;
+    CHECK_EQ(midi_batch_flush(&batch, test_writer), 0);
+    CHECK_EQ(batch.count, 8);
+
+    g_test.room = 5;
+    CHECK_EQ(midi_batch_flush(&batch, test_writer), 5);
+    CHECK_EQ(midi_batch_flush(&batch, test_writer), 3);
+    CHECK_EQ(batch.count, 0);
+    CHECK_EQ(g_test.written_count, 11);
+
+    for (uint8_t i = 0; i < 10; i++) {
+        test_check_packet(g_test.written[i], 0x09, 0x90, i, 1);
+    }
+    test_check_packet(g_test.written[10], 0x08, 0x80, 3, 0);
+}
+
+int main(void)
+{
+    test_cin();
+    test_full();
+    test_flush();
+    test_partial_flush();
+
+    return test_result("test_midi");
+}
@@ -0,0 +1,172 @@
+/*
+ * Checks that each frame's batch goes to TinyUSB in a single write, which
+ * is what gets a chord in to one transfer. The stream writer is faked
+ * with a FIFO that takes whole messages while there is room for a packet,
+ * like TinyUSB's does.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "tusb.h"
+
+#include "io.h"
+#include "midi.h"
+#include "usb_midi.h"
+
+#include "test.h"
+
+#define TEST_MAX_BYTES (MIDI_BATCH_SIZE * 4 * (MIDI_PACKET_LEN - 1))
+
+TEST_MAIN_STATE;
+
+uint64_t test_time_us;
+
+// io.h only has the inline definition
+extern inline bool io_is_keybed_key(uint8_t key_id);
+
+struct test_state {
+    bool mounted;
+    uint32_t room; // Packets left in the FIFO
+    uint32_t writes;
+
+    // Everything that went in to the FIFO
+    uint8_t sent[TEST_MAX_BYTES];
+    uint32_t sent_len;
+} g_test;
+
+bool tud_midi_mounted(void)
+{
+    return g_test.mounted;
+}
+
+uint32_t tud_midi_stream_write(uint8_t cable_num, const uint8_t *buffer, uint32_t bufsize)
+{
+    uint32_t i = 0;
+
+    CHECK_EQ(cable_num, 0);
+    g_test.writes++;
+
+    while (i < bufsize && g_test.room) {
+        // Every message the firmware sends is three bytes
+        uint32_t size = bufsize - i < 3 ? bufsize - i : 3;
+
+        memcpy(g_test.sent + g_test.sent_len, buffer + i, size);
+        g_test.sent_len += size;
+        g_test.room--;
+        i += size;
+    }
+
+    return i;
+}
+
+static void test_reset(uint32_t room)
+{
+    memset(&g_test, 0, sizeof(g_test));
+    g_test.mounted = true;
+    g_test.room = room;
+
+    usb_midi_init();
+}
+
+/*
+ * Moves on to the next 1ms frame and flushes
+ */
+static void test_next_frame(void)
+{
+    test_time_us += 1000;
+    usb_midi_flush_frame();
+}
+
+static void test_check_note(uint32_t index, uint8_t status, uint8_t note, uint8_t velocity)
+{
+    const uint8_t *bytes = g_test.sent + index * 3;
+
+    CHECK_EQ(bytes[0], status);
+    CHECK_EQ(bytes[1], note);
+    CHECK_EQ(bytes[2], velocity);
+}
+
+static void test_chord(void)
+{
+    test_reset(MIDI_BATCH_SIZE);
+
+    for (uint8_t i = 0; i < 6; i++) {
+        usb_midi_key_event(IO_KEY_PRESSED, KEY_C1 + i * 2, 0);
+    }
+
+    // Nothing goes until the frame is up
+    usb_midi_flush_frame();
+    CHECK_EQ(g_test.writes, 0);
+
+    test_next_frame();
+    CHECK_EQ(g_test.writes, 1);
+    CHECK_EQ(g_test.sent_len, 6 * 3);
+
+    for (uint8_t i = 0; i < 6; i++) {
+        test_check_note(i, MIDI_NOTE_ON | USB_MIDI_CHANNEL, USB_MIDI_BASE_NOTE + i * 2, USB_MIDI_VELOCITY);
+    }
+
+    // An empty frame doesn't write at all
+    test_next_frame();
+    CHECK_EQ(g_test.writes, 1);
+
+    for (uint8_t i = 0; i < 6; i++) {
+        usb_midi_key_event(IO_KEY_RELEASED, KEY_C1 + i * 2, 0);
+    }
+
+    test_next_frame();
+    CHECK_EQ(g_test.writes, 2);
+    CHECK_EQ(g_test.sent_len, 12 * 3);
+
+    for (uint8_t i = 0; i < 6; i++) {
+        test_check_note(6 + i, MIDI_NOTE_OFF | USB_MIDI_CHANNEL, USB_MIDI_BASE_NOTE + i * 2, 0);
+    }
+}
+
+static void test_fifo_full(void)
+{
+    test_reset(4);
+
+    for (uint8_t i = 0; i < 6; i++) {
+        usb_midi_key_event(IO_KEY_PRESSED, KEY_C1 + i, 0);
+    }
+
+    test_next_frame();
+    CHECK_EQ(g_test.writes, 1);
+    CHECK_EQ(g_test.sent_len, 4 * 3);
+
+    // The rest go next frame, still in order and in one write
+    g_test.room = MIDI_BATCH_SIZE;
+    test_next_frame();
+    CHECK_EQ(g_test.writes, 2);
+    CHECK_EQ(g_test.sent_len, 6 * 3);
+
+    for (uint8_t i = 0; i < 6; i++) {
+        test_check_note(i, MIDI_NOTE_ON | USB_MIDI_CHANNEL, USB_MIDI_BASE_NOTE + i, USB_MIDI_VELOCITY);
+    }
+}
+
+static void test_unmounted(void)
+{
+    test_reset(MIDI_BATCH_SIZE);
+    g_test.mounted = false;
+
+    usb_midi_key_event(IO_KEY_PRESSED, KEY_C1, 0);
+    test_next_frame();
+    CHECK_EQ(g_test.writes, 0);
+
+    // What was queued while nobody was listening is thrown away
+    g_test.mounted = true;
+    test_next_frame();
+    CHECK_EQ(g_test.writes, 0);
+}
+
+int main(void)
+{
+    test_chord();
+    test_fifo_full();
+    test_unmounted();
+
+    return test_result("test_usb_midi");
+}
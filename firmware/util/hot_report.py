@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""
+Lists the functions reachable from the firmware's interrupt handlers that
+still run from flash, eg:
+
+    ./hot_report.py keyboard.elf
+    ./hot_report.py --objdump arm-none-eabi-objdump --root my_callback keyboard.elf
+
+Meant for builds with KEYBOARD_HOT_IN_RAM on, where those functions can
+stall on an XIP cache miss. The call graph comes from the direct calls and
+tail calls in the disassembly. Calls through function pointers can't be
+followed, which is why the callbacks they reach are roots too.
+"""
+import argparse
+import re
+import subprocess
+import sys
+
+# Entry points on the timing critical path: interrupt handlers, timer and
+# alarm callbacks, and anything called through a function pointer from them
+DEFAULT_ROOTS = [
+    "io_poll_keys",
+    "io_gpio_irq",
+    "clock_alarm_callback",
+    "clock_step_alarm_callback",
+    "midi_uart_irq_handler",
+    "midi_uart_clock_listener",
+    "sched_alarm_callback",
+    "voice_gate_on_callback",
+    "led_clock_listener",
+    "sync_out_clock_listener",
+    "looper_sched_callback",
+]
+
+FLASH_START = 0x10000000
+FLASH_END = 0x16000000
+
+FUNC_RE = re.compile(r"^([0-9a-f]{8}) <([^>]+)>:$")
+CALL_RE = re.compile(r"\t(?:bl|blx|b|b\.n|b\.w)\s+[0-9a-f]+ <([^>+]+)>")
+VENEER_RE = re.compile(r"^__(.+)_veneer$")
+
+
+def load_call_graph(objdump, elf):
+    output = subprocess.run([objdump, "-d", "--no-show-raw-insn", elf],
+                            check=True, capture_output=True, text=True).stdout
+
+    addresses = {}
+    calls = {}
+    current = None
+
+    for line in output.splitlines():
+        match = FUNC_RE.match(line)
+        if match:
+            current = match.group(2)
+            addresses[current] = int(match.group(1), 16)
+            calls.setdefault(current, set())
+            continue
+
+        if current is None:
+            continue
+
+        match = CALL_RE.search(line)
+        if match and match.group(1) != current:
+            calls[current].add(match.group(1))
+
+    # Long calls between RAM and flash go through linker veneers
+    for name in list(calls):
+        match = VENEER_RE.match(name)
+        if match and match.group(1) in addresses:
+            calls[name].add(match.group(1))
+
+    return addresses, calls
+
+
+def in_flash(address):
+    return FLASH_START <= address < FLASH_END
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="firmware elf")
+    parser.add_argument("--objdump", default="arm-none-eabi-objdump", help="objdump to use")
+    parser.add_argument("--root", action="append", default=[],
+                        help="extra entry point (can be repeated)")
+    parser.add_argument("--strict", action="store_true",
+                        help="exit with an error if anything is found in flash")
+    args = parser.parse_args()
+
+    addresses, calls = load_call_graph(args.objdump, args.elf)
+
+    # Breadth first, so the path recorded for each function is the shortest
+    paths = {}
+    queue = []
+    for root in DEFAULT_ROOTS + args.root:
+        if root not in addresses:
+            print("warning: {} isn't in the elf".format(root), file=sys.stderr)
+            continue
+        paths[root] = [root]
+        queue.append(root)
+
+    while queue:
+        func = queue.pop(0)
+        for callee in sorted(calls.get(func, ())):
+            if callee not in paths and callee in addresses:
+                paths[callee] = paths[func] + [callee]
+                queue.append(callee)
+
+    in_flash_funcs = sorted(f for f in paths if in_flash(addresses[f]) and not VENEER_RE.match(f))
+
+    print("{} functions reachable from {} roots, {} in flash".format(
+        len(paths), len(DEFAULT_ROOTS) + len(args.root), len(in_flash_funcs)))
+
+    for func in in_flash_funcs:
+        print("  {:08x} {:<32} {}".format(addresses[func], func, " -> ".join(paths[func])))
+
+    if args.strict and in_flash_funcs:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
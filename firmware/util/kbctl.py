@@ -0,0 +1,291 @@
+#!/usr/bin/env python3
+"""
+Talks to the keyboard over the binary control protocol on its second USB
+CDC interface (see include/ctl.h), eg:
+
+    ./kbctl.py /dev/ttyACM1 ping
+    ./kbctl.py /dev/ttyACM1 get swing
+    ./kbctl.py /dev/ttyACM1 set bpm 128
+    ./kbctl.py /dev/ttyACM1 stats
+    ./kbctl.py /dev/ttyACM1 stats --stream 500
+    ./kbctl.py /dev/ttyACM1 tuning-read 1 --out 19edo.bin
+    ./kbctl.py /dev/ttyACM1 tuning-write 2 19edo.bin --select
+    ./kbctl.py /dev/ttyACM1 pattern-write 0 pattern.bin
+
+Tunings are transferred as the raw struct tuning, so a file read back
+from one slot can be written to another. Use scl_upload.py to get a .scl
+file on to the device in the first place.
+
+Needs pyserial.
+"""
+import argparse
+import struct
+import sys
+import time
+
+import serial
+
+# Must match include/ctl.h
+CTL_RESPONSE = 0x80
+CTL_STATS_VERSION = 2
+
+CMD_PING = 0x01
+CMD_PARAM_GET = 0x02
+CMD_PARAM_SET = 0x03
+CMD_TUNING_READ = 0x04
+CMD_TUNING_WRITE = 0x05
+CMD_TUNING_SELECT = 0x06
+CMD_PATTERN_READ = 0x07
+CMD_PATTERN_WRITE = 0x08
+CMD_STATS = 0x09
+CMD_STREAM = 0x0a
+
+STATUSES = ["ok", "unknown command", "bad arguments", "failed", "empty"]
+
+PARAMS = {
+    "bpm": 0,
+    "steps_per_quarter": 1,
+    "swing": 2,
+    "groove": 3,
+    "sync_in_ppqn": 4,
+    "sync_out_ppqn": 5,
+    "sync_out_width_us": 6,
+    "sync_out_thru": 7,
+    "looper_grid": 8,
+    "lfo_shape": 9,
+    "lfo_sync": 10,
+    "lfo_rate_mhz": 11,
+    "lfo_division": 12,
+    "lfo_depth": 13,
+}
+
+# In the order ctl_fill_stats() sends them, before the lateness histogram
+COUNTERS = [
+    "sched_fired", "sched_dropped", "sched_max_lateness_us",
+    "scan_frames", "scan_probes", "scan_idle_entries", "scan_wakes",
+    "scan_last_wake_latency_us", "scan_max_wake_latency_us", "scan_frame_queue_full",
+    "xip_hits", "xip_accesses",
+    "sync_out_dropped", "looper_dropped", "kv_erases",
+    "ctl_bad_frames", "ctl_tx_dropped",
+    "scan_min_poll_period_us", "scan_max_poll_period_us", "scan_late_polls",
+    "health_late_checks", "health_scan_stalls", "health_analog_stalls", "health_recoveries",
+    "health_watchdog_reboot",
+]
+
+# Must match SCHED_LATENESS_BUCKETS in include/sched.h
+SCHED_LATENESS_BUCKETS = 16
+
+REPLY_TIMEOUT_S = 2.0
+
+
+def crc16(data):
+    """CRC-16/CCITT-FALSE, same as frame_crc16()"""
+    crc = 0xffff
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xffff
+    return crc
+
+
+def cobs_encode(data):
+    out = bytearray([0])
+    code_idx = 0
+    code = 1
+    for byte in data:
+        if byte:
+            out.append(byte)
+            code += 1
+        if not byte or code == 0xff:
+            out[code_idx] = code
+            code_idx = len(out)
+            out.append(0)
+            code = 1
+    out[code_idx] = code
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if not code or i + code > len(data):
+            raise ValueError("bad COBS")
+        out += data[i + 1:i + code]
+        i += code
+        if code != 0xff and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def encode_frame(payload):
+    return cobs_encode(payload + struct.pack("<H", crc16(payload))) + b"\x00"
+
+
+def decode_frame(data):
+    """Returns the payload, or None if the frame is bad"""
+    try:
+        decoded = cobs_decode(data)
+    except ValueError:
+        return None
+    if len(decoded) < 2:
+        return None
+    payload, crc = decoded[:-2], struct.unpack("<H", decoded[-2:])[0]
+    return payload if crc16(payload) == crc else None
+
+
+class Device:
+    def __init__(self, port):
+        self.port = port
+        self.seq = 0
+        self.buf = bytearray()
+
+    def read_frame(self, deadline):
+        while time.monotonic() < deadline:
+            end = self.buf.find(b"\x00")
+            if end < 0:
+                self.buf += self.port.read(max(1, self.port.in_waiting))
+                continue
+            data, self.buf = bytes(self.buf[:end]), self.buf[end + 1:]
+            payload = decode_frame(data)
+            if payload is not None and len(payload) >= 3:
+                return payload
+        return None
+
+    def request(self, cmd, args=b""):
+        # 0 is left for streamed stats
+        self.seq = self.seq % 255 + 1
+        self.port.write(encode_frame(bytes([cmd, self.seq]) + args))
+
+        deadline = time.monotonic() + REPLY_TIMEOUT_S
+        while True:
+            payload = self.read_frame(deadline)
+            if payload is None:
+                sys.exit("no reply")
+            if payload[0] == cmd | CTL_RESPONSE and payload[1] == self.seq:
+                break
+
+        status = payload[2]
+        if status:
+            name = STATUSES[status] if status < len(STATUSES) else str(status)
+            sys.exit("error: {}".format(name))
+        return payload[3:]
+
+
+def print_stats(data):
+    if not data or data[0] != CTL_STATS_VERSION:
+        sys.exit("unsupported stats version")
+
+    values = struct.unpack("<{}I".format(len(COUNTERS) + SCHED_LATENESS_BUCKETS), data[1:])
+    for name, value in zip(COUNTERS, values):
+        print("{}: {}".format(name, value))
+
+    # Bucket 0 is < 1us, bucket n is [2^(n-1), 2^n) us, the last is the rest
+    histogram = values[len(COUNTERS):]
+    for bucket, count in enumerate(histogram):
+        if not count:
+            continue
+        low = 0 if not bucket else 1 << (bucket - 1)
+        high = "" if bucket == SCHED_LATENESS_BUCKETS - 1 else str(1 << bucket)
+        print("sched_lateness_us[{}, {}): {}".format(low, high, count))
+
+
+def cmd_stats(dev, args):
+    print_stats(dev.request(CMD_STATS))
+
+    if not args.stream:
+        return
+
+    dev.request(CMD_STREAM, struct.pack("<H", args.stream))
+    try:
+        while True:
+            payload = dev.read_frame(time.monotonic() + REPLY_TIMEOUT_S + args.stream / 1000)
+            if payload is None:
+                sys.exit("stream stopped")
+            if payload[0] == CMD_STATS | CTL_RESPONSE and payload[1] == 0:
+                print()
+                print_stats(payload[3:])
+    except KeyboardInterrupt:
+        dev.request(CMD_STREAM, struct.pack("<H", 0))
+
+
+def write_out(data, path):
+    if path:
+        with open(path, "wb") as f:
+            f.write(data)
+    else:
+        print(data.hex())
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", help="serial port of the control interface")
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    sub.add_parser("ping")
+
+    get = sub.add_parser("get")
+    get.add_argument("param", choices=PARAMS)
+
+    set_ = sub.add_parser("set")
+    set_.add_argument("param", choices=PARAMS)
+    set_.add_argument("value", type=int)
+
+    stats = sub.add_parser("stats")
+    stats.add_argument("--stream", type=int, metavar="MS", help="keep printing them every MS")
+
+    for name in ("tuning-read", "pattern-read"):
+        read = sub.add_parser(name)
+        read.add_argument("slot", type=int)
+        read.add_argument("--out", help="file to write to (default: print hex)")
+
+    for name in ("tuning-write", "pattern-write"):
+        write = sub.add_parser(name)
+        write.add_argument("slot", type=int)
+        write.add_argument("file")
+        if name == "tuning-write":
+            write.add_argument("--select", action="store_true", help="switch to the tuning afterwards")
+
+    select = sub.add_parser("tuning-select")
+    select.add_argument("slot", type=int)
+
+    args = parser.parse_args()
+
+    with serial.Serial(args.port, timeout=0.05) as port:
+        port.reset_input_buffer()
+        dev = Device(port)
+
+        if args.command == "ping":
+            version, max_payload = struct.unpack("<BH", dev.request(CMD_PING))
+            print("version {}, max payload {}".format(version, max_payload))
+        elif args.command in ("get", "set"):
+            param = PARAMS[args.param]
+            if args.command == "get":
+                data = dev.request(CMD_PARAM_GET, bytes([param]))
+            else:
+                data = dev.request(CMD_PARAM_SET, struct.pack("<Bi", param, args.value))
+            print("{}: {}".format(args.param, struct.unpack("<Bi", data)[1]))
+        elif args.command == "stats":
+            cmd_stats(dev, args)
+        elif args.command == "tuning-read":
+            write_out(dev.request(CMD_TUNING_READ, bytes([args.slot]))[1:], args.out)
+        elif args.command == "pattern-read":
+            write_out(dev.request(CMD_PATTERN_READ, bytes([args.slot]))[1:], args.out)
+        elif args.command in ("tuning-write", "pattern-write"):
+            with open(args.file, "rb") as f:
+                data = f.read()
+            cmd = CMD_TUNING_WRITE if args.command == "tuning-write" else CMD_PATTERN_WRITE
+            dev.request(cmd, bytes([args.slot]) + data)
+            if args.command == "tuning-write" and args.select:
+                dev.request(CMD_TUNING_SELECT, bytes([args.slot]))
+            print("ok")
+        elif args.command == "tuning-select":
+            dev.request(CMD_TUNING_SELECT, bytes([args.slot]))
+            print("ok")
+
+
+if __name__ == "__main__":
+    main()
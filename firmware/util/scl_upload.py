@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""
+Uploads a Scala tuning to one of the keyboard's tuning slots over the USB
+console, eg:
+
+    ./scl_upload.py /dev/ttyACM0 1 19edo.scl
+    ./scl_upload.py /dev/ttyACM0 2 just.scl --kbm just.kbm --select
+
+Slot 0 is the built in 12-TET tuning and can't be replaced. The files are
+parsed on the device; see include/tuning.h for what is supported.
+
+Needs pyserial.
+"""
+import argparse
+import sys
+import time
+
+import serial
+
+# Must match TUNING_NUM_SLOTS in include/tuning.h
+TUNING_NUM_SLOTS = 9
+
+# Must match CONSOLE_LINE_LEN in include/console.h, less the terminator
+MAX_LINE_LEN = 95
+
+REPLY_TIMEOUT_S = 2.0
+
+
+def read_lines(path):
+    with open(path, "r", encoding="latin-1") as f:
+        lines = [line.rstrip("\r\n") for line in f]
+
+    for number, line in enumerate(lines, 1):
+        if len(line) > MAX_LINE_LEN and not line.lstrip().startswith("!"):
+            sys.exit("{}:{}: line is too long for the device".format(path, number))
+
+    # Comments are skipped on the device anyway, so don't bother sending
+    # long ones
+    return [line[:MAX_LINE_LEN] for line in lines]
+
+
+def command(port, line):
+    port.write((line + "\n").encode("latin-1"))
+
+    deadline = time.monotonic() + REPLY_TIMEOUT_S
+    while time.monotonic() < deadline:
+        reply = port.readline().decode("latin-1", errors="replace").strip()
+        # Skip over anything else on the console, like trace records
+        if reply.startswith("tuning:"):
+            return reply
+
+    sys.exit("no reply to '{}'".format(line))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", help="serial port of the USB console")
+    parser.add_argument("slot", type=int, help="tuning slot, 1 to {}".format(TUNING_NUM_SLOTS - 1))
+    parser.add_argument("scl", help=".scl file")
+    parser.add_argument("--kbm", help=".kbm file (default: linear mapping from middle C)")
+    parser.add_argument("--select", action="store_true", help="switch to the tuning afterwards")
+    args = parser.parse_args()
+
+    if not 1 <= args.slot < TUNING_NUM_SLOTS:
+        sys.exit("slot must be between 1 and {}".format(TUNING_NUM_SLOTS - 1))
+
+    with serial.Serial(args.port, timeout=0.1) as port:
+        port.reset_input_buffer()
+
+        port.write("tuning scl {}\n".format(args.slot).encode("latin-1"))
+        for line in read_lines(args.scl):
+            port.write((line + "\n").encode("latin-1"))
+
+        if args.kbm:
+            port.write(b"tuning kbm\n")
+            for line in read_lines(args.kbm):
+                port.write((line + "\n").encode("latin-1"))
+
+        reply = command(port, "tuning end")
+        if reply != "tuning: ok":
+            sys.exit(reply)
+
+        if args.select:
+            reply = command(port, "tuning select {}".format(args.slot))
+            if reply != "tuning: ok":
+                sys.exit(reply)
+
+    print("uploaded to slot {}".format(args.slot))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""
+Decodes trace records from the keyboard firmware in to a readable log.
+
+Accepts either the hex lines emitted by trace_drain() on stdio:
+
+    ./trace_decode.py serial_log.txt
+
+or a raw dump of the g_trace symbol taken over SWD, eg:
+
+    arm-none-eabi-nm keyboard.elf | grep g_trace
+    openocd ... -c "init; halt; dump_image trace.bin <g_trace addr> 6168; exit"
+    ./trace_decode.py --raw trace.bin
+"""
+import argparse
+import re
+import struct
+import sys
+
+# Keep in sync with enum trace_id in include/trace.h
+TRACE_IDS = {
+    0: "NONE",
+    1: "BOOT",
+    2: "IO_EVENT",
+    3: "SYNC_CN",
+    4: "SYNC_IN",
+    5: "MATRIX_GHOST",
+    6: "SCAN_WAKE",
+    7: "KEY_FRAME",
+    8: "KEY_REPAIR",
+    9: "CORE1_STALL",
+}
+
+# Must match TRACE_RING_SIZE in include/trace.h
+TRACE_RING_SIZE = 256
+
+RING_HEADER = struct.Struct("<III")
+RECORD = struct.Struct("<IHHI")
+
+LINE_RE = re.compile(r"^@(\d):([0-9a-f]{8}):([0-9a-f]{4}):([0-9a-f]{4}):([0-9a-f]{8})$")
+OVERFLOW_RE = re.compile(r"^@(\d):overflow:([0-9a-f]{8})$")
+
+
+def format_record(core, timestamp, trace_id, a, b):
+    name = TRACE_IDS.get(trace_id, "UNKNOWN({})".format(trace_id))
+    return "{:>12.3f} ms  core{}  {:<12} a={:<5} b={}".format(
+        timestamp / 1000.0, core, name, a, b)
+
+
+def decode_lines(stream):
+    for line in stream:
+        line = line.strip()
+
+        match = LINE_RE.match(line)
+        if match:
+            core, timestamp, trace_id, a, b = match.groups()
+            print(format_record(int(core), int(timestamp, 16), int(trace_id, 16),
+                                int(a, 16), int(b, 16)))
+            continue
+
+        match = OVERFLOW_RE.match(line)
+        if match:
+            core, overflows = match.groups()
+            print("core{}: {} records dropped so far".format(core, int(overflows, 16)))
+
+
+def decode_raw(data):
+    ring_size = RING_HEADER.size + RECORD.size * TRACE_RING_SIZE
+    records = []
+
+    for core in range(2):
+        offset = core * ring_size
+        if len(data) < offset + ring_size:
+            sys.exit("dump is too short for core{}'s ring".format(core))
+
+        head, tail, overflows = RING_HEADER.unpack_from(data, offset)
+        print("core{}: head={} tail={} overflows={}".format(core, head, tail, overflows))
+
+        # Everything still in the ring, including records that have already
+        # been drained but not yet overwritten
+        start = max(head - TRACE_RING_SIZE, 0)
+        for i in range(start, head):
+            idx = i & (TRACE_RING_SIZE - 1)
+            fields = RECORD.unpack_from(data, offset + RING_HEADER.size + idx * RECORD.size)
+            records.append((core,) + fields)
+
+    records.sort(key=lambda r: r[1])
+    for record in records:
+        print(format_record(*record))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", nargs="?", help="log file or raw dump (default: stdin)")
+    parser.add_argument("--raw", action="store_true", help="input is a raw dump of g_trace")
+    args = parser.parse_args()
+
+    if args.raw:
+        if not args.input:
+            sys.exit("--raw needs an input file")
+        with open(args.input, "rb") as f:
+            decode_raw(f.read())
+    elif args.input:
+        with open(args.input, "r", errors="replace") as f:
+            decode_lines(f)
+    else:
+        decode_lines(sys.stdin)
+
+
+if __name__ == "__main__":
+    main()